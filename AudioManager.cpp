@@ -1,692 +1,6653 @@
 #include <AudioManager.hpp>
 #include <OpenAL/al.h>
 #include <OpenAL/alc.h>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#if defined(__AVX__) || (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)))
+#	include <immintrin.h>
+#elif defined(__SSSE3__)
+#	include <tmmintrin.h>
+#elif defined(__SSE2__)
+#	include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#	include <arm_neon.h>
+#endif
+#if defined(_WIN32)
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+#if !defined(AUDIOMANAGER_STATS)
+#	define AUDIOMANAGER_STATS 1
+#endif
 
 constexpr ALuint INVALID_AL_ID = 0;
+constexpr unsigned int INVALID_POOL_INDEX = ~0u;
+constexpr unsigned int POOL_PAGE_SLOTS = 64;
+constexpr ALsizei AL_NAME_CHUNK = 16;
+constexpr size_t DEFAULT_MAX_VOICES = 32;
+constexpr float VOICE_FADE_TIME = 0.05f;
+constexpr float VOICE_CULL_AUDIBILITY = 0.001f;
+constexpr float SPEED_OF_SOUND = 343.3f;
+constexpr float DOPPLER_MAX_VELOCITY = SPEED_OF_SOUND * 0.99f;
+constexpr float PI = 3.14159265358979323846f;
+constexpr std::chrono::microseconds AUDIO_THREAD_IDLE_WAIT(1000);
+constexpr size_t DEFAULT_CACHE_BUDGET = 64 << 20;
+constexpr size_t CACHE_INITIAL_BUCKETS = 64;
+constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+constexpr uint64_t FNV_PRIME = 0x100000001b3ull;
+constexpr size_t MAX_LOAD_WORKERS = 4;
+constexpr size_t LOAD_PREFAULT_STRIDE = 4096;
+constexpr size_t MAX_DECODERS = 8;
+constexpr size_t DECODE_CHUNK_FRAMES = 4096;
+constexpr size_t MAX_RESAMPLE_PHASES = 1024;
+constexpr uint32_t NORMALIZED_CACHE_MAGIC = 0x314E4D41; // "AMN1"
+constexpr size_t FORMAT_TABLE_SIZE = AudioManager::AudioBuffer::FORMAT_STEREO_MSADPCM + 1;
+constexpr size_t STATS_HISTOGRAM_BUCKETS = sizeof(AudioManager::OperationStats::histogram) / sizeof(size_t);
+constexpr size_t MAX_CHAIN_EFFECTS = 8;
+constexpr size_t MAX_EFFECT_CHANNELS = 8;
+constexpr size_t EFFECT_PARAMETER_COUNT = AudioManager::EffectChain::PARAM_RELEASE + 1;
+constexpr size_t EFFECT_RAMP_FRAMES = 32;
+constexpr float EFFECT_RAMP_RATE = 0.25f;
+constexpr float MAX_EFFECT_DELAY = 2.f;
+constexpr size_t REVERB_COMBS = 4;
+constexpr size_t REVERB_ALLPASSES = 2;
+constexpr size_t EFFECT_LINES = REVERB_COMBS + REVERB_ALLPASSES;
+constexpr size_t REVERB_SPREAD = 23;
+constexpr float REVERB_INPUT_GAIN = 0.06f;
+constexpr float REVERB_DAMPING = 0.2f;
+constexpr float REVERB_ALLPASS_FEEDBACK = 0.5f;
 
-ALCdevice *_g_al_device = 0;
-int _g_handles = 0;
+enum AudioCommandType
+{
+	CMD_SOURCE_CREATE,
+	CMD_SOURCE_DELETE,
+	CMD_SOURCE_PROPERTY,
+	CMD_SOURCE_PLAY,
+	CMD_SOURCE_PAUSE,
+	CMD_SOURCE_STOP,
+	CMD_GROUP_PLAY,
+	CMD_GROUP_PAUSE,
+	CMD_GROUP_STOP,
+	CMD_BUFFER_CREATE,
+	CMD_BUFFER_DELETE,
+	CMD_BUFFER_DATA,
+	CMD_LISTENER
+};
+
+constexpr unsigned int SOURCE_DIRTY_LOOP         = 0x001;
+constexpr unsigned int SOURCE_DIRTY_PITCH        = 0x002;
+constexpr unsigned int SOURCE_DIRTY_GAIN         = 0x004;
+constexpr unsigned int SOURCE_DIRTY_MIN_GAIN     = 0x008;
+constexpr unsigned int SOURCE_DIRTY_MAX_GAIN     = 0x010;
+constexpr unsigned int SOURCE_DIRTY_MAX_DISTANCE = 0x020;
+constexpr unsigned int SOURCE_DIRTY_POSITION     = 0x040;
+constexpr unsigned int SOURCE_DIRTY_VELOCITY     = 0x080;
+constexpr unsigned int SOURCE_DIRTY_DIRECTION    = 0x100;
+constexpr unsigned int SOURCE_DIRTY_BUFFER       = 0x200;
+constexpr unsigned int SOURCE_DIRTY_ALL          = 0x3FF;
+
+constexpr unsigned int LISTENER_DIRTY_POSITION    = 0x1;
+constexpr unsigned int LISTENER_DIRTY_VELOCITY    = 0x2;
+constexpr unsigned int LISTENER_DIRTY_ORIENTATION = 0x4;
+
+// Slot map backing newBuffer/newSource. Slots live in fixed-size pages so object addresses
+// stay stable as the pool grows; a handle is only honoured while its generation matches.
+template <class T>
+struct ObjectPool
+{
+	struct Slot
+	{
+		alignas(T) unsigned char storage[sizeof(T)];
+		unsigned int generation;
+		unsigned int next_free;
+		bool live;
+	};
+	Slot **pages;
+	unsigned int page_count;
+	unsigned int free_head;
+	unsigned int live_count;
+	ObjectPool() :
+		pages(0),
+		page_count(0),
+		free_head(INVALID_POOL_INDEX),
+		live_count(0)
+	{}
+	~ObjectPool()
+	{
+		for(unsigned int i = 0; i < page_count; ++i)
+			delete[] pages[i];
+		free(pages);
+	}
+	Slot* slot(unsigned int index) const
+	{
+		if(index >= page_count * POOL_PAGE_SLOTS)
+			return 0;
+		return &pages[index / POOL_PAGE_SLOTS][index % POOL_PAGE_SLOTS];
+	}
+	T* get(const AudioManager::Handle& handle) const
+	{
+		Slot *_slot = this->slot(handle.index);
+		if(!_slot || !_slot->live || _slot->generation != handle.generation)
+			return 0;
+		return (T*)_slot->storage;
+	}
+	void* allocate(AudioManager::Handle& handle)
+	{
+		if(free_head == INVALID_POOL_INDEX)
+		{
+			Slot **new_pages = (Slot**)realloc(pages, (page_count + 1) * sizeof(Slot*));
+			if(!new_pages)
+				return 0;
+			pages = new_pages;
+			Slot *page = new Slot[POOL_PAGE_SLOTS];
+			unsigned int base = page_count * POOL_PAGE_SLOTS;
+			for(unsigned int i = 0; i < POOL_PAGE_SLOTS; ++i)
+			{
+				page[i].generation = 1;
+				page[i].next_free = i + 1 < POOL_PAGE_SLOTS ? base + i + 1 : INVALID_POOL_INDEX;
+				page[i].live = false;
+			}
+			pages[page_count++] = page;
+			free_head = base;
+		}
+		Slot *_slot = this->slot(free_head);
+		handle.index = free_head;
+		handle.generation = _slot->generation;
+		free_head = _slot->next_free;
+		_slot->live = true;
+		++live_count;
+		return _slot->storage;
+	}
+	// Retiring invalidates the handle; the storage is only reused once recycled. The
+	// threaded mode retires on the calling thread and recycles on the audio thread.
+	void retire(unsigned int index)
+	{
+		Slot *_slot = this->slot(index);
+		if(!_slot || !_slot->live)
+			return;
+		_slot->live = false;
+		++_slot->generation;
+	}
+	void recycle(unsigned int index)
+	{
+		Slot *_slot = this->slot(index);
+		if(!_slot || _slot->live)
+			return;
+		_slot->next_free = free_head;
+		free_head = index;
+		--live_count;
+	}
+	void release(unsigned int index)
+	{
+		this->retire(index);
+		this->recycle(index);
+	}
+};
+
+// Growable array for plain data; only ever grows, clearing just resets the count.
+template <class T>
+struct PodArray
+{
+	T *items;
+	size_t count;
+	size_t capacity;
+	PodArray() :
+		items(0),
+		count(0),
+		capacity(0)
+	{}
+	~PodArray()
+	{
+		free(items);
+	}
+	bool push(const T& item)
+	{
+		if(count == capacity)
+		{
+			size_t new_capacity = capacity ? capacity * 2 : (size_t)AL_NAME_CHUNK;
+			T *new_items = (T*)realloc(items, new_capacity * sizeof(T));
+			if(!new_items)
+				return false;
+			items = new_items;
+			capacity = new_capacity;
+		}
+		items[count++] = item;
+		return true;
+	}
+};
+
+// Pre-generated AL names handed out by newBuffer/newSource.
+typedef PodArray<ALuint> NameStock;
+
+struct SpinLock
+{
+	std::atomic_flag flag = ATOMIC_FLAG_INIT;
+	void lock()
+	{
+		while(flag.test_and_set(std::memory_order_acquire))
+			std::this_thread::yield();
+	}
+	void unlock()
+	{
+		flag.clear(std::memory_order_release);
+	}
+};
+
+struct AudioCommand
+{
+	std::atomic<AudioCommand*> next;
+	AudioCommandType type;
+	unsigned int flags;
+	unsigned int serial;
+	void *target;
+	const void *object;
+	float values[6];
+	void *payload;
+	size_t size;
+	size_t frequency;
+	uint64_t time;
+	AudioManager::AudioBuffer::Format format;
+	bool mapped;
+	AudioCommand(AudioCommandType _type = CMD_LISTENER, void* _target = 0) :
+		next(0),
+		type(_type),
+		flags(0),
+		serial(0),
+		target(_target),
+		object(0),
+		values{0.f, 0.f, 0.f, 0.f, 0.f, 0.f},
+		payload(0),
+		size(0),
+		frequency(0),
+		time(0),
+		format(AudioManager::AudioBuffer::FORMAT_NONE),
+		mapped(false)
+	{}
+};
+
+// Intrusive multi-producer single-consumer queue (Vyukov). Producers never wait on each
+// other or on the consumer; pop may report empty while a push is half done.
+struct CommandQueue
+{
+	std::atomic<AudioCommand*> head;
+	AudioCommand *tail;
+	AudioCommand stub;
+	CommandQueue() :
+		head(&stub),
+		tail(&stub),
+		stub()
+	{}
+	void push(AudioCommand* command)
+	{
+		command->next.store(0, std::memory_order_relaxed);
+		AudioCommand *previous = head.exchange(command, std::memory_order_acq_rel);
+		previous->next.store(command, std::memory_order_release);
+	}
+	AudioCommand* pop()
+	{
+		AudioCommand *_tail = tail;
+		AudioCommand *next = _tail->next.load(std::memory_order_acquire);
+		if(_tail == &stub)
+		{
+			if(!next)
+				return 0;
+			tail = _tail = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+		if(next)
+		{
+			tail = next;
+			return _tail;
+		}
+		if(_tail != head.load(std::memory_order_acquire))
+			return 0;
+		this->push(&stub);
+		next = _tail->next.load(std::memory_order_acquire);
+		if(next)
+		{
+			tail = next;
+			return _tail;
+		}
+		return 0;
+	}
+};
+
+struct StateResult
+{
+	AudioManager::Handle handle;
+	AudioManager::AudioSource::State state;
+	unsigned int serial;
+};
+
+struct UploadResult
+{
+	AudioManager::Handle handle;
+	AudioManager::AudioBuffer::Format format;
+	size_t size;
+	size_t frequency;
+	bool success;
+};
+
+// A group start waiting on the device clock when AL_SOFT_source_start_delay is missing.
+struct ScheduledStart
+{
+	AudioManager::AudioSource *source;
+	uint64_t time;
+	unsigned int serial;
+};
+
+typedef ALCboolean (*PFN_alcSetThreadContext)(ALCcontext* context);
+typedef ALCcontext* (*PFN_alcGetThreadContext)();
+
+// Backs AudioManager::Device. Every manager created on the device holds one reference and the
+// ALC device closes when the last one is released.
+struct DeviceData
+{
+	ALCdevice *device;
+	std::atomic<size_t> ref_count;
+	DeviceData() :
+		device(0),
+		ref_count(1)
+	{}
+};
+typedef ALCdevice* (*PFN_alcLoopbackOpenDeviceSOFT)(const ALCchar* device_name);
+typedef ALCboolean (*PFN_alcIsRenderFormatSupportedSOFT)(ALCdevice* device, ALCsizei frequency, ALCenum channels, ALCenum type);
+typedef void (*PFN_alcRenderSamplesSOFT)(ALCdevice* device, ALCvoid* buffer, ALCsizei samples);
+
+// Enum values fixed by the ALC_SOFT_loopback specification.
+constexpr ALCint LOOPBACK_FORMAT_CHANNELS = 0x1990;
+constexpr ALCint LOOPBACK_FORMAT_TYPE = 0x1991;
+constexpr ALCint LOOPBACK_TYPE_FLOAT = 0x1406;
+
+typedef void (*PFN_alcGetInteger64vSOFT)(ALCdevice* device, ALCenum pname, ALCsizei size, int64_t* values);
+typedef void (*PFN_alGetSourcedvSOFT)(ALuint source, ALenum param, ALdouble* values);
+typedef void (*PFN_alSourcePlayAtTimevSOFT)(ALsizei n, const ALuint* sources, int64_t start_time);
+
+// Enum values fixed by the ALC_SOFT_HRTF, ALC_SOFT_device_clock and AL_SOFT_source_latency specifications.
+constexpr ALCint HRTF_SOFT = 0x1992;
+constexpr ALCint DEVICE_CLOCK_LATENCY_SOFT = 0x1602;
+constexpr ALenum SEC_OFFSET_LATENCY_SOFT = 0x1201;
+
+static ALCint _loopbackChannels(size_t channel_count)
+{
+	switch(channel_count)
+	{
+		case 1: return 0x1500;
+		case 2: return 0x1501;
+		case 4: return 0x1503;
+		case 6: return 0x1504;
+		case 7: return 0x1505;
+		case 8: return 0x1506;
+		default: return 0;
+	}
+}
+
+typedef void (*PFN_alGenObjects)(ALsizei n, ALuint* names);
+typedef void (*PFN_alDeleteObjects)(ALsizei n, const ALuint* names);
+typedef void (*PFN_alObjecti)(ALuint name, ALenum param, ALint value);
+typedef void (*PFN_alObjectf)(ALuint name, ALenum param, ALfloat value);
+
+// Enum values fixed by the ALC_EXT_EFX specification.
+constexpr ALCint EFX_MAX_AUXILIARY_SENDS = 0x20003;
+constexpr ALenum EFX_DIRECT_FILTER = 0x20005;
+constexpr ALenum EFX_AUXILIARY_SEND_FILTER = 0x20006;
+constexpr ALenum EFX_FILTER_TYPE = 0x8001;
+constexpr ALint EFX_FILTER_LOWPASS = 0x0001;
+constexpr ALint EFX_FILTER_HIGHPASS = 0x0002;
+constexpr ALenum EFX_LOWPASS_GAINHF = 0x0002;
+constexpr ALenum EFX_HIGHPASS_GAINLF = 0x0002;
+constexpr ALenum EFX_EFFECT_TYPE = 0x8001;
+constexpr ALint EFX_EFFECT_REVERB = 0x0001;
+constexpr ALint EFX_EFFECT_ECHO = 0x0004;
+constexpr ALenum EFX_REVERB_DECAY_TIME = 0x0005;
+constexpr ALenum EFX_ECHO_DELAY = 0x0001;
+constexpr ALenum EFX_ECHO_FEEDBACK = 0x0004;
+constexpr ALenum EFX_EFFECTSLOT_EFFECT = 0x0001;
+constexpr ALenum EFX_EFFECTSLOT_GAIN = 0x0002;
+constexpr float EFX_ECHO_MAX_DELAY = 0.207f;
+// EFX filters are shelves rather than a cutoff; these set where a cutoff maps to full gain.
+constexpr float EFX_LOWPASS_REFERENCE = 5000.f;
+constexpr float EFX_HIGHPASS_REFERENCE = 250.f;
+
+struct EfxFunctions
+{
+	PFN_alGenObjects gen_filters;
+	PFN_alDeleteObjects delete_filters;
+	PFN_alObjecti filteri;
+	PFN_alObjectf filterf;
+	PFN_alGenObjects gen_effects;
+	PFN_alDeleteObjects delete_effects;
+	PFN_alObjecti effecti;
+	PFN_alObjectf effectf;
+	PFN_alGenObjects gen_slots;
+	PFN_alDeleteObjects delete_slots;
+	PFN_alObjecti sloti;
+	PFN_alObjectf slotf;
+	ALCint max_sends;
+};
+
+static bool _loadEfx(ALCdevice* device, EfxFunctions& efx)
+{
+	memset(&efx, 0, sizeof(efx));
+	if(!alcIsExtensionPresent(device, "ALC_EXT_EFX"))
+		return false;
+	efx.gen_filters = (PFN_alGenObjects)alGetProcAddress("alGenFilters");
+	efx.delete_filters = (PFN_alDeleteObjects)alGetProcAddress("alDeleteFilters");
+	efx.filteri = (PFN_alObjecti)alGetProcAddress("alFilteri");
+	efx.filterf = (PFN_alObjectf)alGetProcAddress("alFilterf");
+	efx.gen_effects = (PFN_alGenObjects)alGetProcAddress("alGenEffects");
+	efx.delete_effects = (PFN_alDeleteObjects)alGetProcAddress("alDeleteEffects");
+	efx.effecti = (PFN_alObjecti)alGetProcAddress("alEffecti");
+	efx.effectf = (PFN_alObjectf)alGetProcAddress("alEffectf");
+	efx.gen_slots = (PFN_alGenObjects)alGetProcAddress("alGenAuxiliaryEffectSlots");
+	efx.delete_slots = (PFN_alDeleteObjects)alGetProcAddress("alDeleteAuxiliaryEffectSlots");
+	efx.sloti = (PFN_alObjecti)alGetProcAddress("alAuxiliaryEffectSloti");
+	efx.slotf = (PFN_alObjectf)alGetProcAddress("alAuxiliaryEffectSlotf");
+	alcGetIntegerv(device, EFX_MAX_AUXILIARY_SENDS, 1, &efx.max_sends);
+	if(!efx.gen_filters || !efx.delete_filters || !efx.filteri || !efx.filterf || !efx.gen_effects || !efx.delete_effects ||
+		!efx.effecti || !efx.effectf || !efx.gen_slots || !efx.delete_slots || !efx.sloti || !efx.slotf)
+	{
+		memset(&efx, 0, sizeof(efx));
+		return false;
+	}
+	return true;
+}
+
+struct VoiceRank
+{
+	float score;
+	AudioManager::Voice *voice;
+};
+
+static bool _rankGreater(const VoiceRank& a, const VoiceRank& b)
+{
+	return a.score > b.score;
+}
+
+// A build that does not target AVX itself still gets an 8-wide kernel on CPUs with AVX2.
+#if !defined(__AVX__) && defined(__SSE2__) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define EMITTER_AVX2 __attribute__((target("avx2")))
+
+static bool _cpuSupportsAvx2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+// Structure-of-arrays copy of the playing voices so the audibility kernel can run 8 (AVX, or AVX2
+// picked at run time) or 4 (SSE/NEON) emitters per instruction. Cone angles are stored as cosines
+// of the half angles.
+struct EmitterBatch
+{
+	enum Column
+	{
+		POSITION_X, POSITION_Y, POSITION_Z,
+		VELOCITY_X, VELOCITY_Y, VELOCITY_Z,
+		DIRECTION_X, DIRECTION_Y, DIRECTION_Z,
+		GAIN, MAX_DISTANCE, CONE_INNER, CONE_OUTER, CONE_OUTER_GAIN, SPATIAL,
+		AUDIBILITY, DOPPLER,
+		COLUMN_COUNT
+	};
+	float *storage;
+	AudioManager::Voice **voices;
+	size_t count;
+	size_t capacity;
+#if defined(EMITTER_AVX2)
+	bool avx2;
+#endif
+	EmitterBatch() :
+		storage(0),
+		voices(0),
+		count(0),
+		capacity(0)
+#if defined(EMITTER_AVX2)
+		, avx2(_cpuSupportsAvx2())
+#endif
+	{}
+	~EmitterBatch()
+	{
+		free(storage);
+		free(voices);
+	}
+	float* column(Column column_index)
+	{
+		return storage + column_index * capacity;
+	}
+	bool reserve(size_t _capacity)
+	{
+		if(_capacity <= capacity)
+			return true;
+		size_t new_capacity = capacity ? capacity : (size_t)POOL_PAGE_SLOTS;
+		while(new_capacity < _capacity)
+			new_capacity *= 2;
+		float *new_storage = (float*)malloc(new_capacity * COLUMN_COUNT * sizeof(float));
+		AudioManager::Voice **new_voices = (AudioManager::Voice**)malloc(new_capacity * sizeof(AudioManager::Voice*));
+		if(!new_storage || !new_voices)
+		{
+			free(new_storage);
+			free(new_voices);
+			return false;
+		}
+		free(storage);
+		free(voices);
+		storage = new_storage;
+		voices = new_voices;
+		capacity = new_capacity;
+		count = 0;
+		return true;
+	}
+};
+
+// Scalar reference for one emitter; the vector paths below evaluate the same expressions in the
+// same order, so lanes match it unless the compiler contracts the scalar code into FMAs. It only
+// feeds voice ranking and virtual time, never the mix itself. Distance attenuation is the clamped
+// inverse model with the AL defaults, the cone is interpolated in cosine space and Doppler follows
+// the AL 1.1 formula with a factor of 1.
+static void _emitterAudibility(EmitterBatch& batch, size_t i, const float* listener)
+{
+	float tx = batch.column(EmitterBatch::POSITION_X)[i] - listener[0];
+	float ty = batch.column(EmitterBatch::POSITION_Y)[i] - listener[1];
+	float tz = batch.column(EmitterBatch::POSITION_Z)[i] - listener[2];
+	float distance = sqrtf(tx*tx + ty*ty + tz*tz);
+	float attenuation = 1.f / std::max(std::min(distance, batch.column(EmitterBatch::MAX_DISTANCE)[i]), 1.f);
+	float dx = batch.column(EmitterBatch::DIRECTION_X)[i];
+	float dy = batch.column(EmitterBatch::DIRECTION_Y)[i];
+	float dz = batch.column(EmitterBatch::DIRECTION_Z)[i];
+	float cone_scale = sqrtf(dx*dx + dy*dy + dz*dz) * distance;
+	float cosine = -(dx*tx + dy*ty + dz*tz) / std::max(cone_scale, FLT_MIN);
+	float inner = batch.column(EmitterBatch::CONE_INNER)[i];
+	float t = (inner - cosine) / std::max(inner - batch.column(EmitterBatch::CONE_OUTER)[i], FLT_MIN);
+	t = std::min(std::max(t, 0.f), 1.f);
+	float cone = cone_scale > 0.f ? 1.f + t * (batch.column(EmitterBatch::CONE_OUTER_GAIN)[i] - 1.f) : 1.f;
+	float inverse_distance = distance > 0.f ? 1.f / std::max(distance, FLT_MIN) : 0.f;
+	float listener_speed = (tx*listener[3] + ty*listener[4] + tz*listener[5]) * inverse_distance;
+	float source_speed = (tx*batch.column(EmitterBatch::VELOCITY_X)[i] + ty*batch.column(EmitterBatch::VELOCITY_Y)[i] + tz*batch.column(EmitterBatch::VELOCITY_Z)[i]) * inverse_distance;
+	listener_speed = std::min(listener_speed, DOPPLER_MAX_VELOCITY);
+	source_speed = std::min(source_speed, DOPPLER_MAX_VELOCITY);
+	float doppler = (SPEED_OF_SOUND - listener_speed) / (SPEED_OF_SOUND - source_speed);
+	bool spatial = batch.column(EmitterBatch::SPATIAL)[i] != 0.f;
+	batch.column(EmitterBatch::AUDIBILITY)[i] = batch.column(EmitterBatch::GAIN)[i] * (spatial ? attenuation * cone : 1.f);
+	batch.column(EmitterBatch::DOPPLER)[i] = spatial ? doppler : 1.f;
+}
+
+#if defined(__AVX__)
+#	define EMITTER_LANES 8
+typedef __m256 EmitterVector;
+static inline EmitterVector _evLoad(const float* p) { return _mm256_loadu_ps(p); }
+static inline void _evStore(float* p, EmitterVector v) { _mm256_storeu_ps(p, v); }
+static inline EmitterVector _evSet(float f) { return _mm256_set1_ps(f); }
+static inline EmitterVector _evAdd(EmitterVector a, EmitterVector b) { return _mm256_add_ps(a, b); }
+static inline EmitterVector _evSub(EmitterVector a, EmitterVector b) { return _mm256_sub_ps(a, b); }
+static inline EmitterVector _evMul(EmitterVector a, EmitterVector b) { return _mm256_mul_ps(a, b); }
+static inline EmitterVector _evDiv(EmitterVector a, EmitterVector b) { return _mm256_div_ps(a, b); }
+static inline EmitterVector _evSqrt(EmitterVector a) { return _mm256_sqrt_ps(a); }
+static inline EmitterVector _evMin(EmitterVector a, EmitterVector b) { return _mm256_min_ps(a, b); }
+static inline EmitterVector _evMax(EmitterVector a, EmitterVector b) { return _mm256_max_ps(a, b); }
+static inline EmitterVector _evSelectPositive(EmitterVector condition, EmitterVector a, EmitterVector b) { return _mm256_blendv_ps(b, a, _mm256_cmp_ps(condition, _mm256_setzero_ps(), _CMP_GT_OQ)); }
+static inline EmitterVector _evSelectNonZero(EmitterVector condition, EmitterVector a, EmitterVector b) { return _mm256_blendv_ps(b, a, _mm256_cmp_ps(condition, _mm256_setzero_ps(), _CMP_NEQ_UQ)); }
+#elif defined(__SSE2__)
+#	define EMITTER_LANES 4
+typedef __m128 EmitterVector;
+static inline EmitterVector _evLoad(const float* p) { return _mm_loadu_ps(p); }
+static inline void _evStore(float* p, EmitterVector v) { _mm_storeu_ps(p, v); }
+static inline EmitterVector _evSet(float f) { return _mm_set1_ps(f); }
+static inline EmitterVector _evAdd(EmitterVector a, EmitterVector b) { return _mm_add_ps(a, b); }
+static inline EmitterVector _evSub(EmitterVector a, EmitterVector b) { return _mm_sub_ps(a, b); }
+static inline EmitterVector _evMul(EmitterVector a, EmitterVector b) { return _mm_mul_ps(a, b); }
+static inline EmitterVector _evDiv(EmitterVector a, EmitterVector b) { return _mm_div_ps(a, b); }
+static inline EmitterVector _evSqrt(EmitterVector a) { return _mm_sqrt_ps(a); }
+static inline EmitterVector _evMin(EmitterVector a, EmitterVector b) { return _mm_min_ps(a, b); }
+static inline EmitterVector _evMax(EmitterVector a, EmitterVector b) { return _mm_max_ps(a, b); }
+static inline EmitterVector _evSelectMask(EmitterVector mask, EmitterVector a, EmitterVector b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+static inline EmitterVector _evSelectPositive(EmitterVector condition, EmitterVector a, EmitterVector b) { return _evSelectMask(_mm_cmpgt_ps(condition, _mm_setzero_ps()), a, b); }
+static inline EmitterVector _evSelectNonZero(EmitterVector condition, EmitterVector a, EmitterVector b) { return _evSelectMask(_mm_cmpneq_ps(condition, _mm_setzero_ps()), a, b); }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#	define EMITTER_LANES 4
+typedef float32x4_t EmitterVector;
+static inline EmitterVector _evLoad(const float* p) { return vld1q_f32(p); }
+static inline void _evStore(float* p, EmitterVector v) { vst1q_f32(p, v); }
+static inline EmitterVector _evSet(float f) { return vdupq_n_f32(f); }
+static inline EmitterVector _evAdd(EmitterVector a, EmitterVector b) { return vaddq_f32(a, b); }
+static inline EmitterVector _evSub(EmitterVector a, EmitterVector b) { return vsubq_f32(a, b); }
+static inline EmitterVector _evMul(EmitterVector a, EmitterVector b) { return vmulq_f32(a, b); }
+static inline EmitterVector _evDiv(EmitterVector a, EmitterVector b) { return vdivq_f32(a, b); }
+static inline EmitterVector _evSqrt(EmitterVector a) { return vsqrtq_f32(a); }
+static inline EmitterVector _evMin(EmitterVector a, EmitterVector b) { return vminq_f32(a, b); }
+static inline EmitterVector _evMax(EmitterVector a, EmitterVector b) { return vmaxq_f32(a, b); }
+static inline EmitterVector _evSelectPositive(EmitterVector condition, EmitterVector a, EmitterVector b) { return vbslq_f32(vcgtq_f32(condition, vdupq_n_f32(0.f)), a, b); }
+static inline EmitterVector _evSelectNonZero(EmitterVector condition, EmitterVector a, EmitterVector b) { return vbslq_f32(vceqq_f32(condition, vdupq_n_f32(0.f)), b, a); }
+#endif
+
+#if defined(EMITTER_AVX2)
+EMITTER_AVX2 static inline __m256 _ev8Load(const float* p) { return _mm256_loadu_ps(p); }
+EMITTER_AVX2 static inline void _ev8Store(float* p, __m256 v) { _mm256_storeu_ps(p, v); }
+EMITTER_AVX2 static inline __m256 _ev8Set(float f) { return _mm256_set1_ps(f); }
+EMITTER_AVX2 static inline __m256 _ev8Add(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+EMITTER_AVX2 static inline __m256 _ev8Sub(__m256 a, __m256 b) { return _mm256_sub_ps(a, b); }
+EMITTER_AVX2 static inline __m256 _ev8Mul(__m256 a, __m256 b) { return _mm256_mul_ps(a, b); }
+EMITTER_AVX2 static inline __m256 _ev8Div(__m256 a, __m256 b) { return _mm256_div_ps(a, b); }
+EMITTER_AVX2 static inline __m256 _ev8Sqrt(__m256 a) { return _mm256_sqrt_ps(a); }
+EMITTER_AVX2 static inline __m256 _ev8Min(__m256 a, __m256 b) { return _mm256_min_ps(a, b); }
+EMITTER_AVX2 static inline __m256 _ev8Max(__m256 a, __m256 b) { return _mm256_max_ps(a, b); }
+EMITTER_AVX2 static inline __m256 _ev8SelectPositive(__m256 condition, __m256 a, __m256 b) { return _mm256_blendv_ps(b, a, _mm256_cmp_ps(condition, _mm256_setzero_ps(), _CMP_GT_OQ)); }
+EMITTER_AVX2 static inline __m256 _ev8SelectNonZero(__m256 condition, __m256 a, __m256 b) { return _mm256_blendv_ps(b, a, _mm256_cmp_ps(condition, _mm256_setzero_ps(), _CMP_NEQ_UQ)); }
+
+// The 8-wide lanes of _computeAudibility, term for term; returns where the scalar tail starts.
+EMITTER_AVX2 static size_t _computeAudibilityAvx2(EmitterBatch& batch, const float* listener)
+{
+	size_t i = 0;
+	const __m256 zero = _ev8Set(0.f), one = _ev8Set(1.f), minimum = _ev8Set(FLT_MIN);
+	const __m256 speed_of_sound = _ev8Set(SPEED_OF_SOUND), max_velocity = _ev8Set(DOPPLER_MAX_VELOCITY);
+	const __m256 lx = _ev8Set(listener[0]), ly = _ev8Set(listener[1]), lz = _ev8Set(listener[2]);
+	const __m256 lvx = _ev8Set(listener[3]), lvy = _ev8Set(listener[4]), lvz = _ev8Set(listener[5]);
+	for(; i + 8 <= batch.count; i += 8)
+	{
+		__m256 tx = _ev8Sub(_ev8Load(batch.column(EmitterBatch::POSITION_X) + i), lx);
+		__m256 ty = _ev8Sub(_ev8Load(batch.column(EmitterBatch::POSITION_Y) + i), ly);
+		__m256 tz = _ev8Sub(_ev8Load(batch.column(EmitterBatch::POSITION_Z) + i), lz);
+		__m256 distance = _ev8Sqrt(_ev8Add(_ev8Add(_ev8Mul(tx, tx), _ev8Mul(ty, ty)), _ev8Mul(tz, tz)));
+		__m256 attenuation = _ev8Div(one, _ev8Max(_ev8Min(distance, _ev8Load(batch.column(EmitterBatch::MAX_DISTANCE) + i)), one));
+		__m256 dx = _ev8Load(batch.column(EmitterBatch::DIRECTION_X) + i);
+		__m256 dy = _ev8Load(batch.column(EmitterBatch::DIRECTION_Y) + i);
+		__m256 dz = _ev8Load(batch.column(EmitterBatch::DIRECTION_Z) + i);
+		__m256 cone_scale = _ev8Mul(_ev8Sqrt(_ev8Add(_ev8Add(_ev8Mul(dx, dx), _ev8Mul(dy, dy)), _ev8Mul(dz, dz))), distance);
+		__m256 cosine = _ev8Div(_ev8Sub(zero, _ev8Add(_ev8Add(_ev8Mul(dx, tx), _ev8Mul(dy, ty)), _ev8Mul(dz, tz))), _ev8Max(cone_scale, minimum));
+		__m256 inner = _ev8Load(batch.column(EmitterBatch::CONE_INNER) + i);
+		__m256 t = _ev8Div(_ev8Sub(inner, cosine), _ev8Max(_ev8Sub(inner, _ev8Load(batch.column(EmitterBatch::CONE_OUTER) + i)), minimum));
+		t = _ev8Min(_ev8Max(t, zero), one);
+		__m256 cone = _ev8SelectPositive(cone_scale, _ev8Add(one, _ev8Mul(t, _ev8Sub(_ev8Load(batch.column(EmitterBatch::CONE_OUTER_GAIN) + i), one))), one);
+		__m256 inverse_distance = _ev8SelectPositive(distance, _ev8Div(one, _ev8Max(distance, minimum)), zero);
+		__m256 listener_speed = _ev8Mul(_ev8Add(_ev8Add(_ev8Mul(tx, lvx), _ev8Mul(ty, lvy)), _ev8Mul(tz, lvz)), inverse_distance);
+		__m256 source_speed = _ev8Mul(_ev8Add(_ev8Add(_ev8Mul(tx, _ev8Load(batch.column(EmitterBatch::VELOCITY_X) + i)), _ev8Mul(ty, _ev8Load(batch.column(EmitterBatch::VELOCITY_Y) + i))), _ev8Mul(tz, _ev8Load(batch.column(EmitterBatch::VELOCITY_Z) + i))), inverse_distance);
+		listener_speed = _ev8Min(listener_speed, max_velocity);
+		source_speed = _ev8Min(source_speed, max_velocity);
+		__m256 doppler = _ev8Div(_ev8Sub(speed_of_sound, listener_speed), _ev8Sub(speed_of_sound, source_speed));
+		__m256 spatial = _ev8Load(batch.column(EmitterBatch::SPATIAL) + i);
+		_ev8Store(batch.column(EmitterBatch::AUDIBILITY) + i, _ev8Mul(_ev8Load(batch.column(EmitterBatch::GAIN) + i), _ev8SelectNonZero(spatial, _ev8Mul(attenuation, cone), one)));
+		_ev8Store(batch.column(EmitterBatch::DOPPLER) + i, _ev8SelectNonZero(spatial, doppler, one));
+	}
+	return i;
+}
+#endif
+
+static void _computeAudibility(EmitterBatch& batch, const float* listener)
+{
+	size_t i = 0;
+#if defined(EMITTER_AVX2)
+	if(batch.avx2)
+	{
+		for(i = _computeAudibilityAvx2(batch, listener); i < batch.count; ++i)
+			_emitterAudibility(batch, i, listener);
+		return;
+	}
+#endif
+#if defined(EMITTER_LANES)
+	const EmitterVector zero = _evSet(0.f), one = _evSet(1.f), minimum = _evSet(FLT_MIN);
+	const EmitterVector speed_of_sound = _evSet(SPEED_OF_SOUND), max_velocity = _evSet(DOPPLER_MAX_VELOCITY);
+	const EmitterVector lx = _evSet(listener[0]), ly = _evSet(listener[1]), lz = _evSet(listener[2]);
+	const EmitterVector lvx = _evSet(listener[3]), lvy = _evSet(listener[4]), lvz = _evSet(listener[5]);
+	for(; i + EMITTER_LANES <= batch.count; i += EMITTER_LANES)
+	{
+		EmitterVector tx = _evSub(_evLoad(batch.column(EmitterBatch::POSITION_X) + i), lx);
+		EmitterVector ty = _evSub(_evLoad(batch.column(EmitterBatch::POSITION_Y) + i), ly);
+		EmitterVector tz = _evSub(_evLoad(batch.column(EmitterBatch::POSITION_Z) + i), lz);
+		EmitterVector distance = _evSqrt(_evAdd(_evAdd(_evMul(tx, tx), _evMul(ty, ty)), _evMul(tz, tz)));
+		EmitterVector attenuation = _evDiv(one, _evMax(_evMin(distance, _evLoad(batch.column(EmitterBatch::MAX_DISTANCE) + i)), one));
+		EmitterVector dx = _evLoad(batch.column(EmitterBatch::DIRECTION_X) + i);
+		EmitterVector dy = _evLoad(batch.column(EmitterBatch::DIRECTION_Y) + i);
+		EmitterVector dz = _evLoad(batch.column(EmitterBatch::DIRECTION_Z) + i);
+		EmitterVector cone_scale = _evMul(_evSqrt(_evAdd(_evAdd(_evMul(dx, dx), _evMul(dy, dy)), _evMul(dz, dz))), distance);
+		EmitterVector cosine = _evDiv(_evSub(zero, _evAdd(_evAdd(_evMul(dx, tx), _evMul(dy, ty)), _evMul(dz, tz))), _evMax(cone_scale, minimum));
+		EmitterVector inner = _evLoad(batch.column(EmitterBatch::CONE_INNER) + i);
+		EmitterVector t = _evDiv(_evSub(inner, cosine), _evMax(_evSub(inner, _evLoad(batch.column(EmitterBatch::CONE_OUTER) + i)), minimum));
+		t = _evMin(_evMax(t, zero), one);
+		EmitterVector cone = _evSelectPositive(cone_scale, _evAdd(one, _evMul(t, _evSub(_evLoad(batch.column(EmitterBatch::CONE_OUTER_GAIN) + i), one))), one);
+		EmitterVector inverse_distance = _evSelectPositive(distance, _evDiv(one, _evMax(distance, minimum)), zero);
+		EmitterVector listener_speed = _evMul(_evAdd(_evAdd(_evMul(tx, lvx), _evMul(ty, lvy)), _evMul(tz, lvz)), inverse_distance);
+		EmitterVector source_speed = _evMul(_evAdd(_evAdd(_evMul(tx, _evLoad(batch.column(EmitterBatch::VELOCITY_X) + i)), _evMul(ty, _evLoad(batch.column(EmitterBatch::VELOCITY_Y) + i))), _evMul(tz, _evLoad(batch.column(EmitterBatch::VELOCITY_Z) + i))), inverse_distance);
+		listener_speed = _evMin(listener_speed, max_velocity);
+		source_speed = _evMin(source_speed, max_velocity);
+		EmitterVector doppler = _evDiv(_evSub(speed_of_sound, listener_speed), _evSub(speed_of_sound, source_speed));
+		EmitterVector spatial = _evLoad(batch.column(EmitterBatch::SPATIAL) + i);
+		_evStore(batch.column(EmitterBatch::AUDIBILITY) + i, _evMul(_evLoad(batch.column(EmitterBatch::GAIN) + i), _evSelectNonZero(spatial, _evMul(attenuation, cone), one)));
+		_evStore(batch.column(EmitterBatch::DOPPLER) + i, _evSelectNonZero(spatial, doppler, one));
+	}
+#endif
+	for(; i < batch.count; ++i)
+		_emitterAudibility(batch, i, listener);
+}
+
+typedef void (*PFN_ALEVENTPROCSOFT)(ALenum event_type, ALuint object, ALuint param, ALsizei length, const ALchar* message, void* user_param);
+typedef void (*PFN_alEventControlSOFT)(ALsizei count, const ALenum* types, ALboolean enable);
+typedef void (*PFN_alEventCallbackSOFT)(PFN_ALEVENTPROCSOFT callback, void* user_param);
+
+static AudioManager::AudioSource::State _sourceState(ALint al_state)
+{
+	switch(al_state)
+	{
+		case AL_INITIAL:
+		default: return AudioManager::AudioSource::STATE_INITIAL;
+		case AL_PLAYING: return AudioManager::AudioSource::STATE_PLAYING;
+		case AL_PAUSED: return AudioManager::AudioSource::STATE_PAUSED;
+		case AL_STOPPED: return AudioManager::AudioSource::STATE_STOPPED;
+	}
+}
+
+struct MappedFile;
+
+// One asynchronous load. Workers decode it into either the file mapping itself or converted
+// samples; only the frame thread ever touches the AudioBuffer it belongs to.
+struct LoadJob
+{
+	LoadJob *next;
+	char *path;
+	AudioManager::Handle handle;
+	AudioManager::AudioBuffer::Format format;
+	MappedFile *mapped_file;
+	void *samples;
+	size_t size;
+	size_t frequency;
+	size_t block_align;
+	bool failed;
+};
+
+struct LoadQueue
+{
+	LoadJob *head;
+	LoadJob *tail;
+	void push(LoadJob* job)
+	{
+		job->next = 0;
+		if(tail)
+			tail->next = job;
+		else
+			head = job;
+		tail = job;
+	}
+	LoadJob* pop()
+	{
+		LoadJob *job = head;
+		if(job && !(head = job->next))
+			tail = 0;
+		return job;
+	}
+};
+
+struct OperationCounters
+{
+	std::atomic<uint64_t> calls;
+	std::atomic<uint64_t> total_ns;
+	std::atomic<uint64_t> max_ns;
+	std::atomic<uint64_t> histogram[STATS_HISTOGRAM_BUCKETS];
+};
+
+// Bumped with relaxed atomics by whichever thread does the work, so they stay on in release builds.
+struct StatsCounters
+{
+	OperationCounters operations[AudioManager::STAT_OPERATION_COUNT];
+	std::atomic<uint64_t> frame_operations;
+	std::atomic<uint64_t> frame_uploaded_bytes;
+	std::atomic<uint64_t> uploaded_bytes;
+	std::atomic<uint64_t> failed_buffers;
+	std::atomic<uint64_t> failed_sources;
+	uint64_t frame_count;
+	uint64_t last_frame_operations;
+	uint64_t last_frame_uploaded_bytes;
+};
+
+// A cached buffer is keyed by its path. Entries nobody holds sit on an LRU list, oldest first.
+struct CacheEntry
+{
+	CacheEntry *next_in_bucket;
+	CacheEntry *lru_prev;
+	CacheEntry *lru_next;
+	uint64_t hash;
+	char *path;
+	AudioManager::AudioBuffer *buffer;
+	size_t ref_count;
+	size_t size;
+};
 
 struct AudioManagerData
 {
 	ALCdevice *device;
 	ALCcontext *context;
+	AudioManager::Device *shared_device;
+	bool updating;
+	unsigned int listener_dirty;
+	AudioManager::AudioSource *dirty_sources;
+	AudioManager::StreamingSource *streams;
+	ObjectPool<AudioManager::AudioBuffer> buffers;
+	ObjectPool<AudioManager::AudioSource> sources;
+	NameStock buffer_names;
+	NameStock source_names;
+	ObjectPool<AudioManager::Voice> voices;
+	PodArray<VoiceRank> voice_ranking;
+	EmitterBatch emitters;
+	PodArray<AudioManager::Handle> finished;
+	size_t finished_head;
+	bool state_events_enabled;
+	std::atomic<unsigned int> state_events;
+	bool threaded;
+	std::atomic<bool> running;
+	std::thread audio_thread;
+	PFN_alcSetThreadContext set_thread_context;
+	PFN_alcGetThreadContext get_thread_context;
+	CommandQueue commands;
+	SpinLock pool_lock;
+	PodArray<AudioManager::AudioSource*> playing;
+	PodArray<StateResult> state_results;
+	PodArray<UploadResult> upload_results;
+	ALenum al_formats[FORMAT_TABLE_SIZE];
+	bool block_alignment;
+	PFN_alcRenderSamplesSOFT render_samples;
+	size_t render_channels;
+	PFN_alcGetInteger64vSOFT get_clock_latency;
+	PFN_alGetSourcedvSOFT get_source_latency;
+	PFN_alSourcePlayAtTimevSOFT play_at_time;
+	PodArray<ScheduledStart> scheduled;
+	PodArray<ALuint> group_names;
+	uint64_t rendered_frames;
+	std::chrono::steady_clock::time_point clock_origin;
+	EfxFunctions efx;
+	AudioManager::EffectChain *chains;
+	AudioManager::EffectChain *master_chain;
+	AudioManager::DecoderFactory decoders[MAX_DECODERS];
+	size_t decoder_count;
+	bool normalize_loads;
+	AudioManager::ResampleQuality resample_quality;
+	char *normalize_cache_directory;
+	size_t device_frequency;
+	std::mutex load_mutex;
+	std::condition_variable load_signal;
+	std::thread load_workers[MAX_LOAD_WORKERS];
+	size_t load_worker_count;
+	bool load_stopping;
+	LoadQueue load_queue;
+	LoadQueue loaded;
+	PodArray<AudioManager::Handle> pending_sources;
+	CacheEntry **cache_buckets;
+	size_t cache_bucket_count;
+	size_t cache_entry_count;
+	CacheEntry *lru_head;
+	CacheEntry *lru_tail;
+	StatsCounters stats;
 	AudioManagerData(ALCdevice* _device = 0, ALCcontext* _context = 0) :
 		device(_device),
-		context(_context)
+		context(_context),
+		shared_device(0),
+		updating(false),
+		listener_dirty(0),
+		dirty_sources(0),
+		streams(0),
+		buffers(),
+		sources(),
+		buffer_names(),
+		source_names(),
+		voices(),
+		voice_ranking(),
+		emitters(),
+		finished(),
+		finished_head(0),
+		state_events_enabled(false),
+		state_events(0),
+		threaded(false),
+		running(false),
+		audio_thread(),
+		set_thread_context(0),
+		get_thread_context(0),
+		commands(),
+		playing(),
+		state_results(),
+		upload_results(),
+		al_formats(),
+		block_alignment(false),
+		render_samples(0),
+		render_channels(0),
+		get_clock_latency(0),
+		get_source_latency(0),
+		play_at_time(0),
+		scheduled(),
+		group_names(),
+		rendered_frames(0),
+		clock_origin(),
+		efx(),
+		chains(0),
+		master_chain(0),
+		decoders(),
+		decoder_count(0),
+		normalize_loads(false),
+		resample_quality(AudioManager::RESAMPLE_MEDIUM),
+		normalize_cache_directory(0),
+		device_frequency(0),
+		load_worker_count(0),
+		load_stopping(false),
+		load_queue{0, 0},
+		loaded{0, 0},
+		pending_sources(),
+		cache_buckets(0),
+		cache_bucket_count(0),
+		cache_entry_count(0),
+		lru_head(0),
+		lru_tail(0),
+		stats()
 	{}
+	~AudioManagerData()
+	{
+		delete[] normalize_cache_directory;
+	}
 };
 
-//
-// AudioManager::AudioBuffer
-//
+// The device clock in nanoseconds: ALC_SOFT_device_clock when the driver has it, the frames
+// mixed so far on a loopback device, and the time since the context was made otherwise.
+static uint64_t _deviceClock(AudioManagerData* data)
+{
+	if(data->get_clock_latency)
+	{
+		int64_t clock_latency[2] = { 0, 0 };
+		data->get_clock_latency(data->device, DEVICE_CLOCK_LATENCY_SOFT, 2, clock_latency);
+		return clock_latency[0] > 0 ? (uint64_t)clock_latency[0] : 0;
+	}
+	if(data->render_samples && data->device_frequency)
+		return data->rendered_frames * 1000000000ull / data->device_frequency;
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - data->clock_origin).count();
+}
 
-AudioManager::AudioBuffer::AudioBuffer(const AudioManager& _audio_manager) :
-	audio_manager(_audio_manager),
-	buffer_id(m_buffer_id),
-	format(buffer_format),
-	size(buffer_size),
-	frequency(buffer_frequency),
-	buffer_format(FORMAT_NONE),
-	buffer_size(0),
-	buffer_frequency(0),
-	m_buffer_id(INVALID_AL_ID)
-{}
+static bool _isScheduled(AudioManagerData* data, const AudioManager::AudioSource* source)
+{
+	for(size_t i = 0; i < data->scheduled.count; ++i)
+	{
+		if(data->scheduled.items[i].source == source)
+			return true;
+	}
+	return false;
+}
 
-AudioManager::AudioBuffer::~AudioBuffer()
+static void _unschedule(AudioManagerData* data, const AudioManager::AudioSource* source)
 {
-	this->destroy();
+	for(size_t i = 0; i < data->scheduled.count; ++i)
+	{
+		if(data->scheduled.items[i].source != source)
+			continue;
+		data->scheduled.items[i] = data->scheduled.items[--data->scheduled.count];
+		return;
+	}
 }
 
-AudioManager::AudioBuffer::AudioBuffer(AudioBuffer&& audio_buffer) :
-	audio_manager(audio_buffer.audio_manager),
-	buffer_id(m_buffer_id),
-	format(buffer_format),
-	size(buffer_size),
-	frequency(buffer_frequency),
-	buffer_format(audio_buffer.buffer_format),
-	buffer_size(audio_buffer.buffer_size),
-	buffer_frequency(audio_buffer.buffer_frequency),
-	m_buffer_id(audio_buffer.m_buffer_id)
+static inline void _countStat(std::atomic<uint64_t>& counter, uint64_t amount = 1)
 {
-	audio_buffer.m_buffer_id = INVALID_AL_ID;
+#if AUDIOMANAGER_STATS
+	counter.fetch_add(amount, std::memory_order_relaxed);
+#else
+	(void)counter;
+	(void)amount;
+#endif
 }
 
-bool AudioManager::AudioBuffer::create()
+static inline void _countUpload(AudioManagerData* data, size_t size)
 {
-	if(!audio_manager.makeCurrent())
-		return false;
-	this->destroy();
-	while(alGetError() != AL_NO_ERROR);
-	alGenBuffers(1, &m_buffer_id);
-	if(alGetError() != AL_NO_ERROR || m_buffer_id == INVALID_AL_ID)
+	_countStat(data->stats.uploaded_bytes, size);
+	_countStat(data->stats.frame_uploaded_bytes, size);
+}
+
+#if AUDIOMANAGER_STATS
+// Latencies land in power-of-two microsecond buckets: under 1us, then [1, 2), [2, 4) and so on.
+static void _recordOperation(StatsCounters& stats, AudioManager::StatOperation operation, uint64_t elapsed_ns)
+{
+	OperationCounters& counters = stats.operations[operation];
+	counters.calls.fetch_add(1, std::memory_order_relaxed);
+	counters.total_ns.fetch_add(elapsed_ns, std::memory_order_relaxed);
+	uint64_t max_ns = counters.max_ns.load(std::memory_order_relaxed);
+	while(elapsed_ns > max_ns && !counters.max_ns.compare_exchange_weak(max_ns, elapsed_ns, std::memory_order_relaxed));
+	size_t bucket = 0;
+	for(uint64_t microseconds = elapsed_ns / 1000; microseconds && bucket + 1 < STATS_HISTOGRAM_BUCKETS; microseconds >>= 1)
+		++bucket;
+	counters.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+	stats.frame_operations.fetch_add(1, std::memory_order_relaxed);
+}
+#endif
+
+// Times a public operation from its first line to whichever return it leaves by.
+struct StatScope
+{
+#if AUDIOMANAGER_STATS
+	AudioManagerData *data;
+	AudioManager::StatOperation operation;
+	std::chrono::steady_clock::time_point start;
+	StatScope(AudioManagerData* _data, AudioManager::StatOperation _operation) :
+		data(_data),
+		operation(_operation),
+		start(std::chrono::steady_clock::now())
+	{}
+	~StatScope()
 	{
-		this->destroy();
-		return false;
+		if(data)
+			_recordOperation(data->stats, operation, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
 	}
-	return true;
+#else
+	StatScope(AudioManagerData*, AudioManager::StatOperation) {}
+#endif
+};
+
+// Takes a name out of the stock, generating a chunk of them at once when it runs dry.
+// Near the implementation's source limit a full chunk can fail, so fall back to one.
+static ALuint _takeName(NameStock& stock, bool sources)
+{
+	if(stock.count == 0)
+	{
+		ALuint names[AL_NAME_CHUNK];
+		for(ALsizei chunk = AL_NAME_CHUNK; chunk > 0 && stock.count == 0; chunk = chunk > 1 ? 1 : 0)
+		{
+			while(alGetError() != AL_NO_ERROR);
+			if(sources)
+				alGenSources(chunk, names);
+			else
+				alGenBuffers(chunk, names);
+			if(alGetError() != AL_NO_ERROR)
+				continue;
+			for(ALsizei i = 0; i < chunk; ++i)
+				stock.push(names[i]);
+		}
+		if(stock.count == 0)
+			return INVALID_AL_ID;
+	}
+	return stock.items[--stock.count];
 }
 
-bool AudioManager::AudioBuffer::destroy()
+// Parks a source name for reuse instead of deleting it. Rewinding leaves it AL_INITIAL like a fresh
+// one, and dropping its EFX routing keeps the next owner off the old slots and lets them be deleted.
+// flushProperties() has no cone to write, so a voice's cone goes back to the AL defaults here.
+static bool _parkSourceName(AudioManagerData* data, ALuint source_id)
 {
-	if(!audio_manager.makeCurrent() || m_buffer_id == INVALID_AL_ID)
-		return false;
-	while(alGetError() != AL_NO_ERROR);
-	alDeleteBuffers(1, &m_buffer_id);
-	buffer_format = FORMAT_NONE;
-	buffer_size = 0;
-	buffer_frequency = 0;
-	m_buffer_id = INVALID_AL_ID;
-	return alGetError() == AL_NO_ERROR;
+	alSourceRewind(source_id);
+	alSourcei(source_id, AL_BUFFER, 0);
+	alSourcef(source_id, AL_CONE_INNER_ANGLE, 360.f);
+	alSourcef(source_id, AL_CONE_OUTER_ANGLE, 360.f);
+	alSourcef(source_id, AL_CONE_OUTER_GAIN, 0.f);
+	if(data->efx.gen_filters)
+	{
+		alSourcei(source_id, EFX_DIRECT_FILTER, 0);
+		for(ALint send = 0; send < data->efx.max_sends; ++send)
+			alSource3i(source_id, EFX_AUXILIARY_SEND_FILTER, 0, send, 0);
+	}
+	return alGetError() == AL_NO_ERROR && data->source_names.push(source_id);
 }
 
-bool AudioManager::AudioBuffer::isValid() const
+struct StreamingSourceData
 {
-	return audio_manager.makeCurrent() && m_buffer_id != INVALID_AL_ID && alIsBuffer(m_buffer_id);
+	FILE *file;
+	AudioManager::Decoder *decoder;
+	ALuint *buffers;
+	uint8_t *chunk;
+	size_t chunk_size;
+	size_t data_offset;
+	size_t data_size;
+	size_t read_offset;
+	size_t block_align;
+	size_t frequency;
+	ALenum al_format;
+	AudioManager::AudioBuffer::Format format;
+	AudioManager::EffectChain *effect_chain;
+	float *effect_samples;
+	bool primed;
+	bool playing;
+	bool end_of_stream;
+	StreamingSourceData() :
+		file(0),
+		decoder(0),
+		buffers(0),
+		chunk(0),
+		chunk_size(0),
+		data_offset(0),
+		data_size(0),
+		read_offset(0),
+		block_align(0),
+		frequency(0),
+		al_format(AL_NONE),
+		format(AudioManager::AudioBuffer::FORMAT_MONO8),
+		effect_chain(0),
+		effect_samples(0),
+		primed(false),
+		playing(false),
+		end_of_stream(false)
+	{}
+};
+
+struct WavInfo
+{
+	uint16_t format_tag;
+	uint16_t channels;
+	uint32_t samples_per_sec;
+	uint16_t block_align;
+	uint16_t bits_per_sample;
+	size_t data_offset;
+	size_t data_size;
+};
+
+constexpr uint16_t WAVE_FORMAT_PCM = 0x0001;
+constexpr uint16_t WAVE_FORMAT_ADPCM = 0x0002;
+constexpr uint16_t WAVE_FORMAT_IEEE_FLOAT = 0x0003;
+constexpr uint16_t WAVE_FORMAT_IMA_ADPCM = 0x0011;
+constexpr uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+constexpr size_t WAVE_FORMAT_SIZE = 16;
+constexpr size_t WAVE_FORMAT_EXTENSIBLE_SIZE = 40;
+
+static inline uint16_t _readLE16(const uint8_t* bytes)
+{
+	return (uint16_t)(bytes[0] | (bytes[1] << 8));
 }
 
-bool AudioManager::AudioBuffer::loadFromFile(const char* wav_file_path)
+static inline uint32_t _readLE32(const uint8_t* bytes)
 {
-	if(!axl::util::File::exists(wav_file_path) || !AudioBuffer::isValid() || !audio_manager.makeCurrent())
-		return false;
-	axl::media::audio::WAV wav;
-	if(!wav.loadFromFile(wav_file_path))
-		return false;
-	Format _format = FORMAT_NONE;
-	void* _data = 0;
-	size_t _size = 0, _frequency = 0;
-	if(wav.format_chunk.format_tag != (uint16_t)axl::media::audio::WAV::WaveFormat::PCM)
+	return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+// An extensible format chunk carries the real format tag in the first two bytes of its sub-format GUID.
+static void _wavReadFormat(const uint8_t* chunk, size_t chunk_size, WavInfo& info)
+{
+	info.format_tag = _readLE16(chunk);
+	info.channels = _readLE16(chunk+2);
+	info.samples_per_sec = _readLE32(chunk+4);
+	info.block_align = _readLE16(chunk+12);
+	info.bits_per_sample = _readLE16(chunk+14);
+	if(info.format_tag == WAVE_FORMAT_EXTENSIBLE && chunk_size >= WAVE_FORMAT_EXTENSIBLE_SIZE)
+		info.format_tag = _readLE16(chunk+24);
+}
+
+// Walks the RIFF chunks up to the start of the data chunk and leaves the file positioned there.
+static bool _wavReadHeader(FILE* file, WavInfo& info)
+{
+	uint8_t header[WAVE_FORMAT_EXTENSIBLE_SIZE];
+	bool has_format = false;
+	if(!file || fread(header, 1, 12, file) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header+8, "WAVE", 4) != 0)
 		return false;
-	switch(wav.format_chunk.bits_per_sample)
+	size_t offset = 12;
+	while(fread(header, 1, 8, file) == 8)
+	{
+		uint32_t chunk_size = _readLE32(header+4);
+		offset += 8;
+		if(memcmp(header, "fmt ", 4) == 0)
+		{
+			size_t format_size = chunk_size >= WAVE_FORMAT_EXTENSIBLE_SIZE ? WAVE_FORMAT_EXTENSIBLE_SIZE : WAVE_FORMAT_SIZE;
+			if(chunk_size < WAVE_FORMAT_SIZE || fread(header, 1, format_size, file) != format_size)
+				return false;
+			_wavReadFormat(header, format_size, info);
+			has_format = true;
+			if(fseek(file, (long)(chunk_size - format_size + (chunk_size & 1)), SEEK_CUR) != 0)
+				return false;
+		}
+		else if(memcmp(header, "data", 4) == 0)
+		{
+			info.data_offset = offset;
+			info.data_size = chunk_size;
+			return has_format;
+		}
+		else if(fseek(file, (long)(chunk_size + (chunk_size & 1)), SEEK_CUR) != 0)
+			return false;
+		offset += chunk_size + (chunk_size & 1);
+	}
+	return false;
+}
+
+// Same walk as _wavReadHeader but over a file image already in memory.
+static bool _wavParseHeader(const uint8_t* bytes, size_t size, WavInfo& info)
+{
+	bool has_format = false;
+	if(!bytes || size < 12 || memcmp(bytes, "RIFF", 4) != 0 || memcmp(bytes+8, "WAVE", 4) != 0)
+		return false;
+	size_t offset = 12;
+	while(offset + 8 <= size)
+	{
+		const uint8_t* chunk = bytes + offset;
+		size_t chunk_size = _readLE32(chunk+4);
+		offset += 8;
+		if(memcmp(chunk, "fmt ", 4) == 0)
+		{
+			if(chunk_size < WAVE_FORMAT_SIZE || offset + WAVE_FORMAT_SIZE > size)
+				return false;
+			_wavReadFormat(chunk+8, std::min(chunk_size, size - offset), info);
+			has_format = true;
+		}
+		else if(memcmp(chunk, "data", 4) == 0)
+		{
+			info.data_offset = offset;
+			info.data_size = chunk_size > size - offset ? size - offset : chunk_size;
+			return has_format;
+		}
+		offset += chunk_size + (chunk_size & 1);
+	}
+	return false;
+}
+
+struct MappedFile
+{
+	const uint8_t *bytes;
+	size_t size;
+#if defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+#endif
+	MappedFile() :
+		bytes(0),
+		size(0)
+#if defined(_WIN32)
+		,file(INVALID_HANDLE_VALUE),
+		mapping(0)
+#endif
+	{}
+};
+
+static bool _mapFile(const char* file_path, MappedFile& mapped_file)
+{
+	if(!file_path)
+		return false;
+#if defined(_WIN32)
+	mapped_file.file = CreateFileA(file_path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if(mapped_file.file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_size;
+	if(!GetFileSizeEx(mapped_file.file, &file_size) || file_size.QuadPart == 0 ||
+		!(mapped_file.mapping = CreateFileMappingA(mapped_file.file, 0, PAGE_READONLY, 0, 0, 0)) ||
+		!(mapped_file.bytes = (const uint8_t*)MapViewOfFile(mapped_file.mapping, FILE_MAP_READ, 0, 0, 0)))
+	{
+		if(mapped_file.mapping)
+			CloseHandle(mapped_file.mapping);
+		CloseHandle(mapped_file.file);
+		mapped_file = MappedFile();
+		return false;
+	}
+	mapped_file.size = (size_t)file_size.QuadPart;
+	return true;
+#else
+	int fd = open(file_path, O_RDONLY);
+	if(fd < 0)
+		return false;
+	struct stat file_stat;
+	if(fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0)
+	{
+		close(fd);
+		return false;
+	}
+	void *address = mmap(0, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(address == MAP_FAILED)
+		return false;
+	madvise(address, (size_t)file_stat.st_size, MADV_SEQUENTIAL);
+	mapped_file.bytes = (const uint8_t*)address;
+	mapped_file.size = (size_t)file_stat.st_size;
+	return true;
+#endif
+}
+
+static void _unmapFile(MappedFile& mapped_file)
+{
+	if(!mapped_file.bytes)
+		return;
+#if defined(_WIN32)
+	UnmapViewOfFile(mapped_file.bytes);
+	CloseHandle(mapped_file.mapping);
+	CloseHandle(mapped_file.file);
+#else
+	munmap((void*)mapped_file.bytes, mapped_file.size);
+#endif
+	mapped_file = MappedFile();
+}
+
+typedef void (*PFN_alBufferDataStatic)(ALint buffer, ALenum format, ALvoid* data, ALsizei size, ALsizei frequency);
+
+static PFN_alBufferDataStatic _alBufferDataStatic()
+{
+	if(!alIsExtensionPresent("AL_EXT_STATIC_BUFFER"))
+		return 0;
+	return (PFN_alBufferDataStatic)alGetProcAddress("alBufferDataStatic");
+}
+
+// 24-bit PCM has no AL format and is always loaded as its 16-bit counterpart.
+static AudioManager::AudioBuffer::Format _wavFormat(uint16_t format_tag, uint16_t channels, uint16_t bits_per_sample)
+{
+	if((format_tag == WAVE_FORMAT_IMA_ADPCM || format_tag == WAVE_FORMAT_ADPCM) && bits_per_sample == 4)
+	{
+		bool ima = format_tag == WAVE_FORMAT_IMA_ADPCM;
+		switch(channels)
+		{
+			case 1: return ima ? AudioManager::AudioBuffer::FORMAT_MONO_IMA4 : AudioManager::AudioBuffer::FORMAT_MONO_MSADPCM;
+			case 2: return ima ? AudioManager::AudioBuffer::FORMAT_STEREO_IMA4 : AudioManager::AudioBuffer::FORMAT_STEREO_MSADPCM;
+		}
+		return AudioManager::AudioBuffer::FORMAT_NONE;
+	}
+	if(format_tag == WAVE_FORMAT_IEEE_FLOAT && bits_per_sample == 32)
+	{
+		switch(channels)
+		{
+			case 1: return AudioManager::AudioBuffer::FORMAT_MONO_FLOAT32;
+			case 2: return AudioManager::AudioBuffer::FORMAT_STEREO_FLOAT32;
+			case 6: return AudioManager::AudioBuffer::FORMAT_51CHN_FLOAT32;
+			case 8: return AudioManager::AudioBuffer::FORMAT_71CHN_FLOAT32;
+		}
+		return AudioManager::AudioBuffer::FORMAT_NONE;
+	}
+	if(format_tag != WAVE_FORMAT_PCM)
+		return AudioManager::AudioBuffer::FORMAT_NONE;
+	switch(bits_per_sample)
 	{
-		default: return false;
 		case 8:
-			switch(wav.format_chunk.channels)
+			switch(channels)
 			{
-				default: return false;
-				case 1: _format = FORMAT_MONO8; break;
-				case 2: _format = FORMAT_STEREO8; break;
+				case 1: return AudioManager::AudioBuffer::FORMAT_MONO8;
+				case 2: return AudioManager::AudioBuffer::FORMAT_STEREO8;
 			}
 			break;
 		case 16:
-			switch(wav.format_chunk.channels)
+		case 24:
+			switch(channels)
+			{
+				case 1: return AudioManager::AudioBuffer::FORMAT_MONO16;
+				case 2: return AudioManager::AudioBuffer::FORMAT_STEREO16;
+				case 6: return AudioManager::AudioBuffer::FORMAT_51CHN16;
+				case 8: return AudioManager::AudioBuffer::FORMAT_71CHN16;
+			}
+			break;
+	}
+	return AudioManager::AudioBuffer::FORMAT_NONE;
+}
+
+static size_t _formatChannels(AudioManager::AudioBuffer::Format format)
+{
+	switch(format)
+	{
+		case AudioManager::AudioBuffer::FORMAT_NONE:
+		default: return 0;
+		case AudioManager::AudioBuffer::FORMAT_MONO8:
+		case AudioManager::AudioBuffer::FORMAT_MONO16:
+		case AudioManager::AudioBuffer::FORMAT_MONO_FLOAT32:
+		case AudioManager::AudioBuffer::FORMAT_MONO_IMA4:
+		case AudioManager::AudioBuffer::FORMAT_MONO_MSADPCM: return 1;
+		case AudioManager::AudioBuffer::FORMAT_STEREO8:
+		case AudioManager::AudioBuffer::FORMAT_STEREO16:
+		case AudioManager::AudioBuffer::FORMAT_STEREO_FLOAT32:
+		case AudioManager::AudioBuffer::FORMAT_STEREO_IMA4:
+		case AudioManager::AudioBuffer::FORMAT_STEREO_MSADPCM: return 2;
+		case AudioManager::AudioBuffer::FORMAT_51CHN16:
+		case AudioManager::AudioBuffer::FORMAT_51CHN_FLOAT32: return 6;
+		case AudioManager::AudioBuffer::FORMAT_71CHN16:
+		case AudioManager::AudioBuffer::FORMAT_71CHN_FLOAT32: return 8;
+	}
+}
+
+// ADPCM has no whole-byte sample size and reports 0; its sizes come from the block layout instead.
+static size_t _formatSampleSize(AudioManager::AudioBuffer::Format format)
+{
+	switch(format)
+	{
+		case AudioManager::AudioBuffer::FORMAT_NONE:
+		default: return 0;
+		case AudioManager::AudioBuffer::FORMAT_MONO8:
+		case AudioManager::AudioBuffer::FORMAT_STEREO8: return 1;
+		case AudioManager::AudioBuffer::FORMAT_MONO16:
+		case AudioManager::AudioBuffer::FORMAT_STEREO16:
+		case AudioManager::AudioBuffer::FORMAT_51CHN16:
+		case AudioManager::AudioBuffer::FORMAT_71CHN16: return 2;
+		case AudioManager::AudioBuffer::FORMAT_MONO_FLOAT32:
+		case AudioManager::AudioBuffer::FORMAT_STEREO_FLOAT32:
+		case AudioManager::AudioBuffer::FORMAT_51CHN_FLOAT32:
+		case AudioManager::AudioBuffer::FORMAT_71CHN_FLOAT32: return 4;
+	}
+}
+
+static size_t _formatFrameSize(AudioManager::AudioBuffer::Format format)
+{
+	return _formatChannels(format) * _formatSampleSize(format);
+}
+
+static AudioManager::AudioBuffer::Format _int16Format(AudioManager::AudioBuffer::Format format)
+{
+	switch(format)
+	{
+		case AudioManager::AudioBuffer::FORMAT_MONO_FLOAT32: return AudioManager::AudioBuffer::FORMAT_MONO16;
+		case AudioManager::AudioBuffer::FORMAT_STEREO_FLOAT32: return AudioManager::AudioBuffer::FORMAT_STEREO16;
+		case AudioManager::AudioBuffer::FORMAT_51CHN_FLOAT32: return AudioManager::AudioBuffer::FORMAT_51CHN16;
+		case AudioManager::AudioBuffer::FORMAT_71CHN_FLOAT32: return AudioManager::AudioBuffer::FORMAT_71CHN16;
+		default: return AudioManager::AudioBuffer::FORMAT_NONE;
+	}
+}
+
+static bool _isCompressed(AudioManager::AudioBuffer::Format format)
+{
+	switch(format)
+	{
+		case AudioManager::AudioBuffer::FORMAT_MONO_IMA4:
+		case AudioManager::AudioBuffer::FORMAT_STEREO_IMA4:
+		case AudioManager::AudioBuffer::FORMAT_MONO_MSADPCM:
+		case AudioManager::AudioBuffer::FORMAT_STEREO_MSADPCM: return true;
+		default: return false;
+	}
+}
+
+static bool _isIma4(AudioManager::AudioBuffer::Format format)
+{
+	return format == AudioManager::AudioBuffer::FORMAT_MONO_IMA4 || format == AudioManager::AudioBuffer::FORMAT_STEREO_IMA4;
+}
+
+// Frames held by an ADPCM block of the given size, which may be a short final block. An IMA block
+// has one frame in its header plus 8 per 4-byte word of each channel; an MS block has two in its
+// header plus one per nibble of each channel.
+static size_t _adpcmFrames(AudioManager::AudioBuffer::Format format, size_t size)
+{
+	size_t channels = _formatChannels(format);
+	if(!_isCompressed(format))
+		return 0;
+	if(_isIma4(format))
+		return size >= 4 * channels ? 1 + (size - 4 * channels) / (4 * channels) * 8 : 0;
+	return size >= 7 * channels ? 2 + (size - 7 * channels) * 2 / channels : 0;
+}
+
+// Frames per full block, or 0 when block_align is not a valid block size for the format.
+static size_t _adpcmBlockFrames(AudioManager::AudioBuffer::Format format, size_t block_align)
+{
+	size_t alignment = _isIma4(format) ? 4 * _formatChannels(format) : _formatChannels(format);
+	if(!_isCompressed(format) || block_align % alignment != 0)
+		return 0;
+	return _adpcmFrames(format, block_align);
+}
+
+static size_t _adpcmFrameCount(AudioManager::AudioBuffer::Format format, size_t size, size_t block_align)
+{
+	size_t block_frames = _adpcmBlockFrames(format, block_align);
+	if(block_frames == 0)
+		return 0;
+	return size / block_align * block_frames + _adpcmFrames(format, size % block_align);
+}
+
+static AudioManager::AudioBuffer::Format _adpcmPcmFormat(AudioManager::AudioBuffer::Format format)
+{
+	return _formatChannels(format) == 1 ? AudioManager::AudioBuffer::FORMAT_MONO16 : AudioManager::AudioBuffer::FORMAT_STEREO16;
+}
+
+static size_t _bufferFrameCount(const AudioManager::AudioBuffer* buffer)
+{
+	if(_isCompressed(buffer->format))
+		return _adpcmFrameCount(buffer->format, buffer->size, buffer->block_align);
+	size_t frame_size = _formatFrameSize(buffer->format);
+	return frame_size ? buffer->size / frame_size : 0;
+}
+
+static ALenum _extensionFormat(const char* extension, const char* format_name)
+{
+	if(!alIsExtensionPresent(extension))
+		return AL_NONE;
+	ALenum al_format = alGetEnumValue(format_name);
+	return al_format == -1 ? AL_NONE : al_format;
+}
+
+// Extension formats are looked up once per context; the table is read-only afterwards so the
+// threaded mode can resolve formats off the audio thread.
+static void _queryFormats(AudioManagerData* data)
+{
+	data->al_formats[AudioManager::AudioBuffer::FORMAT_NONE] = AL_NONE;
+	data->al_formats[AudioManager::AudioBuffer::FORMAT_MONO8] = AL_FORMAT_MONO8;
+	data->al_formats[AudioManager::AudioBuffer::FORMAT_MONO16] = AL_FORMAT_MONO16;
+	data->al_formats[AudioManager::AudioBuffer::FORMAT_STEREO8] = AL_FORMAT_STEREO8;
+	data->al_formats[AudioManager::AudioBuffer::FORMAT_STEREO16] = AL_FORMAT_STEREO16;
+	data->al_formats[AudioManager::AudioBuffer::FORMAT_MONO_FLOAT32] = _extensionFormat("AL_EXT_float32", "AL_FORMAT_MONO_FLOAT32");
+	data->al_formats[AudioManager::AudioBuffer::FORMAT_STEREO_FLOAT32] = _extensionFormat("AL_EXT_float32", "AL_FORMAT_STEREO_FLOAT32");
+	data->al_formats[AudioManager::AudioBuffer::FORMAT_51CHN16] = _extensionFormat("AL_EXT_MCFORMATS", "AL_FORMAT_51CHN16");
+	data->al_formats[AudioManager::AudioBuffer::FORMAT_51CHN_FLOAT32] = _extensionFormat("AL_EXT_MCFORMATS", "AL_FORMAT_51CHN32");
+	data->al_formats[AudioManager::AudioBuffer::FORMAT_71CHN16] = _extensionFormat("AL_EXT_MCFORMATS", "AL_FORMAT_71CHN16");
+	data->al_formats[AudioManager::AudioBuffer::FORMAT_71CHN_FLOAT32] = _extensionFormat("AL_EXT_MCFORMATS", "AL_FORMAT_71CHN32");
+	data->al_formats[AudioManager::AudioBuffer::FORMAT_MONO_IMA4] = _extensionFormat("AL_EXT_IMA4", "AL_FORMAT_MONO_IMA4");
+	data->al_formats[AudioManager::AudioBuffer::FORMAT_STEREO_IMA4] = _extensionFormat("AL_EXT_IMA4", "AL_FORMAT_STEREO_IMA4");
+	data->al_formats[AudioManager::AudioBuffer::FORMAT_MONO_MSADPCM] = _extensionFormat("AL_SOFT_MSADPCM", "AL_FORMAT_MONO_MSADPCM_SOFT");
+	data->al_formats[AudioManager::AudioBuffer::FORMAT_STEREO_MSADPCM] = _extensionFormat("AL_SOFT_MSADPCM", "AL_FORMAT_STEREO_MSADPCM_SOFT");
+	data->block_alignment = alIsExtensionPresent("AL_SOFT_block_alignment") == AL_TRUE;
+}
+
+static ALenum _alFormat(const AudioManagerData* data, AudioManager::AudioBuffer::Format format)
+{
+	return (size_t)format < FORMAT_TABLE_SIZE ? data->al_formats[format] : AL_NONE;
+}
+
+// The format a buffer actually ends up in: float data the AL cannot take is converted to 16-bit.
+static AudioManager::AudioBuffer::Format _uploadFormat(const AudioManagerData* data, AudioManager::AudioBuffer::Format format)
+{
+	if(_alFormat(data, format) != AL_NONE)
+		return format;
+	AudioManager::AudioBuffer::Format int16_format = _int16Format(format);
+	return _alFormat(data, int16_format) != AL_NONE ? int16_format : AudioManager::AudioBuffer::FORMAT_NONE;
+}
+
+// Keeps the top 16 bits of each little-endian 24-bit sample.
+static void _convertPcm24(const uint8_t* source, int16_t* destination, size_t count)
+{
+	size_t i = 0;
+#if defined(__SSSE3__)
+	const __m128i low_mask = _mm_setr_epi8(1, 2, 4, 5, 7, 8, 10, 11, 13, 14, -1, -1, -1, -1, -1, -1);
+	const __m128i high_mask = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 8, 9, 11, 12, 14, 15);
+	for(; i + 8 <= count; i += 8)
+	{
+		__m128i low = _mm_loadu_si128((const __m128i*)(source + i*3));
+		__m128i high = _mm_loadu_si128((const __m128i*)(source + i*3 + 8));
+		__m128i samples = _mm_or_si128(_mm_shuffle_epi8(low, low_mask), _mm_shuffle_epi8(high, high_mask));
+		_mm_storeu_si128((__m128i*)(destination + i), samples);
+	}
+#elif defined(__ARM_NEON)
+	for(; i + 8 <= count; i += 8)
+	{
+		uint8x8x3_t bytes = vld3_u8(source + i*3);
+		uint16x8_t samples = vorrq_u16(vmovl_u8(bytes.val[1]), vshlq_n_u16(vmovl_u8(bytes.val[2]), 8));
+		vst1q_s16(destination + i, vreinterpretq_s16_u16(samples));
+	}
+#endif
+	for(; i < count; ++i)
+		destination[i] = (int16_t)(source[i*3+1] | (source[i*3+2] << 8));
+}
+
+// Scales, clamps and rounds to nearest like cvtps2dq so every path produces the same samples.
+static void _convertFloat32(const void* source, int16_t* destination, size_t count)
+{
+	const uint8_t *bytes = (const uint8_t*)source;
+	size_t i = 0;
+#if defined(__SSE2__)
+	const __m128 scale = _mm_set1_ps(32767.f);
+	const __m128 low = _mm_set1_ps(-32768.f);
+	const __m128 high = _mm_set1_ps(32767.f);
+	for(; i + 8 <= count; i += 8)
+	{
+		__m128 first = _mm_mul_ps(_mm_loadu_ps((const float*)(bytes + i*4)), scale);
+		__m128 second = _mm_mul_ps(_mm_loadu_ps((const float*)(bytes + i*4 + 16)), scale);
+		first = _mm_min_ps(_mm_max_ps(first, low), high);
+		second = _mm_min_ps(_mm_max_ps(second, low), high);
+		_mm_storeu_si128((__m128i*)(destination + i), _mm_packs_epi32(_mm_cvtps_epi32(first), _mm_cvtps_epi32(second)));
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	const float32x4_t scale = vdupq_n_f32(32767.f);
+	for(; i + 8 <= count; i += 8)
+	{
+		float32x4_t first = vmulq_f32(vld1q_f32((const float*)(bytes + i*4)), scale);
+		float32x4_t second = vmulq_f32(vld1q_f32((const float*)(bytes + i*4 + 16)), scale);
+		vst1q_s16(destination + i, vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(first)), vqmovn_s32(vcvtnq_s32_f32(second))));
+	}
+#endif
+	for(; i < count; ++i)
+	{
+		float sample;
+		memcpy(&sample, bytes + i*4, sizeof(sample));
+		sample *= 32767.f;
+		sample = sample < -32768.f ? -32768.f : (sample > 32767.f ? 32767.f : sample);
+		destination[i] = (int16_t)lrintf(sample);
+	}
+}
+
+// Enum value fixed by the AL_SOFT_block_alignment specification; it takes the block size in frames.
+constexpr ALenum UNPACK_BLOCK_ALIGNMENT = 0x200C;
+// Block sizes the AL assumes for ADPCM when AL_SOFT_block_alignment is not there to say otherwise.
+constexpr size_t IMA4_DEFAULT_BLOCK_FRAMES = 65;
+constexpr size_t MSADPCM_DEFAULT_BLOCK_FRAMES = 64;
+
+static const int8_t _imaIndexAdjust[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+static const int16_t _imaSteps[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+	107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871,
+	5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623,
+	27086, 29794, 32767
+};
+static const int16_t _msadpcmAdapt[16] = { 230, 230, 230, 230, 307, 409, 512, 614, 768, 614, 512, 409, 307, 230, 230, 230 };
+// The seven predictors every MS-ADPCM encoder writes; custom tables in the format chunk are not read.
+static const int16_t _msadpcmCoefficients[7][2] = { { 256, 0 }, { 512, -256 }, { 0, 0 }, { 192, 64 }, { 240, 0 }, { 460, -208 }, { 392, -232 } };
+
+static inline int _clampSample(int sample)
+{
+	return sample < -32768 ? -32768 : (sample > 32767 ? 32767 : sample);
+}
+
+static inline int16_t _imaNibble(int& predictor, int& index, int nibble)
+{
+	int step = _imaSteps[index];
+	int difference = step >> 3;
+	if(nibble & 1)
+		difference += step >> 2;
+	if(nibble & 2)
+		difference += step >> 1;
+	if(nibble & 4)
+		difference += step;
+	predictor = _clampSample(nibble & 8 ? predictor - difference : predictor + difference);
+	index += _imaIndexAdjust[nibble];
+	index = index < 0 ? 0 : (index > 88 ? 88 : index);
+	return (int16_t)predictor;
+}
+
+// Each channel's header holds its first sample and step index. The body interleaves the channels
+// in 4-byte words of 8 samples, low nibble first.
+static size_t _decodeImaBlock(const uint8_t* block, size_t size, size_t channels, int16_t* frames)
+{
+	size_t header_size = 4 * channels;
+	if(size < header_size)
+		return 0;
+	size_t word_count = (size - header_size) / header_size;
+	for(size_t channel = 0; channel < channels; ++channel)
+	{
+		int predictor = (int16_t)_readLE16(block + channel * 4);
+		int index = block[channel * 4 + 2] > 88 ? 88 : block[channel * 4 + 2];
+		int16_t *output = frames + channel;
+		*output = (int16_t)predictor;
+		output += channels;
+		const uint8_t *word = block + header_size + channel * 4;
+		for(size_t i = 0; i < word_count; ++i, word += header_size)
+		{
+			for(size_t byte = 0; byte < 4; ++byte)
+			{
+				output[0] = _imaNibble(predictor, index, word[byte] & 0xF);
+				output[channels] = _imaNibble(predictor, index, word[byte] >> 4);
+				output += 2 * channels;
+			}
+		}
+	}
+	return 1 + word_count * 8;
+}
+
+// The header holds per channel a predictor, the initial delta and the two previous samples, oldest
+// last; both samples are output first. Nibbles follow high first, alternating channels in stereo.
+static size_t _decodeMsadpcmBlock(const uint8_t* block, size_t size, size_t channels, int16_t* frames)
+{
+	size_t header_size = 7 * channels;
+	if(size < header_size)
+		return 0;
+	int coefficient1[2], coefficient2[2], delta[2], sample1[2], sample2[2];
+	for(size_t channel = 0; channel < channels; ++channel)
+	{
+		if(block[channel] >= 7)
+			return 0;
+		coefficient1[channel] = _msadpcmCoefficients[block[channel]][0];
+		coefficient2[channel] = _msadpcmCoefficients[block[channel]][1];
+		delta[channel] = (int16_t)_readLE16(block + channels + channel * 2);
+		sample1[channel] = (int16_t)_readLE16(block + channels * 3 + channel * 2);
+		sample2[channel] = (int16_t)_readLE16(block + channels * 5 + channel * 2);
+		frames[channel] = (int16_t)sample2[channel];
+		frames[channels + channel] = (int16_t)sample1[channel];
+	}
+	const uint8_t *bytes = block + header_size;
+	size_t nibble_count = (size - header_size) * 2;
+	int16_t *output = frames + 2 * channels;
+	for(size_t i = 0; i < nibble_count; ++i)
+	{
+		size_t channel = i & (channels - 1);
+		int nibble = (i & 1 ? bytes[i >> 1] : bytes[i >> 1] >> 4) & 0xF;
+		int predicted = (sample1[channel] * coefficient1[channel] + sample2[channel] * coefficient2[channel]) >> 8;
+		int sample = _clampSample(predicted + (nibble >= 8 ? nibble - 16 : nibble) * delta[channel]);
+		sample2[channel] = sample1[channel];
+		sample1[channel] = sample;
+		delta[channel] = (_msadpcmAdapt[nibble] * delta[channel]) >> 8;
+		if(delta[channel] < 16)
+			delta[channel] = 16;
+		output[i] = (int16_t)sample;
+	}
+	return 2 + nibble_count / channels;
+}
+
+static size_t _decodeAdpcmBlock(AudioManager::AudioBuffer::Format format, const uint8_t* block, size_t size, int16_t* frames)
+{
+	if(_isIma4(format))
+		return _decodeImaBlock(block, size, _formatChannels(format), frames);
+	return _decodeMsadpcmBlock(block, size, _formatChannels(format), frames);
+}
+
+// Decodes a whole ADPCM data chunk to 16-bit PCM in memory allocated with malloc.
+static bool _decodeAdpcm(AudioManager::AudioBuffer::Format format, const uint8_t* bytes, size_t size, size_t block_align,
+	AudioManager::AudioBuffer::Format& pcm_format, void*& samples, size_t& pcm_size)
+{
+	size_t frame_count = _adpcmFrameCount(format, size, block_align), channels = _formatChannels(format);
+	if(frame_count == 0 || !(samples = malloc(frame_count * channels * sizeof(int16_t))))
+		return false;
+	int16_t *frames = (int16_t*)samples;
+	for(size_t offset = 0; offset < size; offset += block_align)
+	{
+		size_t block_size = std::min(block_align, size - offset);
+		size_t decoded = _decodeAdpcmBlock(format, bytes + offset, block_size, frames);
+		if(decoded == 0 && _adpcmFrames(format, block_size) > 0)
+		{
+			free(samples);
+			samples = 0;
+			return false;
+		}
+		frames += decoded * channels;
+	}
+	pcm_format = _adpcmPcmFormat(format);
+	pcm_size = frame_count * channels * sizeof(int16_t);
+	return true;
+}
+
+// The AL takes ADPCM as it is when it knows the format and either honours AL_SOFT_block_alignment
+// or the blocks are its default size. A short final block is left to the software decoder.
+static bool _uploadsCompressed(const AudioManagerData* data, AudioManager::AudioBuffer::Format format, size_t size, size_t block_align)
+{
+	size_t block_frames = _adpcmBlockFrames(format, block_align);
+	if(_alFormat(data, format) == AL_NONE || block_frames == 0 || size % block_align != 0)
+		return false;
+	return data->block_alignment || block_frames == (_isIma4(format) ? IMA4_DEFAULT_BLOCK_FRAMES : MSADPCM_DEFAULT_BLOCK_FRAMES);
+}
+
+// Reads an ADPCM WAV a block at a time; it is the first decoder tried for streams and decoded loads.
+class AdpcmDecoder : public AudioManager::Decoder
+{
+	public:
+		AdpcmDecoder() :
+			m_file(0),
+			m_compressed_format(AudioManager::AudioBuffer::FORMAT_NONE),
+			m_data_offset(0),
+			m_data_size(0),
+			m_block_align(0),
+			m_block_frames(0),
+			m_next_block(0),
+			m_block(0),
+			m_frames(0),
+			m_frame_index(0),
+			m_decoded_frames(0)
+		{}
+		~AdpcmDecoder()
+		{
+			this->close();
+		}
+	public:
+		bool open(const char* file_path)
+		{
+			this->close();
+			FILE *file = file_path ? fopen(file_path, "rb") : 0;
+			if(!file)
+				return false;
+			WavInfo info;
+			AudioManager::AudioBuffer::Format format = AudioManager::AudioBuffer::FORMAT_NONE;
+			if(!_wavReadHeader(file, info) || info.samples_per_sec == 0 ||
+				!_isCompressed(format = _wavFormat(info.format_tag, info.channels, info.bits_per_sample)) ||
+				(m_block_frames = _adpcmBlockFrames(format, info.block_align)) == 0)
+			{
+				fclose(file);
+				return false;
+			}
+			m_file = file;
+			m_compressed_format = format;
+			m_data_offset = info.data_offset;
+			m_data_size = info.data_size;
+			m_block_align = info.block_align;
+			m_block = new uint8_t[m_block_align];
+			m_frames = new int16_t[m_block_frames * info.channels];
+			m_next_block = 0;
+			m_frame_index = 0;
+			m_decoded_frames = 0;
+			decoder_format = _adpcmPcmFormat(format);
+			decoder_frequency = info.samples_per_sec;
+			decoder_frame_count = _adpcmFrameCount(format, info.data_size, info.block_align);
+			return true;
+		}
+		size_t read(void* samples, size_t frame_count)
+		{
+			size_t channels = _formatChannels(decoder_format), read = 0;
+			while(m_file && read < frame_count)
+			{
+				if(m_frame_index == m_decoded_frames && !this->decodeBlock())
+					break;
+				size_t count = std::min(frame_count - read, m_decoded_frames - m_frame_index);
+				memcpy((int16_t*)samples + read * channels, m_frames + m_frame_index * channels, count * channels * sizeof(int16_t));
+				read += count;
+				m_frame_index += count;
+			}
+			return read;
+		}
+		bool seek(size_t frame_offset)
+		{
+			if(!m_file || frame_offset > decoder_frame_count)
+				return false;
+			m_next_block = frame_offset / m_block_frames;
+			m_frame_index = 0;
+			m_decoded_frames = 0;
+			if(fseek(m_file, (long)(m_data_offset + m_next_block * m_block_align), SEEK_SET) != 0)
+				return false;
+			if(frame_offset % m_block_frames == 0)
+				return true;
+			if(!this->decodeBlock())
+				return false;
+			m_frame_index = std::min(frame_offset % m_block_frames, m_decoded_frames);
+			return true;
+		}
+		void close()
+		{
+			if(m_file)
+				fclose(m_file);
+			delete[] m_block;
+			delete[] m_frames;
+			m_file = 0;
+			m_block = 0;
+			m_frames = 0;
+			m_frame_index = 0;
+			m_decoded_frames = 0;
+			decoder_format = AudioManager::AudioBuffer::FORMAT_NONE;
+			decoder_frequency = 0;
+			decoder_frame_count = 0;
+		}
+	private:
+		bool decodeBlock()
+		{
+			size_t offset = m_next_block * m_block_align;
+			if(offset >= m_data_size)
+				return false;
+			size_t size = fread(m_block, 1, std::min(m_block_align, m_data_size - offset), m_file);
+			m_decoded_frames = _decodeAdpcmBlock(m_compressed_format, m_block, size, m_frames);
+			m_frame_index = 0;
+			++m_next_block;
+			return m_decoded_frames > 0;
+		}
+	private:
+		FILE *m_file;
+		AudioManager::AudioBuffer::Format m_compressed_format;
+		size_t m_data_offset;
+		size_t m_data_size;
+		size_t m_block_align;
+		size_t m_block_frames;
+		size_t m_next_block;
+		uint8_t *m_block;
+		int16_t *m_frames;
+		size_t m_frame_index;
+		size_t m_decoded_frames;
+};
+
+// The built-in ADPCM decoder gets the first look, then registered decoders in registration order.
+// A decoder must produce an uncompressed format the buffers can describe.
+static AudioManager::Decoder* _openDecoder(const AudioManagerData* data, const char* file_path)
+{
+	AdpcmDecoder *adpcm_decoder = new AdpcmDecoder();
+	if(adpcm_decoder->open(file_path))
+		return adpcm_decoder;
+	delete adpcm_decoder;
+	for(size_t i = 0; i < data->decoder_count; ++i)
+	{
+		AudioManager::Decoder *decoder = data->decoders[i]();
+		if(!decoder)
+			continue;
+		if(decoder->open(file_path))
+		{
+			if(decoder->frequency > 0 && !_isCompressed(decoder->format) && _formatFrameSize(decoder->format) > 0)
+				return decoder;
+			decoder->close();
+		}
+		delete decoder;
+	}
+	return 0;
+}
+
+// Reads a whole file through a decoder. The frame count is only a hint: the samples keep growing
+// until the decoder runs dry, and one spare frame lets an exact count finish without reallocating.
+static bool _decodeFile(const AudioManagerData* data, const char* file_path, AudioManager::AudioBuffer::Format& format, void*& samples, size_t& size, size_t& frequency)
+{
+	AudioManager::Decoder *decoder = _openDecoder(data, file_path);
+	if(!decoder)
+		return false;
+	size_t frame_size = _formatFrameSize(decoder->format), frame_count = 0;
+	size_t capacity = decoder->frame_count > 0 ? decoder->frame_count + 1 : DECODE_CHUNK_FRAMES;
+	uint8_t *frames = (uint8_t*)malloc(capacity * frame_size);
+	while(frames)
+	{
+		if(frame_count == capacity)
+		{
+			uint8_t *grown = (uint8_t*)realloc(frames, capacity * 2 * frame_size);
+			if(!grown)
+			{
+				free(frames);
+				frames = 0;
+				break;
+			}
+			frames = grown;
+			capacity *= 2;
+		}
+		size_t read = decoder->read(frames + frame_count * frame_size, capacity - frame_count);
+		if(read == 0)
+			break;
+		frame_count += read;
+	}
+	format = decoder->format;
+	frequency = decoder->frequency;
+	decoder->close();
+	delete decoder;
+	if(!frames || frame_count == 0)
+	{
+		free(frames);
+		return false;
+	}
+	samples = frames;
+	size = frame_count * frame_size;
+	return true;
+}
+
+static uint64_t _hashBytes(uint64_t hash, const void* bytes, size_t size)
+{
+	for(size_t i = 0; i < size; ++i)
+		hash = (hash ^ ((const uint8_t*)bytes)[i]) * FNV_PRIME;
+	return hash;
+}
+
+struct ResampleProfile
+{
+	size_t taps;
+	double rolloff;
+	double kaiser_beta;
+};
+
+// Indexed by AudioManager::ResampleQuality: longer kernels keep more of the band and reject more images.
+static const ResampleProfile _resampleProfiles[] = { { 8, 0.80, 5.0 }, { 16, 0.90, 7.0 }, { 32, 0.95, 9.0 } };
+
+static double _besselI0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	for(int k = 1; k < 32; ++k)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+static size_t _gcd(size_t a, size_t b)
+{
+	while(b != 0)
+	{
+		size_t remainder = a % b;
+		a = b;
+		b = remainder;
+	}
+	return a;
+}
+
+// Kernel lengths are multiples of 8, so every path covers them without a scalar tail.
+static inline float _dotProduct(const float* a, const float* b, size_t count)
+{
+#if defined(__AVX__)
+	__m256 sum = _mm256_setzero_ps();
+	for(size_t i = 0; i < count; i += 8)
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+	__m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+	half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+	return _mm_cvtss_f32(_mm_add_ss(half, _mm_shuffle_ps(half, half, 1)));
+#elif defined(__SSE2__)
+	__m128 sum = _mm_setzero_ps();
+	for(size_t i = 0; i < count; i += 4)
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	return _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1)));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	float32x4_t sum = vdupq_n_f32(0.f);
+	for(size_t i = 0; i < count; i += 4)
+		sum = vfmaq_f32(sum, vld1q_f32(a + i), vld1q_f32(b + i));
+	return vaddvq_f32(sum);
+#else
+	float sum = 0.f;
+	for(size_t i = 0; i < count; ++i)
+		sum += a[i] * b[i];
+	return sum;
+#endif
+}
+
+// Polyphase FIR resampler. Every output frame falls on one of the fractional positions between two
+// input frames, and each of those phases has its own Kaiser-windowed sinc kernel, built once per call.
+// Rate pairs with more than MAX_RESAMPLE_PHASES exact phases use the nearest of that many instead.
+// Downsampling narrows the passband, so the kernels grow with the ratio to keep the same rejection.
+static bool _resample(const float* input, size_t frame_count, size_t channels, size_t input_rate, size_t output_rate,
+	const ResampleProfile& profile, float*& output, size_t& output_frames)
+{
+	size_t divisor = _gcd(input_rate, output_rate);
+	size_t up = output_rate / divisor, down = input_rate / divisor;
+	size_t phase_count = std::min(up, MAX_RESAMPLE_PHASES), taps = profile.taps * ((input_rate + output_rate - 1) / output_rate), half = taps / 2;
+	output_frames = (size_t)(((uint64_t)frame_count * up + down - 1) / down);
+	float *kernels = (float*)malloc(phase_count * taps * sizeof(float));
+	float *padded = (float*)calloc(frame_count + taps, sizeof(float));
+	output = (float*)malloc(output_frames * channels * sizeof(float));
+	if(!kernels || !padded || !output)
+	{
+		free(kernels);
+		free(padded);
+		free(output);
+		output = 0;
+		return false;
+	}
+	const double pi = 3.14159265358979323846;
+	double cutoff = std::min(1.0, (double)output_rate / (double)input_rate) * profile.rolloff;
+	double window_scale = 1.0 / _besselI0(profile.kaiser_beta);
+	for(size_t phase = 0; phase < phase_count; ++phase)
+	{
+		float *kernel = kernels + phase * taps;
+		double fraction = (double)phase / (double)phase_count, sum = 0.0;
+		for(size_t k = 0; k < taps; ++k)
+		{
+			double x = (double)k - (double)(half - 1) - fraction;
+			double edge = x / (double)half;
+			double window = edge * edge < 1.0 ? _besselI0(profile.kaiser_beta * sqrt(1.0 - edge * edge)) * window_scale : 0.0;
+			double sinc = x == 0.0 ? 1.0 : sin(pi * cutoff * x) / (pi * cutoff * x);
+			kernel[k] = (float)(cutoff * sinc * window);
+			sum += kernel[k];
+		}
+		for(size_t k = 0; k < taps; ++k)
+			kernel[k] = (float)(kernel[k] / sum);
+	}
+	// One channel at a time through a zero-padded copy, so kernel and samples are both contiguous.
+	for(size_t channel = 0; channel < channels; ++channel)
+	{
+		for(size_t i = 0; i < frame_count; ++i)
+			padded[half - 1 + i] = input[i * channels + channel];
+		for(size_t n = 0; n < output_frames; ++n)
+		{
+			uint64_t position = (uint64_t)n * down;
+			size_t index = (size_t)(position / up), phase = (size_t)((position % up * phase_count + up / 2) / up);
+			// Rounding up from the last phase lands on phase 0 of the next input frame.
+			if(phase == phase_count)
 			{
-				default: return false;
-				case 1: _format = FORMAT_MONO16; break;
-				case 2: _format = FORMAT_STEREO16; break;
+				phase = 0;
+				++index;
 			}
+			output[n * channels + channel] = _dotProduct(kernels + phase * taps, padded + index, taps);
+		}
+	}
+	free(kernels);
+	free(padded);
+	return true;
+}
+
+static void _convertToFloat(const uint8_t* bytes, size_t bits_per_sample, size_t count, float* destination)
+{
+	switch(bits_per_sample)
+	{
+		case 8:
+			for(size_t i = 0; i < count; ++i)
+				destination[i] = (float)((int)bytes[i] - 128) * (1.f / 128.f);
+			break;
+		case 16:
+			for(size_t i = 0; i < count; ++i)
+				destination[i] = (float)(int16_t)_readLE16(bytes + i * 2) * (1.f / 32768.f);
+			break;
+		case 24:
+			for(size_t i = 0; i < count; ++i)
+				destination[i] = (float)((int32_t)((uint32_t)_readLE16(bytes + i * 3) << 8 | (uint32_t)bytes[i * 3 + 2] << 24) >> 8) * (1.f / 8388608.f);
 			break;
+		case 32:
+			memcpy(destination, bytes, count * sizeof(float));
+			break;
+	}
+}
+
+static AudioManager::AudioBuffer::Format _pcm16Format(size_t channels)
+{
+	switch(channels)
+	{
+		case 1: return AudioManager::AudioBuffer::FORMAT_MONO16;
+		case 2: return AudioManager::AudioBuffer::FORMAT_STEREO16;
+		case 6: return AudioManager::AudioBuffer::FORMAT_51CHN16;
+		case 8: return AudioManager::AudioBuffer::FORMAT_71CHN16;
+		default: return AudioManager::AudioBuffer::FORMAT_NONE;
+	}
+}
+
+// Loaded samples are normalized to 16-bit PCM at the device rate, keeping their channel count, so the
+// mixer never resamples them. bits_per_sample tells 24-bit PCM apart from the 16-bit format it loads as.
+static bool _normalizes(const AudioManagerData* data, AudioManager::AudioBuffer::Format format, size_t bits_per_sample, size_t frequency)
+{
+	if(!data->normalize_loads)
+		return false;
+	return _isCompressed(format) || bits_per_sample != 16 || (data->device_frequency != 0 && frequency != data->device_frequency);
+}
+
+static bool _fileStamp(const char* file_path, uint64_t& size, uint64_t& time)
+{
+#if defined(_WIN32)
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if(!GetFileAttributesExA(file_path, GetFileExInfoStandard, &attributes))
+		return false;
+	size = (uint64_t)attributes.nFileSizeHigh << 32 | attributes.nFileSizeLow;
+	time = (uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32 | attributes.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat file_stat;
+	if(stat(file_path, &file_stat) != 0)
+		return false;
+	size = (uint64_t)file_stat.st_size;
+	time = (uint64_t)file_stat.st_mtime;
+#endif
+	return true;
+}
+
+// Cache files are machine-local and hold a raw header followed by the samples. The name hashes the
+// source path, size and modification time with the settings, so a changed source misses the cache.
+struct NormalizedCacheHeader
+{
+	uint32_t magic;
+	uint32_t format;
+	uint64_t key;
+	uint64_t frequency;
+	uint64_t size;
+};
+
+static uint64_t _normalizedKey(const AudioManagerData* data, const char* file_path)
+{
+	uint64_t stamp[4] = { 0, 0, data->device_frequency, (uint64_t)data->resample_quality };
+	if(!data->normalize_cache_directory || !_fileStamp(file_path, stamp[0], stamp[1]))
+		return 0;
+	return _hashBytes(_hashBytes(FNV_OFFSET_BASIS, file_path, strlen(file_path)), stamp, sizeof(stamp));
+}
+
+static bool _normalizedCachePath(const AudioManagerData* data, uint64_t key, const char* suffix, char* path, size_t path_size)
+{
+	int length = snprintf(path, path_size, "%s/%016llx%s", data->normalize_cache_directory, (unsigned long long)key, suffix);
+	return length > 0 && (size_t)length < path_size;
+}
+
+static bool _readNormalized(const AudioManagerData* data, const char* file_path, AudioManager::AudioBuffer::Format& format, void*& samples, size_t& size, size_t& frequency)
+{
+	char path[1024];
+	uint64_t key = _normalizedKey(data, file_path);
+	FILE *file = key && _normalizedCachePath(data, key, ".pcm", path, sizeof(path)) ? fopen(path, "rb") : 0;
+	if(!file)
+		return false;
+	NormalizedCacheHeader header;
+	void *cached = 0;
+	bool success = fread(&header, sizeof(header), 1, file) == 1 && header.magic == NORMALIZED_CACHE_MAGIC && header.key == key &&
+		header.size > 0 && header.format < FORMAT_TABLE_SIZE && (cached = malloc((size_t)header.size)) &&
+		fread(cached, 1, (size_t)header.size, file) == header.size;
+	fclose(file);
+	if(!success)
+	{
+		free(cached);
+		return false;
+	}
+	format = (AudioManager::AudioBuffer::Format)header.format;
+	samples = cached;
+	size = (size_t)header.size;
+	frequency = (size_t)header.frequency;
+	return true;
+}
+
+// Written under a per-thread temporary name and renamed into place, so concurrent loads of one file
+// and interrupted writes never leave a partial entry behind.
+static void _writeNormalized(const AudioManagerData* data, const char* file_path, AudioManager::AudioBuffer::Format format, const void* samples, size_t size, size_t frequency)
+{
+	char path[1024], temporary_path[1024], suffix[32];
+	uint64_t key = _normalizedKey(data, file_path);
+	snprintf(suffix, sizeof(suffix), ".%zx.tmp", std::hash<std::thread::id>()(std::this_thread::get_id()));
+	if(!key || !_normalizedCachePath(data, key, ".pcm", path, sizeof(path)) || !_normalizedCachePath(data, key, suffix, temporary_path, sizeof(temporary_path)))
+		return;
+	FILE *file = fopen(temporary_path, "wb");
+	if(!file)
+		return;
+	NormalizedCacheHeader header = { NORMALIZED_CACHE_MAGIC, (uint32_t)format, key, frequency, size };
+	bool success = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(samples, 1, size, file) == size;
+	success = fclose(file) == 0 && success;
+#if defined(_WIN32)
+	success = success && MoveFileExA(temporary_path, path, MOVEFILE_REPLACE_EXISTING);
+#else
+	success = success && rename(temporary_path, path) == 0;
+#endif
+	if(!success)
+		remove(temporary_path);
+}
+
+// Converts to float, resamples when the rate differs and converts back to 16-bit, writing the result
+// to the disk cache when there is one. The samples are allocated with malloc.
+static bool _normalizeSamples(const AudioManagerData* data, const char* file_path, AudioManager::AudioBuffer::Format format, size_t bits_per_sample,
+	const uint8_t* bytes, size_t size, size_t frequency, size_t block_align,
+	AudioManager::AudioBuffer::Format& normalized_format, void*& samples, size_t& normalized_size, size_t& normalized_frequency)
+{
+	void *decoded = 0;
+	if(_isCompressed(format))
+	{
+		if(!_decodeAdpcm(format, bytes, size, block_align, format, decoded, size))
+			return false;
+		bytes = (const uint8_t*)decoded;
+		bits_per_sample = 16;
+	}
+	size_t channels = _formatChannels(format), sample_count = bits_per_sample >= 8 ? size / (bits_per_sample / 8) : 0;
+	AudioManager::AudioBuffer::Format pcm16_format = _pcm16Format(channels);
+	float *input = pcm16_format != AudioManager::AudioBuffer::FORMAT_NONE && sample_count >= channels && frequency > 0 ?
+		(float*)malloc(sample_count * sizeof(float)) : 0;
+	if(input)
+		_convertToFloat(bytes, bits_per_sample, sample_count, input);
+	free(decoded);
+	if(!input)
+		return false;
+	size_t target_frequency = data->device_frequency ? data->device_frequency : frequency;
+	size_t frame_count = sample_count / channels;
+	float *output = input;
+	if(target_frequency != frequency)
+	{
+		bool resampled = _resample(input, frame_count, channels, frequency, target_frequency, _resampleProfiles[data->resample_quality], output, frame_count);
+		free(input);
+		if(!resampled)
+			return false;
+	}
+	size_t output_size = frame_count * channels * sizeof(int16_t);
+	int16_t *pcm = (int16_t*)malloc(output_size);
+	if(pcm)
+		_convertFloat32(output, pcm, frame_count * channels);
+	free(output);
+	if(!pcm)
+		return false;
+	if(data->normalize_cache_directory)
+		_writeNormalized(data, file_path, pcm16_format, pcm, output_size, target_frequency);
+	normalized_format = pcm16_format;
+	samples = pcm;
+	normalized_size = output_size;
+	normalized_frequency = target_frequency;
+	return true;
+}
+
+// Anything that is not a WAV the loader reads directly goes through the decoders. ADPCM the AL
+// cannot take, and normalization, run here on the worker rather than at upload time.
+static void _decodeJob(const AudioManagerData* data, LoadJob& job)
+{
+	WavInfo info;
+	MappedFile mapped_file;
+	AudioManager::AudioBuffer::Format wav_format = AudioManager::AudioBuffer::FORMAT_NONE;
+	job.failed = true;
+	if(data->normalize_loads && _readNormalized(data, job.path, job.format, job.samples, job.size, job.frequency))
+	{
+		job.failed = false;
+		return;
+	}
+	if(!_mapFile(job.path, mapped_file))
+		return;
+	if(!_wavParseHeader(mapped_file.bytes, mapped_file.size, info) ||
+		(wav_format = _wavFormat(info.format_tag, info.channels, info.bits_per_sample)) == AudioManager::AudioBuffer::FORMAT_NONE)
+	{
+		_unmapFile(mapped_file);
+		if(!_decodeFile(data, job.path, job.format, job.samples, job.size, job.frequency))
+			return;
+		job.failed = false;
+		size_t bits_per_sample = _formatSampleSize(job.format) * 8;
+		if(_normalizes(data, job.format, bits_per_sample, job.frequency))
+		{
+			void *decoded = job.samples;
+			job.failed = !_normalizeSamples(data, job.path, job.format, bits_per_sample, (const uint8_t*)decoded, job.size, job.frequency, 0,
+				job.format, job.samples, job.size, job.frequency);
+			if(job.failed)
+				job.samples = 0;
+			free(decoded);
+		}
+		return;
+	}
+	const uint8_t *bytes = mapped_file.bytes + info.data_offset;
+	job.frequency = info.samples_per_sec;
+	if(_normalizes(data, wav_format, info.bits_per_sample, info.samples_per_sec))
+	{
+		job.failed = !_normalizeSamples(data, job.path, wav_format, info.bits_per_sample, bytes, info.data_size, info.samples_per_sec, info.block_align,
+			job.format, job.samples, job.size, job.frequency);
+		_unmapFile(mapped_file);
+		return;
+	}
+	if(_isCompressed(wav_format))
+	{
+		if(!_uploadsCompressed(data, wav_format, info.data_size, info.block_align))
+		{
+			job.failed = !_decodeAdpcm(wav_format, bytes, info.data_size, info.block_align, job.format, job.samples, job.size);
+			_unmapFile(mapped_file);
+			return;
+		}
+		job.format = wav_format;
+		job.block_align = info.block_align;
+	}
+	else if((job.format = _uploadFormat(data, wav_format)) == AudioManager::AudioBuffer::FORMAT_NONE)
+	{
+		_unmapFile(mapped_file);
+		return;
+	}
+	else if(info.bits_per_sample == 24 || job.format != wav_format)
+	{
+		size_t sample_count = info.data_size / (info.bits_per_sample / 8);
+		job.size = sample_count * sizeof(int16_t);
+		if((job.samples = malloc(job.size)))
+		{
+			if(info.bits_per_sample == 24)
+				_convertPcm24(bytes, (int16_t*)job.samples, sample_count);
+			else
+				_convertFloat32(bytes, (int16_t*)job.samples, sample_count);
+			job.failed = false;
+		}
+		_unmapFile(mapped_file);
+		return;
+	}
+	// Fault the pages in here so the upload on the frame thread does not do the disk reads.
+	volatile uint8_t page_sum = 0;
+	for(size_t offset = 0; offset < info.data_size; offset += LOAD_PREFAULT_STRIDE)
+		page_sum += bytes[offset];
+	job.mapped_file = new MappedFile(mapped_file);
+	job.samples = (void*)bytes;
+	job.size = info.data_size;
+	job.failed = false;
+}
+
+static void _releaseJob(LoadJob* job)
+{
+	if(job->mapped_file)
+	{
+		_unmapFile(*job->mapped_file);
+		delete job->mapped_file;
+	}
+	else free(job->samples);
+	delete[] job->path;
+	delete job;
+}
+
+static void _runLoadWorker(AudioManagerData* data)
+{
+	std::unique_lock<std::mutex> lock(data->load_mutex);
+	while(true)
+	{
+		data->load_signal.wait(lock, [data]{ return data->load_stopping || data->load_queue.head; });
+		if(data->load_stopping)
+			return;
+		LoadJob *job = data->load_queue.pop();
+		lock.unlock();
+		_decodeJob(data, *job);
+		lock.lock();
+		data->loaded.push(job);
+	}
+}
+
+static uint64_t _hashPath(const char* path)
+{
+	return _hashBytes(FNV_OFFSET_BASIS, path, strlen(path));
+}
+
+static CacheEntry** _cacheSlot(AudioManagerData* data, uint64_t hash, const char* path)
+{
+	CacheEntry **slot = &data->cache_buckets[hash & (data->cache_bucket_count - 1)];
+	while(*slot && ((*slot)->hash != hash || strcmp((*slot)->path, path) != 0))
+		slot = &(*slot)->next_in_bucket;
+	return slot;
+}
+
+static bool _growCache(AudioManagerData* data)
+{
+	size_t bucket_count = data->cache_bucket_count ? data->cache_bucket_count * 2 : CACHE_INITIAL_BUCKETS;
+	CacheEntry **buckets = (CacheEntry**)calloc(bucket_count, sizeof(CacheEntry*));
+	if(!buckets)
+		return false;
+	for(size_t i = 0; i < data->cache_bucket_count; ++i)
+	{
+		CacheEntry *entry = data->cache_buckets[i];
+		while(entry)
+		{
+			CacheEntry *next = entry->next_in_bucket;
+			CacheEntry **bucket = &buckets[entry->hash & (bucket_count - 1)];
+			entry->next_in_bucket = *bucket;
+			*bucket = entry;
+			entry = next;
+		}
+	}
+	free(data->cache_buckets);
+	data->cache_buckets = buckets;
+	data->cache_bucket_count = bucket_count;
+	return true;
+}
+
+static void _lruUnlink(AudioManagerData* data, CacheEntry* entry)
+{
+	(entry->lru_prev ? entry->lru_prev->lru_next : data->lru_head) = entry->lru_next;
+	(entry->lru_next ? entry->lru_next->lru_prev : data->lru_tail) = entry->lru_prev;
+	entry->lru_prev = entry->lru_next = 0;
+}
+
+static void _lruAppend(AudioManagerData* data, CacheEntry* entry)
+{
+	entry->lru_prev = data->lru_tail;
+	entry->lru_next = 0;
+	(data->lru_tail ? data->lru_tail->lru_next : data->lru_head) = entry;
+	data->lru_tail = entry;
+}
+
+static void _clearCache(AudioManagerData* data)
+{
+	for(size_t i = 0; i < data->cache_bucket_count; ++i)
+	{
+		CacheEntry *entry = data->cache_buckets[i];
+		while(entry)
+		{
+			CacheEntry *next = entry->next_in_bucket;
+			delete[] entry->path;
+			delete entry;
+			entry = next;
+		}
+	}
+	free(data->cache_buckets);
+	data->cache_buckets = 0;
+	data->cache_bucket_count = 0;
+	data->cache_entry_count = 0;
+	data->lru_head = data->lru_tail = 0;
+}
+
+// Parameters are written by any thread and read by whichever thread runs the chain; the
+// processing side eases `current` towards `target` once per sub-block so changes never click.
+struct EffectParameter
+{
+	std::atomic<float> target;
+	float current;
+};
+
+struct EffectLine
+{
+	float *samples;
+	size_t length;
+	size_t position;
+	float feedback;
+	float store;
+};
+
+struct EffectState
+{
+	AudioManager::EffectChain::EffectType type;
+	EffectParameter parameters[EFFECT_PARAMETER_COUNT];
+	float *storage;
+	EffectLine lines[MAX_EFFECT_CHANNELS][EFFECT_LINES];
+	float b0, b1, b2, a1, a2;
+	float z1[MAX_EFFECT_CHANNELS];
+	float z2[MAX_EFFECT_CHANNELS];
+	float filter_cutoff;
+	float filter_resonance;
+	float reverb_decay;
+	float envelope;
+	ALuint efx_effect;
+	ALuint efx_slot;
+};
+
+struct EffectChainData
+{
+	EffectState effects[MAX_CHAIN_EFFECTS];
+	std::atomic<unsigned int> version;
+	unsigned int applied_version;
+	bool efx_built;
+	ALuint efx_filter;
+	size_t efx_filter_effect;
+};
+
+struct ParameterRange
+{
+	float minimum;
+	float maximum;
+	float fallback;
+};
+
+static const ParameterRange _effectParameterRanges[EFFECT_PARAMETER_COUNT] = {
+	{ 10.f, 22000.f, 1000.f },
+	{ 0.1f, 20.f, 0.7071f },
+	{ 0.001f, MAX_EFFECT_DELAY, 0.25f },
+	{ 0.f, 0.95f, 0.35f },
+	{ 0.1f, 20.f, 1.5f },
+	{ 0.f, 1.f, 1.f },
+	{ -60.f, 0.f, -12.f },
+	{ 1.f, 50.f, 4.f },
+	{ 0.0001f, 1.f, 0.005f },
+	{ 0.001f, 5.f, 0.1f }
+};
+
+static const size_t _reverbLineLengths[EFFECT_LINES] = { 1116, 1188, 1277, 1356, 556, 441 };
+
+// Delay lines are the only allocation a chain makes, and it happens here, off the audio path.
+static bool _allocateLines(EffectState& effect, size_t channel_count, size_t frequency)
+{
+	size_t lengths[MAX_EFFECT_CHANNELS][EFFECT_LINES] = {};
+	size_t line_count = 0, total = 0;
+	if(effect.type == AudioManager::EffectChain::EFFECT_DELAY)
+		line_count = 1;
+	else if(effect.type == AudioManager::EffectChain::EFFECT_REVERB)
+		line_count = EFFECT_LINES;
+	for(size_t channel = 0; channel < channel_count; ++channel)
+	{
+		for(size_t line = 0; line < line_count; ++line)
+		{
+			if(effect.type == AudioManager::EffectChain::EFFECT_DELAY)
+				lengths[channel][line] = (size_t)(MAX_EFFECT_DELAY * (float)frequency) + 1;
+			else
+				lengths[channel][line] = std::max<size_t>(1, (_reverbLineLengths[line] + channel * REVERB_SPREAD) * frequency / 44100);
+			total += lengths[channel][line];
+		}
+	}
+	effect.storage = 0;
+	if(total > 0 && !(effect.storage = (float*)calloc(total, sizeof(float))))
+		return false;
+	float *samples = effect.storage;
+	for(size_t channel = 0; channel < MAX_EFFECT_CHANNELS; ++channel)
+	{
+		for(size_t line = 0; line < EFFECT_LINES; ++line)
+		{
+			EffectLine& effect_line = effect.lines[channel][line];
+			effect_line.samples = lengths[channel][line] ? samples : 0;
+			effect_line.length = lengths[channel][line];
+			samples += effect_line.length;
+		}
+	}
+	return true;
+}
+
+static void _resetEffect(EffectState& effect)
+{
+	for(size_t i = 0; i < EFFECT_PARAMETER_COUNT; ++i)
+		effect.parameters[i].current = effect.parameters[i].target.load(std::memory_order_relaxed);
+	for(size_t channel = 0; channel < MAX_EFFECT_CHANNELS; ++channel)
+	{
+		for(size_t line = 0; line < EFFECT_LINES; ++line)
+		{
+			EffectLine& effect_line = effect.lines[channel][line];
+			if(effect_line.samples)
+				memset(effect_line.samples, 0, effect_line.length * sizeof(float));
+			effect_line.position = 0;
+			effect_line.store = 0.f;
+		}
+		effect.z1[channel] = effect.z2[channel] = 0.f;
+	}
+	// Negative markers make the next block derive its coefficients afresh.
+	effect.filter_cutoff = -1.f;
+	effect.reverb_decay = -1.f;
+	effect.envelope = 0.f;
+}
+
+// One-pole approach towards the target that snaps once close, so the DSP settles on the exact value.
+static float _rampParameter(EffectParameter& parameter)
+{
+	float target = parameter.target.load(std::memory_order_relaxed);
+	float step = (target - parameter.current) * EFFECT_RAMP_RATE;
+	parameter.current = fabsf(step) <= 1e-6f * (1.f + fabsf(target)) ? target : parameter.current + step;
+	return parameter.current;
+}
+
+// Gains that scale the signal directly are additionally interpolated per sample across a sub-block.
+struct EffectRamp
+{
+	float value;
+	float step;
+};
+
+static EffectRamp _rampPerSample(EffectParameter& parameter, size_t frame_count)
+{
+	float from = parameter.current;
+	return EffectRamp{ from, (_rampParameter(parameter) - from) / (float)frame_count };
+}
+
+// RBJ cookbook biquad, recomputed only when the ramped cutoff or resonance actually moved.
+static void _updateBiquad(EffectState& effect, float cutoff, float resonance, size_t frequency)
+{
+	if(cutoff == effect.filter_cutoff && resonance == effect.filter_resonance)
+		return;
+	effect.filter_cutoff = cutoff;
+	effect.filter_resonance = resonance;
+	float omega = 2.f * PI * std::min(cutoff, 0.49f * (float)frequency) / (float)frequency;
+	float cosine = cosf(omega), alpha = sinf(omega) / (2.f * resonance);
+	float normal = 1.f / (1.f + alpha);
+	bool lowpass = effect.type == AudioManager::EffectChain::EFFECT_LOWPASS;
+	float side = (lowpass ? 1.f - cosine : 1.f + cosine) * 0.5f * normal;
+	effect.b0 = side;
+	effect.b1 = lowpass ? 2.f * side : -2.f * side;
+	effect.b2 = side;
+	effect.a1 = -2.f * cosine * normal;
+	effect.a2 = (1.f - alpha) * normal;
+}
+
+static void _processFilter(EffectState& effect, float* samples, size_t frame_count, size_t channel_count, size_t frequency)
+{
+	float cutoff = _rampParameter(effect.parameters[AudioManager::EffectChain::PARAM_CUTOFF]);
+	_updateBiquad(effect, cutoff, _rampParameter(effect.parameters[AudioManager::EffectChain::PARAM_RESONANCE]), frequency);
+	EffectRamp mix = _rampPerSample(effect.parameters[AudioManager::EffectChain::PARAM_MIX], frame_count);
+	const float b0 = effect.b0, b1 = effect.b1, b2 = effect.b2, a1 = effect.a1, a2 = effect.a2;
+	for(size_t channel = 0; channel < channel_count; ++channel)
+	{
+		float z1 = effect.z1[channel], z2 = effect.z2[channel], wet = mix.value;
+		for(size_t frame = 0; frame < frame_count; ++frame)
+		{
+			float& sample = samples[frame * channel_count + channel];
+			float input = sample;
+			float output = b0 * input + z1;
+			z1 = b1 * input - a1 * output + z2;
+			z2 = b2 * input - a2 * output;
+			wet += mix.step;
+			sample = input + (output - input) * wet;
+		}
+		effect.z1[channel] = z1;
+		effect.z2[channel] = z2;
+	}
+}
+
+static void _processDelay(EffectState& effect, float* samples, size_t frame_count, size_t channel_count, size_t frequency)
+{
+	size_t delay = (size_t)lrintf(_rampParameter(effect.parameters[AudioManager::EffectChain::PARAM_DELAY_TIME]) * (float)frequency);
+	EffectRamp feedback = _rampPerSample(effect.parameters[AudioManager::EffectChain::PARAM_FEEDBACK], frame_count);
+	EffectRamp mix = _rampPerSample(effect.parameters[AudioManager::EffectChain::PARAM_MIX], frame_count);
+	for(size_t channel = 0; channel < channel_count; ++channel)
+	{
+		EffectLine& line = effect.lines[channel][0];
+		size_t tap = std::min(std::max<size_t>(delay, 1), line.length - 1);
+		size_t position = line.position;
+		float gain = feedback.value, wet = mix.value;
+		for(size_t frame = 0; frame < frame_count; ++frame)
+		{
+			float& sample = samples[frame * channel_count + channel];
+			float input = sample;
+			float delayed = line.samples[position >= tap ? position - tap : position + line.length - tap];
+			gain += feedback.step;
+			wet += mix.step;
+			line.samples[position] = input + delayed * gain;
+			if(++position == line.length)
+				position = 0;
+			sample = input + (delayed - input) * wet;
+		}
+		line.position = position;
+	}
+}
+
+// A small Schroeder/Freeverb tank per channel: parallel damped combs into series allpasses, with
+// the comb lengths spread between channels for width and their feedback set by the decay time.
+static void _processReverb(EffectState& effect, float* samples, size_t frame_count, size_t channel_count, size_t frequency)
+{
+	float decay = _rampParameter(effect.parameters[AudioManager::EffectChain::PARAM_DECAY_TIME]);
+	if(decay != effect.reverb_decay)
+	{
+		effect.reverb_decay = decay;
+		for(size_t channel = 0; channel < channel_count; ++channel)
+			for(size_t comb = 0; comb < REVERB_COMBS; ++comb)
+				effect.lines[channel][comb].feedback = powf(10.f, -3.f * (float)effect.lines[channel][comb].length / (decay * (float)frequency));
+	}
+	EffectRamp mix = _rampPerSample(effect.parameters[AudioManager::EffectChain::PARAM_MIX], frame_count);
+	for(size_t channel = 0; channel < channel_count; ++channel)
+	{
+		EffectLine *lines = effect.lines[channel];
+		float wet_gain = mix.value;
+		for(size_t frame = 0; frame < frame_count; ++frame)
+		{
+			float& sample = samples[frame * channel_count + channel];
+			float input = sample * REVERB_INPUT_GAIN, wet = 0.f;
+			for(size_t comb = 0; comb < REVERB_COMBS; ++comb)
+			{
+				EffectLine& line = lines[comb];
+				float output = line.samples[line.position];
+				line.store = output + (line.store - output) * REVERB_DAMPING;
+				line.samples[line.position] = input + line.store * line.feedback;
+				if(++line.position == line.length)
+					line.position = 0;
+				wet += output;
+			}
+			for(size_t allpass = REVERB_COMBS; allpass < EFFECT_LINES; ++allpass)
+			{
+				EffectLine& line = lines[allpass];
+				float buffered = line.samples[line.position];
+				line.samples[line.position] = wet + buffered * REVERB_ALLPASS_FEEDBACK;
+				if(++line.position == line.length)
+					line.position = 0;
+				wet = buffered - wet;
+			}
+			wet_gain += mix.step;
+			sample += (wet - sample) * wet_gain;
+		}
+	}
+}
+
+// Feed-forward peak compressor linked across channels; with a high ratio it doubles as a limiter.
+static void _processCompressor(EffectState& effect, float* samples, size_t frame_count, size_t channel_count, size_t frequency)
+{
+	float threshold = _rampParameter(effect.parameters[AudioManager::EffectChain::PARAM_THRESHOLD]);
+	float slope = 1.f - 1.f / _rampParameter(effect.parameters[AudioManager::EffectChain::PARAM_RATIO]);
+	float attack = expf(-1.f / (_rampParameter(effect.parameters[AudioManager::EffectChain::PARAM_ATTACK]) * (float)frequency));
+	float release = expf(-1.f / (_rampParameter(effect.parameters[AudioManager::EffectChain::PARAM_RELEASE]) * (float)frequency));
+	EffectRamp mix = _rampPerSample(effect.parameters[AudioManager::EffectChain::PARAM_MIX], frame_count);
+	float envelope = effect.envelope, amount = mix.value;
+	for(size_t frame = 0; frame < frame_count; ++frame)
+	{
+		float *frame_samples = samples + frame * channel_count;
+		float peak = 0.f;
+		for(size_t channel = 0; channel < channel_count; ++channel)
+			peak = std::max(peak, fabsf(frame_samples[channel]));
+		envelope = peak + (peak > envelope ? attack : release) * (envelope - peak);
+		float over = envelope > 0.f ? 20.f * log10f(envelope) - threshold : 0.f;
+		float gain = over > 0.f ? powf(10.f, -over * slope * 0.05f) : 1.f;
+		amount += mix.step;
+		gain = 1.f + (gain - 1.f) * amount;
+		for(size_t channel = 0; channel < channel_count; ++channel)
+			frame_samples[channel] *= gain;
+	}
+	effect.envelope = envelope;
+}
+
+static void _processEffect(EffectState& effect, float* samples, size_t frame_count, size_t channel_count, size_t frequency)
+{
+	switch(effect.type)
+	{
+		case AudioManager::EffectChain::EFFECT_LOWPASS:
+		case AudioManager::EffectChain::EFFECT_HIGHPASS: _processFilter(effect, samples, frame_count, channel_count, frequency); break;
+		case AudioManager::EffectChain::EFFECT_DELAY: _processDelay(effect, samples, frame_count, channel_count, frequency); break;
+		case AudioManager::EffectChain::EFFECT_REVERB: _processReverb(effect, samples, frame_count, channel_count, frequency); break;
+		case AudioManager::EffectChain::EFFECT_COMPRESSOR: _processCompressor(effect, samples, frame_count, channel_count, frequency); break;
+	}
+}
+
+static float _effectTarget(const EffectState& effect, AudioManager::EffectChain::Parameter parameter)
+{
+	return effect.parameters[parameter].target.load(std::memory_order_relaxed);
+}
+
+static void _releaseEfx(const EfxFunctions& efx, EffectChainData* chain, size_t effect_count)
+{
+	for(size_t i = 0; i < effect_count; ++i)
+	{
+		EffectState& effect = chain->effects[i];
+		if(effect.efx_slot != INVALID_AL_ID)
+			efx.delete_slots(1, &effect.efx_slot);
+		if(effect.efx_effect != INVALID_AL_ID)
+			efx.delete_effects(1, &effect.efx_effect);
+		effect.efx_slot = effect.efx_effect = INVALID_AL_ID;
+	}
+	if(chain->efx_filter != INVALID_AL_ID)
+		efx.delete_filters(1, &chain->efx_filter);
+	chain->efx_filter = INVALID_AL_ID;
+	chain->efx_filter_effect = MAX_CHAIN_EFFECTS;
+	chain->efx_built = false;
+}
+
+// Approximates the chain with the mixer's own EFX objects. The filter is a shelf, so the cutoff
+// only sets how much of the stopband survives; the effect slots are fed wet-only over sends.
+static void _applyEfx(const EfxFunctions& efx, EffectChainData* chain, size_t effect_count)
+{
+	for(size_t i = 0; i < effect_count; ++i)
+	{
+		const EffectState& effect = chain->effects[i];
+		float mix = _effectTarget(effect, AudioManager::EffectChain::PARAM_MIX);
+		if(i == chain->efx_filter_effect)
+		{
+			float cutoff = _effectTarget(effect, AudioManager::EffectChain::PARAM_CUTOFF);
+			if(effect.type == AudioManager::EffectChain::EFFECT_LOWPASS)
+				efx.filterf(chain->efx_filter, EFX_LOWPASS_GAINHF, 1.f - mix * (1.f - std::min(cutoff / EFX_LOWPASS_REFERENCE, 1.f)));
+			else
+				efx.filterf(chain->efx_filter, EFX_HIGHPASS_GAINLF, 1.f - mix * (1.f - std::min(EFX_HIGHPASS_REFERENCE / cutoff, 1.f)));
+			continue;
+		}
+		if(effect.efx_effect == INVALID_AL_ID)
+			continue;
+		if(effect.type == AudioManager::EffectChain::EFFECT_DELAY)
+		{
+			efx.effectf(effect.efx_effect, EFX_ECHO_DELAY, std::min(_effectTarget(effect, AudioManager::EffectChain::PARAM_DELAY_TIME), EFX_ECHO_MAX_DELAY));
+			efx.effectf(effect.efx_effect, EFX_ECHO_FEEDBACK, _effectTarget(effect, AudioManager::EffectChain::PARAM_FEEDBACK));
+		}
+		else
+			efx.effectf(effect.efx_effect, EFX_REVERB_DECAY_TIME, _effectTarget(effect, AudioManager::EffectChain::PARAM_DECAY_TIME));
+		// A slot copies its effect when it is attached, so edits only take hold on re-attaching.
+		efx.sloti(effect.efx_slot, EFX_EFFECTSLOT_EFFECT, (ALint)effect.efx_effect);
+		efx.slotf(effect.efx_slot, EFX_EFFECTSLOT_GAIN, mix);
+	}
+}
+
+// The first filter becomes the direct-path filter and each delay or reverb gets a slot of its own.
+// EFX has no counterpart for further filters and its compressor is a bare on/off switch, so those
+// stages are left out.
+static bool _buildEfx(const EfxFunctions& efx, EffectChainData* chain, size_t effect_count)
+{
+	if(chain->efx_built)
+		return true;
+	while(alGetError() != AL_NO_ERROR);
+	chain->efx_filter_effect = MAX_CHAIN_EFFECTS;
+	for(size_t i = 0; i < effect_count; ++i)
+	{
+		EffectState& effect = chain->effects[i];
+		if(effect.type == AudioManager::EffectChain::EFFECT_LOWPASS || effect.type == AudioManager::EffectChain::EFFECT_HIGHPASS)
+		{
+			if(chain->efx_filter != INVALID_AL_ID)
+				continue;
+			efx.gen_filters(1, &chain->efx_filter);
+			efx.filteri(chain->efx_filter, EFX_FILTER_TYPE, effect.type == AudioManager::EffectChain::EFFECT_LOWPASS ? EFX_FILTER_LOWPASS : EFX_FILTER_HIGHPASS);
+			chain->efx_filter_effect = i;
+		}
+		else if(effect.type != AudioManager::EffectChain::EFFECT_COMPRESSOR)
+		{
+			efx.gen_effects(1, &effect.efx_effect);
+			efx.effecti(effect.efx_effect, EFX_EFFECT_TYPE, effect.type == AudioManager::EffectChain::EFFECT_DELAY ? EFX_EFFECT_ECHO : EFX_EFFECT_REVERB);
+			efx.gen_slots(1, &effect.efx_slot);
+		}
+	}
+	chain->applied_version = chain->version.load(std::memory_order_acquire);
+	_applyEfx(efx, chain, effect_count);
+	if(alGetError() != AL_NO_ERROR)
+	{
+		_releaseEfx(efx, chain, effect_count);
+		return false;
+	}
+	chain->efx_built = true;
+	return true;
+}
+
+// Streams run their chain in software on each chunk before it is queued. 16-bit data goes through
+// a float scratch block; float data is processed where it lies.
+static void _processStreamChunk(StreamingSourceData* stream, size_t size)
+{
+	AudioManager::EffectChain *effect_chain = stream->effect_chain;
+	size_t sample_count = size / _formatSampleSize(stream->format);
+	size_t frame_count = sample_count / effect_chain->channel_count;
+	if(!stream->effect_samples)
+	{
+		effect_chain->process((float*)stream->chunk, frame_count);
+		return;
+	}
+	const int16_t *pcm = (const int16_t*)stream->chunk;
+	for(size_t i = 0; i < sample_count; ++i)
+		stream->effect_samples[i] = (float)pcm[i] * (1.f / 32767.f);
+	effect_chain->process(stream->effect_samples, frame_count);
+	_convertFloat32(stream->effect_samples, (int16_t*)stream->chunk, sample_count);
+}
+
+static bool _streamTakesEffects(const StreamingSourceData* stream, const AudioManager::EffectChain* effect_chain)
+{
+	size_t sample_size = _formatSampleSize(stream->format);
+	return (sample_size == 2 || sample_size == 4) && _formatChannels(stream->format) == effect_chain->channel_count;
+}
+
+static bool _streamIsOpen(const StreamingSourceData* stream)
+{
+	return stream->file || stream->decoder;
+}
+
+// The manager whose audio thread is the calling thread, if any.
+static thread_local AudioManagerData *_t_audio_thread_data = 0;
+
+// Runs on the mixer thread, so it only bumps a counter; pollStates skips its scan while it is zero.
+static void _stateEventCallback(ALenum, ALuint, ALuint, ALsizei, const ALchar*, void* user_param)
+{
+	AudioManagerData *data = ((AudioManagerData*)user_param);
+	data->state_events.fetch_add(1, std::memory_order_release);
+}
+
+static bool _enableStateEvents(AudioManagerData* data, bool enable)
+{
+	if(!alIsExtensionPresent("AL_SOFT_events"))
+		return false;
+	PFN_alEventControlSOFT alEventControlSOFT = (PFN_alEventControlSOFT)alGetProcAddress("alEventControlSOFT");
+	PFN_alEventCallbackSOFT alEventCallbackSOFT = (PFN_alEventCallbackSOFT)alGetProcAddress("alEventCallbackSOFT");
+	ALenum event_type = alGetEnumValue("AL_EVENT_TYPE_SOURCE_STATE_CHANGED_SOFT");
+	if(!alEventControlSOFT || !alEventCallbackSOFT || event_type == 0)
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	if(enable)
+	{
+		alEventCallbackSOFT(_stateEventCallback, data);
+		alEventControlSOFT(1, &event_type, AL_TRUE);
+	}
+	else
+	{
+		alEventControlSOFT(1, &event_type, AL_FALSE);
+		alEventCallbackSOFT(0, 0);
+	}
+	return alGetError() == AL_NO_ERROR;
+}
+
+static bool _postListener(AudioManagerData* data, unsigned int listener_flag, const AudioManager& audio_manager)
+{
+	AudioCommand *command = new AudioCommand(CMD_LISTENER);
+	command->flags = listener_flag;
+	const axl::math::Vec3f& first = listener_flag == LISTENER_DIRTY_POSITION ? audio_manager.position : (listener_flag == LISTENER_DIRTY_VELOCITY ? audio_manager.velocity : audio_manager.orientation_at);
+	command->values[0] = first.x;
+	command->values[1] = first.y;
+	command->values[2] = first.z;
+	command->values[3] = audio_manager.orientation_up.x;
+	command->values[4] = audio_manager.orientation_up.y;
+	command->values[5] = audio_manager.orientation_up.z;
+	data->commands.push(command);
+	return true;
+}
+
+//
+// AudioManager::AudioBuffer
+//
+
+AudioManager::AudioBuffer::AudioBuffer(const AudioManager& _audio_manager) :
+	audio_manager(_audio_manager),
+	handle(m_handle),
+	buffer_id(m_buffer_id),
+	format(buffer_format),
+	size(buffer_size),
+	frequency(buffer_frequency),
+	block_align(buffer_block_align),
+	load_state(buffer_load_state),
+	buffer_format(FORMAT_NONE),
+	buffer_size(0),
+	buffer_frequency(0),
+	buffer_block_align(0),
+	buffer_load_state(LOAD_NONE),
+	m_buffer_id(INVALID_AL_ID),
+	m_mapping(0),
+	m_cache_entry(0),
+	m_handle{INVALID_POOL_INDEX, 0}
+{}
+
+AudioManager::AudioBuffer::~AudioBuffer()
+{
+	this->destroy();
+	buffer_load_state = LOAD_NONE;
+}
+
+AudioManager::AudioBuffer::AudioBuffer(AudioBuffer&& audio_buffer) :
+	audio_manager(audio_buffer.audio_manager),
+	handle(m_handle),
+	buffer_id(m_buffer_id),
+	format(buffer_format),
+	size(buffer_size),
+	frequency(buffer_frequency),
+	block_align(buffer_block_align),
+	load_state(buffer_load_state),
+	buffer_format(audio_buffer.buffer_format),
+	buffer_size(audio_buffer.buffer_size),
+	buffer_frequency(audio_buffer.buffer_frequency),
+	buffer_block_align(audio_buffer.buffer_block_align),
+	buffer_load_state(audio_buffer.buffer_load_state),
+	m_buffer_id(audio_buffer.m_buffer_id),
+	m_mapping(audio_buffer.m_mapping),
+	m_cache_entry(0),
+	m_handle{INVALID_POOL_INDEX, 0}
+{
+	audio_buffer.m_buffer_id = INVALID_AL_ID;
+	audio_buffer.m_mapping = 0;
+}
+
+bool AudioManager::AudioBuffer::create()
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_CREATE);
+	if(!audio_manager.makeCurrent())
+		return false;
+	this->destroy();
+	while(alGetError() != AL_NO_ERROR);
+	alGenBuffers(1, &m_buffer_id);
+	if(alGetError() != AL_NO_ERROR || m_buffer_id == INVALID_AL_ID)
+	{
+		_countStat(((AudioManagerData*)audio_manager.m_reserved)->stats.failed_buffers);
+		this->destroy();
+		return false;
+	}
+	return true;
+}
+
+bool AudioManager::AudioBuffer::destroy()
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_DESTROY);
+	if(!audio_manager.makeCurrent() || m_buffer_id == INVALID_AL_ID)
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	alDeleteBuffers(1, &m_buffer_id);
+	bool success = alGetError() == AL_NO_ERROR;
+	// A static buffer still reads from the mapping until the AL has actually let go of it.
+	if(success)
+		this->releaseMapping();
+	buffer_format = FORMAT_NONE;
+	buffer_size = 0;
+	buffer_frequency = 0;
+	buffer_block_align = 0;
+	m_buffer_id = INVALID_AL_ID;
+	return success;
+}
+
+bool AudioManager::AudioBuffer::isValid() const
+{
+	if(audio_manager.postsCommands())
+	{
+		AudioManagerData *data = ((AudioManagerData*)audio_manager.m_reserved);
+		std::lock_guard<SpinLock> guard(data->pool_lock);
+		return data->buffers.get(m_handle) == this;
+	}
+	return audio_manager.makeCurrent() && m_buffer_id != INVALID_AL_ID && alIsBuffer(m_buffer_id);
+}
+
+bool AudioManager::AudioBuffer::loadFromFile(const char* wav_file_path)
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_LOAD_FROM_FILE);
+	if(!wav_file_path || !AudioBuffer::isValid() || (!audio_manager.postsCommands() && !audio_manager.makeCurrent()))
+		return false;
+	AudioManagerData *data = ((AudioManagerData*)audio_manager.m_reserved);
+	Format _format = FORMAT_NONE;
+	void *samples = 0;
+	size_t _size = 0, _frequency = 0;
+	if(data->normalize_loads && _readNormalized(data, wav_file_path, _format, samples, _size, _frequency))
+	{
+		bool success = AudioBuffer::setData(_format, samples, _size, _frequency);
+		free(samples);
+		return success;
+	}
+	MappedFile mapped_file;
+	if(_mapFile(wav_file_path, mapped_file))
+	{
+		// The sample data is handed to the AL straight out of the mapping. With static buffers the
+		// mapping is the buffer storage and lives as long as the buffer does; otherwise it is dropped
+		// after the single copy done by alBufferData.
+		WavInfo info;
+		if(!_wavParseHeader(mapped_file.bytes, mapped_file.size, info) ||
+			(_format = _wavFormat(info.format_tag, info.channels, info.bits_per_sample)) == FORMAT_NONE)
+		{
+			_unmapFile(mapped_file);
+			if(!_decodeFile(data, wav_file_path, _format, samples, _size, _frequency))
+				return false;
+			size_t bits_per_sample = _formatSampleSize(_format) * 8;
+			if(_normalizes(data, _format, bits_per_sample, _frequency))
+			{
+				void *decoded = samples;
+				bool normalized = _normalizeSamples(data, wav_file_path, _format, bits_per_sample, (const uint8_t*)decoded, _size, _frequency, 0,
+					_format, samples, _size, _frequency);
+				free(decoded);
+				if(!normalized)
+					return false;
+			}
+			bool success = AudioBuffer::setData(_format, samples, _size, _frequency);
+			free(samples);
+			return success;
+		}
+		void* _data = (void*)(mapped_file.bytes + info.data_offset);
+		if(_normalizes(data, _format, info.bits_per_sample, info.samples_per_sec))
+		{
+			bool success = _normalizeSamples(data, wav_file_path, _format, info.bits_per_sample, (const uint8_t*)_data, info.data_size, info.samples_per_sec, info.block_align,
+				_format, samples, _size, _frequency) && AudioBuffer::setData(_format, samples, _size, _frequency);
+			free(samples);
+			_unmapFile(mapped_file);
+			return success;
+		}
+		if(_isCompressed(_format))
+		{
+			bool success = AudioBuffer::setCompressedData(_format, _data, info.data_size, info.samples_per_sec, info.block_align);
+			_unmapFile(mapped_file);
+			return success;
+		}
+		if(info.bits_per_sample == 24 || _uploadFormat(data, _format) != _format)
+		{
+			// Samples that need converting cannot be uploaded from the mapping as they are.
+			bool success = false;
+			size_t sample_count = info.data_size / 3;
+			if(info.bits_per_sample != 24)
+				success = AudioBuffer::setData(_format, _data, info.data_size, info.samples_per_sec);
+			else if(int16_t *samples = (int16_t*)malloc(sample_count * sizeof(int16_t)))
+			{
+				_convertPcm24((const uint8_t*)_data, samples, sample_count);
+				success = AudioBuffer::setData(_format, samples, sample_count * sizeof(int16_t), info.samples_per_sec);
+				free(samples);
+			}
+			_unmapFile(mapped_file);
+			return success;
+		}
+		if(audio_manager.postsCommands())
+		{
+			// The audio thread uploads straight from the mapping and then owns it.
+			AudioCommand *command = new AudioCommand(CMD_BUFFER_DATA, this);
+			command->payload = new MappedFile(mapped_file);
+			command->object = _data;
+			command->mapped = true;
+			command->format = _format;
+			command->size = info.data_size;
+			command->frequency = info.samples_per_sec;
+			data->commands.push(command);
+			return true;
+		}
+		if(this->setStaticData(_format, _data, info.data_size, info.samples_per_sec))
+		{
+			m_mapping = new MappedFile(mapped_file);
+			return true;
+		}
+		bool success = AudioBuffer::setData(_format, _data, info.data_size, info.samples_per_sec);
+		_unmapFile(mapped_file);
+		return success;
+	}
+	if(!axl::util::File::exists(wav_file_path))
+		return false;
+	axl::media::audio::WAV wav;
+	if(!wav.loadFromFile(wav_file_path))
+		return false;
+	void* _data = 0;
+	if(wav.format_chunk.format_tag != (uint16_t)axl::media::audio::WAV::WaveFormat::PCM)
+		return false;
+	_format = _wavFormat(WAVE_FORMAT_PCM, wav.format_chunk.channels, wav.format_chunk.bits_per_sample);
+	if(_format == FORMAT_NONE || wav.format_chunk.bits_per_sample == 24)
+		return false;
+	_data = wav.wave_data;
+	_size = wav.data_header.chunk_size;
+	_frequency = wav.format_chunk.samples_per_sec;
+	return AudioBuffer::setData(_format, _data, _size, _frequency);
+}
+
+bool AudioManager::AudioBuffer::setData(Format _format, void* _data, size_t _size, size_t _frequency)
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_SET_DATA);
+	AudioManagerData *data = ((AudioManagerData*)audio_manager.m_reserved);
+	Format upload_format = data && !_isCompressed(_format) ? _uploadFormat(data, _format) : FORMAT_NONE;
+	if(!_data || _size==0 || _frequency==0 || upload_format == FORMAT_NONE)
+		return false;
+	bool convert = upload_format != _format;
+	size_t upload_size = convert ? _size / sizeof(float) * sizeof(int16_t) : _size;
+	if(audio_manager.postsCommands())
+	{
+		void *copy = malloc(upload_size);
+		if(!copy)
+			return false;
+		if(convert)
+			_convertFloat32(_data, (int16_t*)copy, _size / sizeof(float));
+		else
+			memcpy(copy, _data, _size);
+		AudioCommand *command = new AudioCommand(CMD_BUFFER_DATA, this);
+		command->payload = copy;
+		command->object = copy;
+		command->format = upload_format;
+		command->size = upload_size;
+		command->frequency = _frequency;
+		data->commands.push(command);
+		return true;
+	}
+	if(!AudioBuffer::isValid() || !audio_manager.makeCurrent())
+		return false;
+	void *samples = _data;
+	if(convert)
+	{
+		if(!(samples = malloc(upload_size)))
+			return false;
+		_convertFloat32(_data, (int16_t*)samples, _size / sizeof(float));
+	}
+	while(alGetError() != AL_NO_ERROR);
+	alBufferData(m_buffer_id, _alFormat(data, upload_format), samples, upload_size, _frequency);
+	if(convert)
+		free(samples);
+	if(alGetError() == AL_NO_ERROR)
+	{
+		_countUpload(data, upload_size);
+		this->releaseMapping();
+		buffer_format = upload_format;
+		buffer_size = upload_size;
+		buffer_frequency = _frequency;
+		buffer_block_align = 0;
+		return true;
+	}
+	return false;
+}
+
+// ADPCM goes to the AL as it is when the AL can take its blocks and is decoded to 16-bit PCM
+// otherwise. The threaded mode always decodes, since its upload commands carry no block size.
+bool AudioManager::AudioBuffer::setCompressedData(Format _format, void* _data, size_t _size, size_t _frequency, size_t _block_align)
+{
+	AudioManagerData *data = ((AudioManagerData*)audio_manager.m_reserved);
+	size_t block_frames = _adpcmBlockFrames(_format, _block_align);
+	if(!data || !_data || _size==0 || _frequency==0 || block_frames == 0)
+		return false;
+	if(!audio_manager.postsCommands() && _uploadsCompressed(data, _format, _size, _block_align))
+	{
+		StatScope stat_scope(data, STAT_SET_DATA);
+		if(!AudioBuffer::isValid() || !audio_manager.makeCurrent())
+			return false;
+		while(alGetError() != AL_NO_ERROR);
+		if(data->block_alignment)
+			alBufferi(m_buffer_id, UNPACK_BLOCK_ALIGNMENT, (ALint)block_frames);
+		alBufferData(m_buffer_id, _alFormat(data, _format), _data, (ALsizei)_size, (ALsizei)_frequency);
+		bool success = alGetError() == AL_NO_ERROR;
+		// The alignment sticks to the buffer and would apply to any PCM uploaded into it later.
+		if(data->block_alignment)
+			alBufferi(m_buffer_id, UNPACK_BLOCK_ALIGNMENT, 0);
+		if(success)
+		{
+			_countUpload(data, _size);
+			this->releaseMapping();
+			buffer_format = _format;
+			buffer_size = _size;
+			buffer_frequency = _frequency;
+			buffer_block_align = _block_align;
+			return true;
+		}
+	}
+	Format pcm_format = FORMAT_NONE;
+	void *samples = 0;
+	size_t pcm_size = 0;
+	if(!_decodeAdpcm(_format, (const uint8_t*)_data, _size, _block_align, pcm_format, samples, pcm_size))
+		return false;
+	bool success = AudioBuffer::setData(pcm_format, samples, pcm_size, _frequency);
+	free(samples);
+	return success;
+}
+
+bool AudioManager::AudioBuffer::setStaticData(Format _format, void* _data, size_t _size, size_t _frequency)
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_SET_DATA);
+	if(!_data || _size==0 || _frequency==0 || m_buffer_id == INVALID_AL_ID)
+		return false;
+	PFN_alBufferDataStatic alBufferDataStatic = _alBufferDataStatic();
+	ALenum al_format = _alFormat((AudioManagerData*)audio_manager.m_reserved, _format);
+	if(!alBufferDataStatic || al_format == AL_NONE)
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	alBufferDataStatic((ALint)m_buffer_id, al_format, _data, (ALsizei)_size, (ALsizei)_frequency);
+	if(alGetError() != AL_NO_ERROR)
+		return false;
+	this->releaseMapping();
+	buffer_format = _format;
+	buffer_size = _size;
+	buffer_frequency = _frequency;
+	buffer_block_align = 0;
+	return true;
+}
+
+void AudioManager::AudioBuffer::releaseMapping()
+{
+	if(!m_mapping)
+		return;
+	MappedFile *mapped_file = (MappedFile*)m_mapping;
+	_unmapFile(*mapped_file);
+	delete mapped_file;
+	m_mapping = 0;
+}
+
+//
+// AudioManager::Decoder
+//
+
+AudioManager::Decoder::Decoder() :
+	format(decoder_format),
+	frequency(decoder_frequency),
+	frame_count(decoder_frame_count),
+	decoder_format(AudioBuffer::FORMAT_NONE),
+	decoder_frequency(0),
+	decoder_frame_count(0)
+{}
+
+AudioManager::Decoder::~Decoder()
+{}
+
+//
+// AudioManager::Device
+//
+
+AudioManager::Device::Device() :
+	m_reserved(new DeviceData())
+{}
+
+AudioManager::Device::~Device()
+{
+	DeviceData *data = ((DeviceData*)m_reserved);
+	if(data->device)
+		alcCloseDevice(data->device);
+	delete data;
+}
+
+bool AudioManager::Device::retain()
+{
+	DeviceData *data = ((DeviceData*)m_reserved);
+	if(!data->device)
+		return false;
+	data->ref_count.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+//
+// AudioManager::EffectChain
+//
+
+AudioManager::EffectChain::EffectChain(const AudioManager& _audio_manager, size_t _channel_count, size_t _frequency) :
+	audio_manager(_audio_manager),
+	channel_count(chain_channel_count),
+	frequency(chain_frequency),
+	effect_count(chain_effect_count),
+	chain_channel_count(_channel_count),
+	chain_frequency(_frequency),
+	chain_effect_count(0),
+	m_chain(new EffectChainData()),
+	m_next_chain(0)
+{}
+
+AudioManager::EffectChain::~EffectChain()
+{
+	EffectChainData *chain = ((EffectChainData*)m_chain);
+	if(!chain)
+		return;
+	for(size_t i = 0; i < chain_effect_count; ++i)
+		free(chain->effects[i].storage);
+	delete chain;
+}
+
+// Stages are appended before the chain is handed to a source or processed; only parameters
+// may change while it is in use.
+bool AudioManager::EffectChain::addEffect(EffectType type)
+{
+	EffectChainData *chain = ((EffectChainData*)m_chain);
+	if(!chain || chain->efx_built || chain_effect_count >= MAX_CHAIN_EFFECTS || type < EFFECT_LOWPASS || type > EFFECT_COMPRESSOR)
+		return false;
+	EffectState& effect = chain->effects[chain_effect_count];
+	effect.type = type;
+	if(!_allocateLines(effect, chain_channel_count, chain_frequency))
+		return false;
+	for(size_t i = 0; i < EFFECT_PARAMETER_COUNT; ++i)
+		effect.parameters[i].target.store(_effectParameterRanges[i].fallback, std::memory_order_relaxed);
+	effect.parameters[PARAM_MIX].target.store(type == EFFECT_DELAY ? 0.3f : (type == EFFECT_REVERB ? 0.25f : 1.f), std::memory_order_relaxed);
+	effect.efx_effect = INVALID_AL_ID;
+	effect.efx_slot = INVALID_AL_ID;
+	_resetEffect(effect);
+	++chain_effect_count;
+	chain->version.fetch_add(1, std::memory_order_release);
+	return true;
+}
+
+// Safe from any thread while the chain runs: the new target is clamped, published with a single
+// atomic store and ramped to by the processing side over the following sub-blocks.
+bool AudioManager::EffectChain::setParameter(size_t effect_index, Parameter parameter, float value)
+{
+	EffectChainData *chain = ((EffectChainData*)m_chain);
+	if(!chain || effect_index >= chain_effect_count || parameter < PARAM_CUTOFF || parameter > PARAM_RELEASE || value != value)
+		return false;
+	const ParameterRange& range = _effectParameterRanges[parameter];
+	chain->effects[effect_index].parameters[parameter].target.store(std::min(std::max(value, range.minimum), range.maximum), std::memory_order_relaxed);
+	chain->version.fetch_add(1, std::memory_order_release);
+	return true;
+}
+
+float AudioManager::EffectChain::getParameter(size_t effect_index, Parameter parameter) const
+{
+	EffectChainData *chain = ((EffectChainData*)m_chain);
+	if(!chain || effect_index >= chain_effect_count || parameter < PARAM_CUTOFF || parameter > PARAM_RELEASE)
+		return 0.f;
+	return _effectTarget(chain->effects[effect_index], parameter);
+}
+
+// Runs every stage in place over interleaved frames of channel_count channels. Parameters move
+// once per EFFECT_RAMP_FRAMES, so the work in between is a plain loop that neither locks nor allocates.
+bool AudioManager::EffectChain::process(float* samples, size_t frame_count)
+{
+	EffectChainData *chain = ((EffectChainData*)m_chain);
+	if(!chain || !samples)
+		return false;
+	for(size_t offset = 0; offset < frame_count; offset += EFFECT_RAMP_FRAMES)
+	{
+		size_t block_frames = std::min(frame_count - offset, EFFECT_RAMP_FRAMES);
+		float *block = samples + offset * chain_channel_count;
+		for(size_t i = 0; i < chain_effect_count; ++i)
+			_processEffect(chain->effects[i], block, block_frames, chain_channel_count, chain_frequency);
+	}
+	return true;
+}
+
+void AudioManager::EffectChain::reset()
+{
+	EffectChainData *chain = ((EffectChainData*)m_chain);
+	if(!chain)
+		return;
+	for(size_t i = 0; i < chain_effect_count; ++i)
+		_resetEffect(chain->effects[i]);
+}
+
+//
+// AudioManager::AudioSource
+//
+
+AudioManager::AudioSource::AudioSource(const AudioManager& _audio_manager) :
+	audio_manager(_audio_manager),
+	handle(m_handle),
+	audio_buffer(source_audio_buffer),
+	source_id(m_source_id),
+	state(source_state),
+	loop(source_loop),
+	pitch(source_pitch),
+	gain(source_gain),
+	min_gain(source_min_gain),
+	max_gain(source_max_gain),
+	max_distance(source_max_distance),
+	position(source_position),
+	velocity(source_velocity),
+	direction(source_direction),
+	effect_chain(source_effect_chain),
+	source_audio_buffer(0),
+	source_state(STATE_INITIAL),
+	source_loop(false),
+	source_pitch(1.f),
+	source_gain(1.f),
+	source_min_gain(0.f),
+	source_max_gain(1.f),
+	source_max_distance(1000.f),
+	source_position(0.f, 0.f, 0.f),
+	source_velocity(0.f, 0.f, 0.f),
+	source_direction(0.f),
+	source_effect_chain(0),
+	m_source_id(INVALID_AL_ID),
+	m_dirty(0),
+	m_next_dirty(0),
+	m_handle{INVALID_POOL_INDEX, 0},
+	m_play_serial(0),
+	m_polled_serial(0),
+	m_play_when_ready(false),
+	m_committed_buffer(0)
+{}
+
+AudioManager::AudioSource::~AudioSource()
+{
+	this->destroy();
+}
+
+AudioManager::AudioSource::AudioSource(AudioSource&& audio_source) :
+	audio_manager(audio_source.audio_manager),
+	handle(m_handle),
+	audio_buffer(source_audio_buffer),
+	source_id(m_source_id),
+	state(source_state),
+	loop(source_loop),
+	pitch(source_pitch),
+	gain(source_gain),
+	min_gain(source_min_gain),
+	max_gain(source_max_gain),
+	max_distance(source_max_distance),
+	position(source_position),
+	velocity(source_velocity),
+	direction(source_direction),
+	effect_chain(source_effect_chain),
+	source_audio_buffer(audio_source.source_audio_buffer),
+	source_state(audio_source.source_state),
+	source_loop(audio_source.source_loop),
+	source_pitch(audio_source.source_pitch),
+	source_gain(audio_source.source_gain),
+	source_min_gain(audio_source.source_min_gain),
+	source_max_gain(audio_source.source_max_gain),
+	source_max_distance(audio_source.source_max_distance),
+	source_position(audio_source.source_position),
+	source_velocity(audio_source.source_velocity),
+	source_direction(audio_source.source_direction),
+	source_effect_chain(audio_source.source_effect_chain),
+	m_source_id(audio_source.m_source_id),
+	m_dirty(0),
+	m_next_dirty(0),
+	m_handle{INVALID_POOL_INDEX, 0},
+	m_play_serial(0),
+	m_polled_serial(0),
+	m_play_when_ready(false),
+	m_committed_buffer(0)
+{
+	unsigned int dirty_flags = audio_source.m_dirty;
+	audio_source.unmarkDirty();
+	audio_source.m_source_id = INVALID_AL_ID;
+	if(dirty_flags)
+		this->markDirty(dirty_flags);
+}
+
+bool AudioManager::AudioSource::create()
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_CREATE);
+	if(!audio_manager.makeCurrent())
+		return false;
+	this->destroy();
+	while(alGetError() != AL_NO_ERROR);
+	alGenSources(1, &m_source_id);
+	if(alGetError() != AL_NO_ERROR || m_source_id == INVALID_AL_ID)
+	{
+		_countStat(((AudioManagerData*)audio_manager.m_reserved)->stats.failed_sources);
+		this->destroy();
+		return false;
+	}
+	alSourcei(m_source_id, AL_LOOPING, (ALint)source_loop);
+	alSourcef(m_source_id, AL_PITCH, source_pitch);
+	alSourcef(m_source_id, AL_GAIN, source_gain);
+	alSourcef(m_source_id, AL_MIN_GAIN, source_min_gain);
+	alSourcef(m_source_id, AL_MAX_GAIN, source_max_gain);
+	alSourcef(m_source_id, AL_MAX_DISTANCE, source_max_distance);
+	alSource3f(m_source_id, AL_POSITION, source_position.x, source_position.y, source_position.z);
+	alSource3f(m_source_id, AL_VELOCITY, source_velocity.x, source_velocity.y, source_velocity.z);
+	alSource3f(m_source_id, AL_DIRECTION, source_direction.x, source_direction.y, source_direction.z);
+	if(source_audio_buffer)
+		this->setBuffer(source_audio_buffer);
+	if(source_effect_chain)
+		this->setEffectChain(source_effect_chain);
+	return true;
+}
+
+bool AudioManager::AudioSource::destroy()
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_DESTROY);
+	this->unmarkDirty();
+	if(!audio_manager.makeCurrent() || m_source_id == INVALID_AL_ID)
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	alSourceStop(m_source_id);
+	alSourcei(m_source_id, AL_BUFFER, 0);
+	alDeleteSources(1, &m_source_id);
+	m_source_id = INVALID_AL_ID;
+	source_state = STATE_INITIAL;
+	return alGetError() == AL_NO_ERROR;
+}
+
+bool AudioManager::AudioSource::isValid() const
+{
+	if(audio_manager.postsCommands())
+	{
+		AudioManagerData *data = ((AudioManagerData*)audio_manager.m_reserved);
+		std::lock_guard<SpinLock> guard(data->pool_lock);
+		return data->sources.get(m_handle) == this;
+	}
+	return audio_manager.makeCurrent() && m_source_id != INVALID_AL_ID && alIsSource(m_source_id);
+}
+
+// The state getters read the cached state: play/pause/stop keep it current and
+// AudioManager::pollStates picks up sources that stopped on their own.
+bool AudioManager::AudioSource::isPlaying() const
+{
+	return source_state == STATE_PLAYING;
+}
+
+bool AudioManager::AudioSource::isPaused() const
+{
+	return source_state == STATE_PAUSED;
+}
+
+bool AudioManager::AudioSource::isStopped() const
+{
+	return source_state == STATE_STOPPED;
+}
+
+bool AudioManager::AudioSource::play() const
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_PLAYBACK);
+	if(audio_manager.postsCommands())
+	{
+		source_state = STATE_PLAYING;
+		++m_play_serial;
+		return this->postCommand(CMD_SOURCE_PLAY);
+	}
+	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+		return false;
+	_unschedule((AudioManagerData*)audio_manager.m_reserved, this);
+	if(source_audio_buffer && source_audio_buffer->load_state == AudioBuffer::LOAD_PENDING)
+	{
+		m_play_when_ready = true;
+		return true;
+	}
+	while(alGetError() != AL_NO_ERROR);
+	alSourcePlay(m_source_id);
+	if(alGetError() != AL_NO_ERROR)
+		return false;
+	source_state = STATE_PLAYING;
+	return true;
+}
+
+bool AudioManager::AudioSource::pause() const
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_PLAYBACK);
+	if(audio_manager.postsCommands())
+	{
+		if(source_state == STATE_PLAYING)
+			source_state = STATE_PAUSED;
+		return this->postCommand(CMD_SOURCE_PAUSE);
+	}
+	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+		return false;
+	_unschedule((AudioManagerData*)audio_manager.m_reserved, this);
+	m_play_when_ready = false;
+	while(alGetError() != AL_NO_ERROR);
+	alSourcePause(m_source_id);
+	if(alGetError() != AL_NO_ERROR)
+		return false;
+	if(source_state == STATE_PLAYING)
+		source_state = STATE_PAUSED;
+	return true;
+}
+
+bool AudioManager::AudioSource::stop() const
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_PLAYBACK);
+	if(audio_manager.postsCommands())
+	{
+		source_state = STATE_STOPPED;
+		return this->postCommand(CMD_SOURCE_STOP);
+	}
+	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+		return false;
+	_unschedule((AudioManagerData*)audio_manager.m_reserved, this);
+	m_play_when_ready = false;
+	while(alGetError() != AL_NO_ERROR);
+	alSourceStop(m_source_id);
+	if(alGetError() != AL_NO_ERROR)
+		return false;
+	source_state = STATE_STOPPED;
+	return true;
+}
+
+bool AudioManager::AudioSource::setLoop(bool _loop)
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_SET_PROPERTY);
+	if(audio_manager.postsCommands())
+	{
+		source_loop = _loop;
+		return this->postCommand(CMD_SOURCE_PROPERTY, SOURCE_DIRTY_LOOP);
+	}
+	if(audio_manager.isUpdating())
+	{
+		if(!this->markDirty(SOURCE_DIRTY_LOOP))
+			return false;
+		source_loop = _loop;
+		return true;
+	}
+	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	alSourcei(m_source_id, AL_LOOPING, (ALint)_loop);
+	if(alGetError() == AL_NO_ERROR)
+	{
+		source_loop = _loop;
+		return true;
+	}
+	return false;
+}
+
+bool AudioManager::AudioSource::setPitch(float _pitch)
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_SET_PROPERTY);
+	if(audio_manager.postsCommands())
+	{
+		source_pitch = _pitch;
+		return this->postCommand(CMD_SOURCE_PROPERTY, SOURCE_DIRTY_PITCH);
+	}
+	if(audio_manager.isUpdating())
+	{
+		if(!this->markDirty(SOURCE_DIRTY_PITCH))
+			return false;
+		source_pitch = _pitch;
+		return true;
+	}
+	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	alSourcef(m_source_id, AL_PITCH, _pitch);
+	if(alGetError() == AL_NO_ERROR)
+	{
+		source_pitch = _pitch;
+		return true;
+	}
+	return false;
+}
+
+bool AudioManager::AudioSource::setGain(float _gain)
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_SET_PROPERTY);
+	if(audio_manager.postsCommands())
+	{
+		source_gain = _gain;
+		return this->postCommand(CMD_SOURCE_PROPERTY, SOURCE_DIRTY_GAIN);
+	}
+	if(audio_manager.isUpdating())
+	{
+		if(!this->markDirty(SOURCE_DIRTY_GAIN))
+			return false;
+		source_gain = _gain;
+		return true;
+	}
+	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	alSourcef(m_source_id, AL_GAIN, _gain);
+	if(alGetError() == AL_NO_ERROR)
+	{
+		source_gain = _gain;
+		return true;
+	}
+	return false;
+}
+
+bool AudioManager::AudioSource::setMinGain(float _min_gain)
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_SET_PROPERTY);
+	if(audio_manager.postsCommands())
+	{
+		source_min_gain = _min_gain;
+		return this->postCommand(CMD_SOURCE_PROPERTY, SOURCE_DIRTY_MIN_GAIN);
+	}
+	if(audio_manager.isUpdating())
+	{
+		if(!this->markDirty(SOURCE_DIRTY_MIN_GAIN))
+			return false;
+		source_min_gain = _min_gain;
+		return true;
+	}
+	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	alSourcef(m_source_id, AL_MIN_GAIN, _min_gain);
+	if(alGetError() == AL_NO_ERROR)
+	{
+		source_min_gain = _min_gain;
+		return true;
+	}
+	return false;
+}
+
+bool AudioManager::AudioSource::setMaxGain(float _max_gain)
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_SET_PROPERTY);
+	if(audio_manager.postsCommands())
+	{
+		source_max_gain = _max_gain;
+		return this->postCommand(CMD_SOURCE_PROPERTY, SOURCE_DIRTY_MAX_GAIN);
+	}
+	if(audio_manager.isUpdating())
+	{
+		if(!this->markDirty(SOURCE_DIRTY_MAX_GAIN))
+			return false;
+		source_max_gain = _max_gain;
+		return true;
+	}
+	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	alSourcef(m_source_id, AL_MAX_GAIN, _max_gain);
+	if(alGetError() == AL_NO_ERROR)
+	{
+		source_max_gain = _max_gain;
+		return true;
+	}
+	return false;
+}
+
+bool AudioManager::AudioSource::setMaxDistance(float _max_distance)
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_SET_PROPERTY);
+	if(audio_manager.postsCommands())
+	{
+		source_max_distance = _max_distance;
+		return this->postCommand(CMD_SOURCE_PROPERTY, SOURCE_DIRTY_MAX_DISTANCE);
+	}
+	if(audio_manager.isUpdating())
+	{
+		if(!this->markDirty(SOURCE_DIRTY_MAX_DISTANCE))
+			return false;
+		source_max_distance = _max_distance;
+		return true;
+	}
+	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	alSourcef(m_source_id, AL_MAX_DISTANCE, _max_distance);
+	if(alGetError() == AL_NO_ERROR)
+	{
+		source_max_distance = _max_distance;
+		return true;
+	}
+	return false;
+}
+
+bool AudioManager::AudioSource::setPosition(const axl::math::Vec3f& _position)
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_SET_PROPERTY);
+	if(audio_manager.postsCommands())
+	{
+		source_position = _position;
+		return this->postCommand(CMD_SOURCE_PROPERTY, SOURCE_DIRTY_POSITION);
+	}
+	if(audio_manager.isUpdating())
+	{
+		if(!this->markDirty(SOURCE_DIRTY_POSITION))
+			return false;
+		source_position = _position;
+		return true;
+	}
+	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	alSource3f(m_source_id, AL_POSITION, _position.x, _position.y, _position.z);
+	if(alGetError() == AL_NO_ERROR)
+	{
+		source_position = _position;
+		return true;
+	}
+	return false;
+}
+
+bool AudioManager::AudioSource::setVelocity(const axl::math::Vec3f& _velocity)
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_SET_PROPERTY);
+	if(audio_manager.postsCommands())
+	{
+		source_velocity = _velocity;
+		return this->postCommand(CMD_SOURCE_PROPERTY, SOURCE_DIRTY_VELOCITY);
+	}
+	if(audio_manager.isUpdating())
+	{
+		if(!this->markDirty(SOURCE_DIRTY_VELOCITY))
+			return false;
+		source_velocity = _velocity;
+		return true;
+	}
+	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	alSource3f(m_source_id, AL_VELOCITY, _velocity.x, _velocity.y, _velocity.z);
+	if(alGetError() == AL_NO_ERROR)
+	{
+		source_velocity = _velocity;
+		return true;
+	}
+	return false;
+}
+
+bool AudioManager::AudioSource::setDirection(const axl::math::Vec3f& _direction)
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_SET_PROPERTY);
+	if(audio_manager.postsCommands())
+	{
+		source_direction = _direction;
+		return this->postCommand(CMD_SOURCE_PROPERTY, SOURCE_DIRTY_DIRECTION);
+	}
+	if(audio_manager.isUpdating())
+	{
+		if(!this->markDirty(SOURCE_DIRTY_DIRECTION))
+			return false;
+		source_direction = _direction;
+		return true;
+	}
+	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	alSource3f(m_source_id, AL_DIRECTION, _direction.x, _direction.y, _direction.z);
+	if(alGetError() == AL_NO_ERROR)
+	{
+		source_direction = _direction;
+		return true;
+	}
+	return false;
+}
+
+bool AudioManager::AudioSource::setBuffer(const AudioBuffer* audio_buffer)
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_SET_PROPERTY);
+	if(audio_manager.postsCommands())
+	{
+		source_audio_buffer = audio_buffer;
+		return this->postCommand(CMD_SOURCE_PROPERTY, SOURCE_DIRTY_BUFFER);
+	}
+	// A buffer still loading stays unattached; updateLoads binds it once its data is in.
+	AudioManagerData *data = ((AudioManagerData*)audio_manager.m_reserved);
+	bool pending = audio_buffer && audio_buffer->load_state == AudioBuffer::LOAD_PENDING;
+	if(audio_manager.isUpdating())
+	{
+		// The AL only reports a buffer name, so a rejected flush restores the buffer held before the batch.
+		const AudioBuffer *committed_buffer = m_dirty & SOURCE_DIRTY_BUFFER ? m_committed_buffer : source_audio_buffer;
+		if((audio_buffer && audio_buffer->buffer_id == INVALID_AL_ID) || !this->markDirty(SOURCE_DIRTY_BUFFER))
+			return false;
+		m_committed_buffer = committed_buffer;
+		source_audio_buffer = audio_buffer;
+		m_play_when_ready = false;
+		if(pending)
+			data->pending_sources.push(m_handle);
+		return true;
+	}
+	if(!AudioSource::isValid() || (audio_buffer && !audio_buffer->isValid()) || !audio_manager.makeCurrent())
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	if(!audio_buffer || pending)
+		alSourcei(m_source_id, AL_BUFFER, 0);
+	else
+		alSourcei(m_source_id, AL_BUFFER, audio_buffer->buffer_id);
+	if(alGetError() == AL_NO_ERROR)
+	{
+		source_audio_buffer = audio_buffer;
+		m_play_when_ready = false;
+		if(pending)
+			data->pending_sources.push(m_handle);
+		return true;
+	}
+	return false;
+}
+
+// Plain sources are mixed by OpenAL, so their chain runs on its EFX objects; see _buildEfx.
+bool AudioManager::AudioSource::setEffectChain(const EffectChain* _effect_chain)
+{
+	StatScope stat_scope((AudioManagerData*)audio_manager.m_reserved, STAT_SET_PROPERTY);
+	AudioManagerData *data = ((AudioManagerData*)audio_manager.m_reserved);
+	if(audio_manager.postsCommands() || (_effect_chain && !data->efx.gen_filters))
+		return false;
+	if(!AudioSource::isValid())
+	{
+		source_effect_chain = _effect_chain;
+		return true;
+	}
+	if(!audio_manager.makeCurrent())
+		return false;
+	EffectChainData *chain = _effect_chain ? (EffectChainData*)_effect_chain->m_chain : 0;
+	if(chain && !_buildEfx(data->efx, chain, _effect_chain->chain_effect_count))
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	if(data->efx.gen_filters)
+	{
+		ALint send = 0;
+		alSourcei(m_source_id, EFX_DIRECT_FILTER, chain ? (ALint)chain->efx_filter : 0);
+		for(size_t i = 0; chain && i < _effect_chain->chain_effect_count && send < data->efx.max_sends; ++i)
+		{
+			if(chain->effects[i].efx_slot != INVALID_AL_ID)
+				alSource3i(m_source_id, EFX_AUXILIARY_SEND_FILTER, (ALint)chain->effects[i].efx_slot, send++, 0);
+		}
+		for(; send < data->efx.max_sends; ++send)
+			alSource3i(m_source_id, EFX_AUXILIARY_SEND_FILTER, 0, send, 0);
+	}
+	if(alGetError() != AL_NO_ERROR)
+		return false;
+	source_effect_chain = _effect_chain;
+	return true;
+}
+
+// AL_SOFT_source_latency reads the playback offset and the time until that sample reaches the
+// speakers in one atomic query, which is what input-to-sound timing needs. Without it the offset
+// comes from AL_SEC_OFFSET and the latency from the device estimate.
+bool AudioManager::AudioSource::getLatency(double& offset, double& latency) const
+{
+	AudioManagerData *data = ((AudioManagerData*)audio_manager.m_reserved);
+	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+		return false;
+	Latency device_latency;
+	if(!data->get_source_latency && !audio_manager.getLatency(device_latency))
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	if(data->get_source_latency)
+	{
+		ALdouble offset_latency[2] = { 0.0, 0.0 };
+		data->get_source_latency(m_source_id, SEC_OFFSET_LATENCY_SOFT, offset_latency);
+		offset = offset_latency[0];
+		latency = offset_latency[1];
+	}
+	else
+	{
+		ALfloat seconds = 0.f;
+		alGetSourcef(m_source_id, AL_SEC_OFFSET, &seconds);
+		offset = seconds;
+		latency = device_latency.output;
+	}
+	return alGetError() == AL_NO_ERROR;
+}
+
+bool AudioManager::AudioSource::markDirty(unsigned int dirty_flags)
+{
+	AudioManagerData *data = ((AudioManagerData*)audio_manager.m_reserved);
+	if(!data || !data->updating || m_source_id == INVALID_AL_ID)
+		return false;
+	if(!m_dirty)
+	{
+		m_next_dirty = data->dirty_sources;
+		data->dirty_sources = this;
+	}
+	m_dirty |= dirty_flags;
+	return true;
+}
+
+void AudioManager::AudioSource::unmarkDirty()
+{
+	AudioManagerData *data = ((AudioManagerData*)audio_manager.m_reserved);
+	if(!m_dirty || !data)
+		return;
+	for(AudioSource** link = &data->dirty_sources; *link; link = &(*link)->m_next_dirty)
+	{
+		if(*link != this)
+			continue;
+		*link = m_next_dirty;
+		break;
+	}
+	m_dirty = 0;
+	m_next_dirty = 0;
+}
+
+// Snapshots the requested property on the calling thread so the audio thread never reads our fields.
+bool AudioManager::AudioSource::postCommand(unsigned int command_type, unsigned int dirty_flags) const
+{
+	AudioManagerData *data = ((AudioManagerData*)audio_manager.m_reserved);
+	AudioCommand *command = new AudioCommand((AudioCommandType)command_type, const_cast<AudioSource*>(this));
+	command->flags = dirty_flags;
+	command->serial = m_play_serial;
+	switch(dirty_flags)
+	{
+		case SOURCE_DIRTY_LOOP: command->values[0] = source_loop ? 1.f : 0.f; break;
+		case SOURCE_DIRTY_PITCH: command->values[0] = source_pitch; break;
+		case SOURCE_DIRTY_GAIN: command->values[0] = source_gain; break;
+		case SOURCE_DIRTY_MIN_GAIN: command->values[0] = source_min_gain; break;
+		case SOURCE_DIRTY_MAX_GAIN: command->values[0] = source_max_gain; break;
+		case SOURCE_DIRTY_MAX_DISTANCE: command->values[0] = source_max_distance; break;
+		case SOURCE_DIRTY_POSITION: command->values[0] = source_position.x; command->values[1] = source_position.y; command->values[2] = source_position.z; break;
+		case SOURCE_DIRTY_VELOCITY: command->values[0] = source_velocity.x; command->values[1] = source_velocity.y; command->values[2] = source_velocity.z; break;
+		case SOURCE_DIRTY_DIRECTION: command->values[0] = source_direction.x; command->values[1] = source_direction.y; command->values[2] = source_direction.z; break;
+		case SOURCE_DIRTY_BUFFER: command->object = source_audio_buffer; break;
+	}
+	data->commands.push(command);
+	return true;
+}
+
+void AudioManager::AudioSource::flushProperties(unsigned int dirty_flags)
+{
+	if(dirty_flags & SOURCE_DIRTY_LOOP)
+		alSourcei(m_source_id, AL_LOOPING, (ALint)source_loop);
+	if(dirty_flags & SOURCE_DIRTY_PITCH)
+		alSourcef(m_source_id, AL_PITCH, source_pitch);
+	if(dirty_flags & SOURCE_DIRTY_GAIN)
+		alSourcef(m_source_id, AL_GAIN, source_gain);
+	if(dirty_flags & SOURCE_DIRTY_MIN_GAIN)
+		alSourcef(m_source_id, AL_MIN_GAIN, source_min_gain);
+	if(dirty_flags & SOURCE_DIRTY_MAX_GAIN)
+		alSourcef(m_source_id, AL_MAX_GAIN, source_max_gain);
+	if(dirty_flags & SOURCE_DIRTY_MAX_DISTANCE)
+		alSourcef(m_source_id, AL_MAX_DISTANCE, source_max_distance);
+	if(dirty_flags & SOURCE_DIRTY_POSITION)
+		alSource3f(m_source_id, AL_POSITION, source_position.x, source_position.y, source_position.z);
+	if(dirty_flags & SOURCE_DIRTY_VELOCITY)
+		alSource3f(m_source_id, AL_VELOCITY, source_velocity.x, source_velocity.y, source_velocity.z);
+	if(dirty_flags & SOURCE_DIRTY_DIRECTION)
+		alSource3f(m_source_id, AL_DIRECTION, source_direction.x, source_direction.y, source_direction.z);
+	if(dirty_flags & SOURCE_DIRTY_BUFFER)
+		alSourcei(m_source_id, AL_BUFFER, source_audio_buffer && source_audio_buffer->load_state != AudioBuffer::LOAD_PENDING ? (ALint)source_audio_buffer->buffer_id : 0);
+}
+
+// Reads the flushed properties back after a batch the AL rejected, so the fields again hold what the AL kept.
+void AudioManager::AudioSource::reloadProperties(unsigned int dirty_flags)
+{
+	ALint value = 0;
+	if(dirty_flags & SOURCE_DIRTY_LOOP)
+	{
+		alGetSourcei(m_source_id, AL_LOOPING, &value);
+		source_loop = value != AL_FALSE;
+	}
+	if(dirty_flags & SOURCE_DIRTY_PITCH)
+		alGetSourcef(m_source_id, AL_PITCH, &source_pitch);
+	if(dirty_flags & SOURCE_DIRTY_GAIN)
+		alGetSourcef(m_source_id, AL_GAIN, &source_gain);
+	if(dirty_flags & SOURCE_DIRTY_MIN_GAIN)
+		alGetSourcef(m_source_id, AL_MIN_GAIN, &source_min_gain);
+	if(dirty_flags & SOURCE_DIRTY_MAX_GAIN)
+		alGetSourcef(m_source_id, AL_MAX_GAIN, &source_max_gain);
+	if(dirty_flags & SOURCE_DIRTY_MAX_DISTANCE)
+		alGetSourcef(m_source_id, AL_MAX_DISTANCE, &source_max_distance);
+	if(dirty_flags & SOURCE_DIRTY_POSITION)
+		alGetSource3f(m_source_id, AL_POSITION, &source_position.x, &source_position.y, &source_position.z);
+	if(dirty_flags & SOURCE_DIRTY_VELOCITY)
+		alGetSource3f(m_source_id, AL_VELOCITY, &source_velocity.x, &source_velocity.y, &source_velocity.z);
+	if(dirty_flags & SOURCE_DIRTY_DIRECTION)
+		alGetSource3f(m_source_id, AL_DIRECTION, &source_direction.x, &source_direction.y, &source_direction.z);
+	if(dirty_flags & SOURCE_DIRTY_BUFFER)
+	{
+		alGetSourcei(m_source_id, AL_BUFFER, &value);
+		if(value != (source_audio_buffer && source_audio_buffer->load_state != AudioBuffer::LOAD_PENDING ? (ALint)source_audio_buffer->buffer_id : 0))
+			source_audio_buffer = m_committed_buffer;
+	}
+	m_committed_buffer = 0;
+	while(alGetError() != AL_NO_ERROR);
+}
+
+//
+// AudioManager::StreamingSource
+//
+
+AudioManager::StreamingSource::StreamingSource(const AudioManager& _audio_manager, size_t _buffer_count, size_t _buffer_size) :
+	AudioSource(_audio_manager),
+	buffer_count(stream_buffer_count),
+	buffer_size(stream_buffer_size),
+	sample_count(stream_sample_count),
+	stream_buffer_count(_buffer_count < 2 ? 2 : _buffer_count),
+	stream_buffer_size(_buffer_size < 4096 ? 4096 : _buffer_size),
+	stream_sample_count(0),
+	m_stream(new StreamingSourceData()),
+	m_next_stream(0)
+{}
+
+AudioManager::StreamingSource::~StreamingSource()
+{
+	this->close();
+	this->destroy();
+	if(m_stream)
+		delete (StreamingSourceData*)m_stream;
+}
+
+bool AudioManager::StreamingSource::create()
+{
+	StreamingSourceData *stream = ((StreamingSourceData*)m_stream);
+	if(!stream)
+		return false;
+	this->destroy();
+	if(!AudioSource::create())
+		return false;
+	stream->buffers = new ALuint[stream_buffer_count];
+	memset(stream->buffers, 0, stream_buffer_count * sizeof(ALuint));
+	while(alGetError() != AL_NO_ERROR);
+	alGenBuffers((ALsizei)stream_buffer_count, stream->buffers);
+	alSourcei(source_id, AL_LOOPING, AL_FALSE);
+	if(alGetError() != AL_NO_ERROR)
+	{
+		delete[] stream->buffers;
+		stream->buffers = 0;
+		this->destroy();
+		return false;
+	}
+	stream->primed = false;
+	stream->playing = false;
+	return true;
+}
+
+bool AudioManager::StreamingSource::destroy()
+{
+	StreamingSourceData *stream = ((StreamingSourceData*)m_stream);
+	if(stream && stream->buffers)
+	{
+		if(audio_manager.makeCurrent())
+		{
+			while(alGetError() != AL_NO_ERROR);
+			if(source_id != INVALID_AL_ID)
+				this->unqueueAll();
+			alDeleteBuffers((ALsizei)stream_buffer_count, stream->buffers);
+		}
+		delete[] stream->buffers;
+		stream->buffers = 0;
+		stream->primed = false;
+		stream->playing = false;
+	}
+	return AudioSource::destroy();
+}
+
+bool AudioManager::StreamingSource::open(const char* wav_file_path)
+{
+	StreamingSourceData *stream = ((StreamingSourceData*)m_stream);
+	if(!stream || !wav_file_path)
+		return false;
+	this->close();
+	AudioManagerData *data = ((AudioManagerData*)audio_manager.m_reserved);
+	FILE *file = fopen(wav_file_path, "rb");
+	WavInfo info;
+	AudioBuffer::Format format = AudioBuffer::FORMAT_MONO8;
+	ALenum al_format = AL_NONE;
+	if(!file || !_wavReadHeader(file, info) || info.block_align == 0 || info.samples_per_sec == 0 || info.bits_per_sample == 24 ||
+		_isCompressed(format = _wavFormat(info.format_tag, info.channels, info.bits_per_sample)) || (al_format = _alFormat(data, format)) == AL_NONE)
+	{
+		// Compressed WAVs and anything else a decoder reads are streamed as the decoder's PCM frames.
+		if(file)
+			fclose(file);
+		Decoder *decoder = _openDecoder(data, wav_file_path);
+		if(!decoder)
+			return false;
+		if((al_format = _alFormat(data, decoder->format)) == AL_NONE)
+		{
+			decoder->close();
+			delete decoder;
+			return false;
+		}
+		file = 0;
+		format = decoder->format;
+		stream->decoder = decoder;
+		info.data_offset = 0;
+		info.data_size = decoder->frame_count * _formatFrameSize(format);
+		info.block_align = (uint16_t)_formatFrameSize(format);
+		info.samples_per_sec = (uint32_t)decoder->frequency;
+	}
+	stream->chunk_size = stream_buffer_size - stream_buffer_size % info.block_align;
+	if(stream->chunk_size == 0)
+		stream->chunk_size = info.block_align;
+	stream->chunk = new uint8_t[stream->chunk_size];
+	if(_formatSampleSize(format) == 2)
+		stream->effect_samples = new float[stream->chunk_size / 2];
+	stream->file = file;
+	stream->data_offset = info.data_offset;
+	stream->data_size = info.data_size;
+	stream->read_offset = 0;
+	stream->block_align = info.block_align;
+	stream->frequency = info.samples_per_sec;
+	stream->al_format = al_format;
+	stream->format = format;
+	stream->primed = false;
+	stream->playing = false;
+	stream->end_of_stream = false;
+	stream_sample_count = info.data_size / info.block_align;
+	return true;
+}
+
+bool AudioManager::StreamingSource::close()
+{
+	StreamingSourceData *stream = ((StreamingSourceData*)m_stream);
+	if(!stream || !_streamIsOpen(stream))
+		return false;
+	if(stream->buffers && source_id != INVALID_AL_ID && audio_manager.makeCurrent())
+		this->unqueueAll();
+	if(stream->file)
+		fclose(stream->file);
+	if(stream->decoder)
+	{
+		stream->decoder->close();
+		delete stream->decoder;
+	}
+	delete[] stream->chunk;
+	delete[] stream->effect_samples;
+	stream->file = 0;
+	stream->decoder = 0;
+	stream->chunk = 0;
+	stream->effect_samples = 0;
+	stream->chunk_size = 0;
+	stream->data_size = 0;
+	stream->read_offset = 0;
+	stream->primed = false;
+	stream->playing = false;
+	stream->end_of_stream = false;
+	stream_sample_count = 0;
+	return true;
+}
+
+bool AudioManager::StreamingSource::isOpen() const
+{
+	StreamingSourceData *stream = ((StreamingSourceData*)m_stream);
+	return stream && _streamIsOpen(stream);
+}
+
+bool AudioManager::StreamingSource::play()
+{
+	StreamingSourceData *stream = ((StreamingSourceData*)m_stream);
+	if(!this->prepare() || !AudioSource::play())
+		return false;
+	stream->primed = false;
+	stream->playing = true;
+	return true;
+}
+
+// Fills the queue ahead of a start unless the source is already running or primed.
+bool AudioManager::StreamingSource::prepare()
+{
+	StreamingSourceData *stream = ((StreamingSourceData*)m_stream);
+	if(!stream || !_streamIsOpen(stream) || !stream->buffers || !AudioSource::isValid() || !audio_manager.makeCurrent())
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	ALint state = AL_INITIAL;
+	alGetSourcei(source_id, AL_SOURCE_STATE, &state);
+	if(state != AL_PAUSED && state != AL_PLAYING && !stream->primed)
+	{
+		if(stream->end_of_stream)
+			this->seek(0);
+		if(!this->prime())
+			return false;
+	}
+	return true;
+}
+
+bool AudioManager::StreamingSource::pause()
+{
+	StreamingSourceData *stream = ((StreamingSourceData*)m_stream);
+	if(!stream || !AudioSource::pause())
+		return false;
+	stream->playing = false;
+	return true;
+}
+
+bool AudioManager::StreamingSource::stop()
+{
+	StreamingSourceData *stream = ((StreamingSourceData*)m_stream);
+	if(!stream || !_streamIsOpen(stream) || !AudioSource::stop())
+		return false;
+	stream->playing = false;
+	return this->seek(0);
+}
+
+bool AudioManager::StreamingSource::update()
+{
+	StreamingSourceData *stream = ((StreamingSourceData*)m_stream);
+	if(!stream || !_streamIsOpen(stream) || !stream->buffers || !AudioSource::isValid() || !audio_manager.makeCurrent())
+		return false;
+	if(!stream->playing)
+		return true;
+	while(alGetError() != AL_NO_ERROR);
+	ALint processed = 0;
+	alGetSourcei(source_id, AL_BUFFERS_PROCESSED, &processed);
+	for(; processed > 0; --processed)
+	{
+		ALuint al_buffer = INVALID_AL_ID;
+		alSourceUnqueueBuffers(source_id, 1, &al_buffer);
+		if(this->fill(al_buffer))
+			alSourceQueueBuffers(source_id, 1, &al_buffer);
+	}
+	ALint state = AL_STOPPED, queued = 0;
+	alGetSourcei(source_id, AL_SOURCE_STATE, &state);
+	alGetSourcei(source_id, AL_BUFFERS_QUEUED, &queued);
+	if(state != AL_PLAYING && state != AL_PAUSED)
+	{
+		// Either the ring ran dry before we could refill it or the stream has ended.
+		if(queued > 0)
+			alSourcePlay(source_id);
+		else
+			stream->playing = false;
+		source_state = queued > 0 ? STATE_PLAYING : _sourceState(state);
+	}
+	return alGetError() == AL_NO_ERROR;
+}
+
+bool AudioManager::StreamingSource::seek(size_t sample_offset)
+{
+	StreamingSourceData *stream = ((StreamingSourceData*)m_stream);
+	if(!stream || !_streamIsOpen(stream) || sample_offset > stream_sample_count)
+		return false;
+	stream->read_offset = sample_offset * stream->block_align;
+	stream->end_of_stream = false;
+	stream->primed = false;
+	if(stream->decoder ? !stream->decoder->seek(sample_offset) : fseek(stream->file, (long)(stream->data_offset + stream->read_offset), SEEK_SET) != 0)
+		return false;
+	if(!stream->playing)
+	{
+		if(stream->buffers && source_id != INVALID_AL_ID && audio_manager.makeCurrent())
+			this->unqueueAll();
+		return true;
+	}
+	if(!AudioSource::isValid() || !audio_manager.makeCurrent() || !this->prime())
+		return false;
+	stream->primed = false;
+	return AudioSource::play();
+}
+
+bool AudioManager::StreamingSource::setLoop(bool _loop)
+{
+	// Looping is done while refilling the ring; AL_LOOPING on a queue would repeat only the queued buffers.
+	source_loop = _loop;
+	return true;
+}
+
+// A stream runs its chain on the decoded chunks instead of the AL's EFX objects. Every chain comes
+// from newEffectChain(), so the const only mirrors AudioSource::setEffectChain.
+bool AudioManager::StreamingSource::setEffectChain(const EffectChain* effect_chain)
+{
+	StreamingSourceData *stream = ((StreamingSourceData*)m_stream);
+	if(!stream || (effect_chain && _streamIsOpen(stream) && !_streamTakesEffects(stream, effect_chain)))
+		return false;
+	stream->effect_chain = const_cast<EffectChain*>(effect_chain);
+	return true;
+}
+
+bool AudioManager::StreamingSource::fill(unsigned int al_buffer)
+{
+	StreamingSourceData *stream = ((StreamingSourceData*)m_stream);
+	size_t filled = 0;
+	while(stream->decoder && filled < stream->chunk_size)
+	{
+		// Decoders report the end by reading nothing; a loop that reads nothing right after
+		// rewinding means the stream is empty.
+		size_t read = stream->decoder->read(stream->chunk + filled, (stream->chunk_size - filled) / stream->block_align);
+		filled += read * stream->block_align;
+		stream->read_offset += read * stream->block_align;
+		if(read > 0)
+			continue;
+		if(!source_loop || stream->read_offset == 0 || !stream->decoder->seek(0))
+			break;
+		stream->read_offset = 0;
+	}
+	while(stream->file && filled < stream->chunk_size)
+	{
+		if(stream->read_offset >= stream->data_size)
+		{
+			if(!source_loop || stream->data_size == 0)
+				break;
+			stream->read_offset = 0;
+			if(fseek(stream->file, (long)stream->data_offset, SEEK_SET) != 0)
+				break;
+		}
+		size_t to_read = stream->chunk_size - filled;
+		if(to_read > stream->data_size - stream->read_offset)
+			to_read = stream->data_size - stream->read_offset;
+		size_t read = fread(stream->chunk + filled, 1, to_read, stream->file);
+		filled += read;
+		stream->read_offset += read;
+		if(read < to_read)
+		{
+			// The file is shorter than its data chunk claims; treat what we got as the whole stream.
+			stream->data_size = stream->read_offset - stream->read_offset % stream->block_align;
+			stream_sample_count = stream->data_size / stream->block_align;
+			if(read == 0 && stream->read_offset == 0)
+				break;
+		}
+	}
+	filled -= filled % stream->block_align;
+	if(filled == 0)
+	{
+		stream->end_of_stream = true;
+		return false;
+	}
+	if(stream->effect_chain && _streamTakesEffects(stream, stream->effect_chain))
+		_processStreamChunk(stream, filled);
+	alBufferData(al_buffer, stream->al_format, stream->chunk, (ALsizei)filled, (ALsizei)stream->frequency);
+	_countUpload((AudioManagerData*)audio_manager.m_reserved, filled);
+	return true;
+}
+
+bool AudioManager::StreamingSource::prime()
+{
+	StreamingSourceData *stream = ((StreamingSourceData*)m_stream);
+	this->unqueueAll();
+	while(alGetError() != AL_NO_ERROR);
+	size_t queued = 0;
+	while(queued < stream_buffer_count && this->fill(stream->buffers[queued]))
+		++queued;
+	if(queued > 0)
+		alSourceQueueBuffers(source_id, (ALsizei)queued, stream->buffers);
+	stream->primed = queued > 0 && alGetError() == AL_NO_ERROR;
+	return stream->primed;
+}
+
+void AudioManager::StreamingSource::unqueueAll()
+{
+	// Detaching the buffer from a stopped source releases every queued buffer at once.
+	alSourceStop(source_id);
+	alSourcei(source_id, AL_BUFFER, 0);
+	source_state = STATE_STOPPED;
+}
+
+//
+// AudioManager::Voice
+//
+
+AudioManager::Voice::Voice(const AudioManager& _audio_manager) :
+	audio_manager(_audio_manager),
+	handle(m_handle),
+	audio_buffer(voice_audio_buffer),
+	loop(voice_loop),
+	priority(voice_priority),
+	pitch(voice_pitch),
+	gain(voice_gain),
+	max_distance(voice_max_distance),
+	position(voice_position),
+	velocity(voice_velocity),
+	direction(voice_direction),
+	cone_inner_angle(voice_cone_inner_angle),
+	cone_outer_angle(voice_cone_outer_angle),
+	cone_outer_gain(voice_cone_outer_gain),
+	audibility(voice_audibility),
+	doppler(voice_doppler),
+	offset(voice_offset),
+	voice_audio_buffer(0),
+	voice_loop(false),
+	voice_priority(1.f),
+	voice_pitch(1.f),
+	voice_gain(1.f),
+	voice_max_distance(1000.f),
+	voice_position(0.f, 0.f, 0.f),
+	voice_velocity(0.f, 0.f, 0.f),
+	voice_direction(0.f, 0.f, 0.f),
+	voice_cone_inner_angle(360.f),
+	voice_cone_outer_angle(360.f),
+	voice_cone_outer_gain(0.f),
+	voice_audibility(0.f),
+	voice_doppler(1.f),
+	voice_offset(0.f),
+	m_handle{INVALID_POOL_INDEX, 0},
+	m_source(0),
+	m_fade(1.f),
+	m_playing(false),
+	m_pending(false),
+	m_selected(false)
+{}
+
+AudioManager::Voice::~Voice()
+{}
+
+bool AudioManager::Voice::isPlaying() const
+{
+	return m_playing;
+}
+
+bool AudioManager::Voice::isVirtual() const
+{
+	return m_playing && !m_source;
+}
+
+bool AudioManager::Voice::play()
+{
+	if(!voice_audio_buffer)
+		return false;
+	voice_offset = 0.f;
+	m_fade = 1.f;
+	m_playing = true;
+	m_pending = true;
+	if(m_source)
+	{
+		m_source->stop();
+		m_source->setGain(voice_gain);
+		return m_source->play();
+	}
+	return true;
+}
+
+bool AudioManager::Voice::stop()
+{
+	// The real source, if any, is handed back on the next updateVoices.
+	m_playing = false;
+	m_pending = false;
+	voice_offset = 0.f;
+	if(m_source)
+		return m_source->stop();
+	return true;
+}
+
+bool AudioManager::Voice::setBuffer(const AudioBuffer* _audio_buffer)
+{
+	voice_audio_buffer = _audio_buffer;
+	voice_offset = 0.f;
+	if(!m_source)
+		return true;
+	if(!m_source->stop() || !m_source->setBuffer(_audio_buffer))
+		return false;
+	return !m_playing || !_audio_buffer || m_source->play();
+}
+
+bool AudioManager::Voice::setLoop(bool _loop)
+{
+	voice_loop = _loop;
+	return !m_source || m_source->setLoop(_loop);
+}
+
+bool AudioManager::Voice::setPriority(float _priority)
+{
+	voice_priority = _priority;
+	return true;
+}
+
+bool AudioManager::Voice::setPitch(float _pitch)
+{
+	voice_pitch = _pitch;
+	return !m_source || m_source->setPitch(_pitch);
+}
+
+bool AudioManager::Voice::setGain(float _gain)
+{
+	voice_gain = _gain;
+	return !m_source || m_source->setGain(_gain * m_fade);
+}
+
+bool AudioManager::Voice::setMaxDistance(float _max_distance)
+{
+	voice_max_distance = _max_distance;
+	return !m_source || m_source->setMaxDistance(_max_distance);
+}
+
+bool AudioManager::Voice::setPosition(const axl::math::Vec3f& _position)
+{
+	voice_position = _position;
+	return !m_source || m_source->setPosition(_position);
+}
+
+bool AudioManager::Voice::setVelocity(const axl::math::Vec3f& _velocity)
+{
+	voice_velocity = _velocity;
+	return !m_source || m_source->setVelocity(_velocity);
+}
+
+bool AudioManager::Voice::setDirection(const axl::math::Vec3f& _direction)
+{
+	voice_direction = _direction;
+	return !m_source || m_source->setDirection(_direction);
+}
+
+bool AudioManager::Voice::setCone(float _inner_angle, float _outer_angle, float _outer_gain)
+{
+	if(_inner_angle < 0.f || _inner_angle > 360.f || _outer_angle < _inner_angle || _outer_angle > 360.f || _outer_gain < 0.f || _outer_gain > 1.f)
+		return false;
+	voice_cone_inner_angle = _inner_angle;
+	voice_cone_outer_angle = _outer_angle;
+	voice_cone_outer_gain = _outer_gain;
+	if(!m_source)
+		return true;
+	if(!audio_manager.makeCurrent())
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	alSourcef(m_source->source_id, AL_CONE_INNER_ANGLE, _inner_angle);
+	alSourcef(m_source->source_id, AL_CONE_OUTER_ANGLE, _outer_angle);
+	alSourcef(m_source->source_id, AL_CONE_OUTER_GAIN, _outer_gain);
+	return alGetError() == AL_NO_ERROR;
+}
+
+//
+// AudioManager
+//
+
+AudioManager::AudioManager() :
+	m_reserved(new AudioManagerData()),
+	position(audioman_position),
+	velocity(audioman_velocity),
+	orientation_at(audioman_orientation_at),
+	orientation_up(audioman_orientation_up),
+	max_voices(audioman_max_voices),
+	cache_budget(audioman_cache_budget),
+	cache_stats(audioman_cache_stats),
+	audioman_position(0.f, 0.f, 0.f),
+	audioman_velocity(0.f, 0.f, 0.f),
+	audioman_orientation_at(0.f, 0.f, -1.f),
+	audioman_orientation_up(0.f, 1.f, 0.f),
+	audioman_max_voices(DEFAULT_MAX_VOICES),
+	audioman_cache_budget(DEFAULT_CACHE_BUDGET),
+	audioman_cache_stats{0, 0, 0, 0}
+{}
+
+AudioManager::~AudioManager()
+{
+	this->destroy();
+	if(m_reserved)
+		delete (AudioManagerData*)m_reserved;
+}
+
+bool AudioManager::create(bool threaded)
+{
+	DeviceConfig config = { 0, 0, 0, 0, HRTF_DEFAULT, threaded };
+	return this->create(config);
+}
+
+// Fields left at 0 (and HRTF_DEFAULT) keep the driver's choice. The rest are requests only: the
+// driver may round the frequency or refresh and cap the source counts, so getLatency() reports
+// what was granted. A higher refresh shortens the mixer period, and with it the output latency.
+// Managers given the same device each get their own context and listener on it; the device's
+// attributes are shared, so the last manager created on it decides them.
+bool AudioManager::create(const DeviceConfig& config, Device* device)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!data)
+		m_reserved = data = new AudioManagerData();
+	if(!data || data->device)
+		return false;
+	if(device ? !device->retain() : !(device = AudioManager::openDevice()))
+		return false;
+	data->shared_device = device;
+	data->device = ((DeviceData*)device->m_reserved)->device;
+	ALCint attributes[11];
+	size_t count = 0;
+	if(config.frequency)
+	{
+		attributes[count++] = ALC_FREQUENCY;
+		attributes[count++] = (ALCint)config.frequency;
+	}
+	if(config.refresh)
+	{
+		attributes[count++] = ALC_REFRESH;
+		attributes[count++] = (ALCint)config.refresh;
+	}
+	if(config.mono_sources)
+	{
+		attributes[count++] = ALC_MONO_SOURCES;
+		attributes[count++] = (ALCint)config.mono_sources;
+	}
+	if(config.stereo_sources)
+	{
+		attributes[count++] = ALC_STEREO_SOURCES;
+		attributes[count++] = (ALCint)config.stereo_sources;
+	}
+	if(config.hrtf != HRTF_DEFAULT && alcIsExtensionPresent(data->device, "ALC_SOFT_HRTF"))
+	{
+		attributes[count++] = HRTF_SOFT;
+		attributes[count++] = config.hrtf == HRTF_ENABLED ? ALC_TRUE : ALC_FALSE;
+	}
+	attributes[count] = 0;
+	data->context = alcCreateContext(data->device, attributes);
+	if(!data->context)
+	{
+		AudioManager::releaseDevice(data->shared_device);
+		data->shared_device = 0;
+		data->device = 0;
+		return false;
+	}
+	return this->initContext(config.threaded);
+}
+
+AudioManager::Device* AudioManager::openDevice(const char* device_name)
+{
+	Device *device = new(std::nothrow) Device();
+	if(!device)
+		return 0;
+	DeviceData *data = ((DeviceData*)device->m_reserved);
+	data->device = alcOpenDevice(device_name);
+	if(!data->device)
+	{
+		delete device;
+		return 0;
+	}
+	return device;
+}
+
+bool AudioManager::releaseDevice(Device* device)
+{
+	if(!device)
+		return false;
+	DeviceData *data = ((DeviceData*)device->m_reserved);
+	if(data->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		delete device;
+	return true;
+}
+
+// A loopback device mixes only when render() asks it to, as fast as the CPU allows, and never
+// touches a sound card. It is owned by this manager alone rather than shared like the default device.
+bool AudioManager::createOffline(size_t frequency, size_t channel_count)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!data)
+		m_reserved = data = new AudioManagerData();
+	if(!data || data->device || frequency == 0 || !alcIsExtensionPresent(NULL, "ALC_SOFT_loopback"))
+		return false;
+	PFN_alcLoopbackOpenDeviceSOFT alcLoopbackOpenDeviceSOFT = (PFN_alcLoopbackOpenDeviceSOFT)alcGetProcAddress(NULL, "alcLoopbackOpenDeviceSOFT");
+	PFN_alcIsRenderFormatSupportedSOFT alcIsRenderFormatSupportedSOFT = (PFN_alcIsRenderFormatSupportedSOFT)alcGetProcAddress(NULL, "alcIsRenderFormatSupportedSOFT");
+	PFN_alcRenderSamplesSOFT alcRenderSamplesSOFT = (PFN_alcRenderSamplesSOFT)alcGetProcAddress(NULL, "alcRenderSamplesSOFT");
+	ALCint channels = _loopbackChannels(channel_count);
+	if(!alcLoopbackOpenDeviceSOFT || !alcIsRenderFormatSupportedSOFT || !alcRenderSamplesSOFT || channels == 0)
+		return false;
+	data->device = alcLoopbackOpenDeviceSOFT(NULL);
+	if(!data->device)
+		return false;
+	ALCint attributes[] = { LOOPBACK_FORMAT_CHANNELS, channels, LOOPBACK_FORMAT_TYPE, LOOPBACK_TYPE_FLOAT, ALC_FREQUENCY, (ALCint)frequency, 0 };
+	if(!alcIsRenderFormatSupportedSOFT(data->device, (ALCsizei)frequency, channels, LOOPBACK_TYPE_FLOAT) ||
+		!(data->context = alcCreateContext(data->device, attributes)))
+	{
+		alcCloseDevice(data->device);
+		data->device = 0;
+		return false;
+	}
+	data->render_samples = alcRenderSamplesSOFT;
+	data->render_channels = channel_count;
+	return this->initContext(false);
+}
+
+bool AudioManager::initContext(bool threaded)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	bool thread_local_context = alcIsExtensionPresent(data->device, "ALC_EXT_thread_local_context");
+	data->set_thread_context = thread_local_context ? (PFN_alcSetThreadContext)alcGetProcAddress(data->device, "alcSetThreadContext") : 0;
+	data->get_thread_context = thread_local_context ? (PFN_alcGetThreadContext)alcGetProcAddress(data->device, "alcGetThreadContext") : 0;
+	if(!data->get_thread_context)
+		data->set_thread_context = 0;
+	if(!AudioManager::makeCurrent())
+		return false;
+	while(alGetError() != AL_NO_ERROR);
+	alListener3f(AL_POSITION, audioman_position.x, audioman_position.y, audioman_position.z);
+	alListener3f(AL_VELOCITY, audioman_velocity.x, audioman_velocity.y, audioman_velocity.z);
+	float fp_orientation[] = { audioman_orientation_at.x, audioman_orientation_at.y, audioman_orientation_at.z, audioman_orientation_up.x, audioman_orientation_up.y, audioman_orientation_up.z };
+	alListenerfv(AL_ORIENTATION, fp_orientation);
+	if(alGetError() != AL_NO_ERROR)
+		return false;
+	_queryFormats(data);
+	_loadEfx(data->device, data->efx);
+	ALCint device_frequency = 0;
+	alcGetIntegerv(data->device, ALC_FREQUENCY, 1, &device_frequency);
+	data->device_frequency = device_frequency > 0 ? (size_t)device_frequency : 0;
+	data->get_clock_latency = alcIsExtensionPresent(data->device, "ALC_SOFT_device_clock") ?
+		(PFN_alcGetInteger64vSOFT)alcGetProcAddress(data->device, "alcGetInteger64vSOFT") : 0;
+	data->get_source_latency = alIsExtensionPresent("AL_SOFT_source_latency") ?
+		(PFN_alGetSourcedvSOFT)alGetProcAddress("alGetSourcedvSOFT") : 0;
+	// Start times are on the ALC_SOFT_device_clock timeline, so the two only work together.
+	data->play_at_time = data->get_clock_latency && alIsExtensionPresent("AL_SOFT_source_start_delay") ?
+		(PFN_alSourcePlayAtTimevSOFT)alGetProcAddress("alSourcePlayAtTimevSOFT") : 0;
+	data->scheduled.count = 0;
+	data->rendered_frames = 0;
+	data->clock_origin = std::chrono::steady_clock::now();
+	data->state_events_enabled = _enableStateEvents(data, true);
+	data->state_events.store(1, std::memory_order_relaxed);
+	if(threaded)
+	{
+		data->threaded = true;
+		data->running.store(true, std::memory_order_release);
+		data->audio_thread = std::thread(&AudioManager::runAudioThread, this);
+	}
+	return true;
+}
+
+bool AudioManager::destroy()
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!data || !data->device || !data->context)
+		return false;
+	if(data->threaded)
+	{
+		data->running.store(false, std::memory_order_release);
+		if(data->audio_thread.joinable())
+			data->audio_thread.join();
+		data->threaded = false;
+		// Anything pushed after the thread's last drain still runs, just on this thread.
+		if(AudioManager::makeCurrent())
+		{
+			while(AudioCommand *command = data->commands.pop())
+			{
+				this->executeCommand(command);
+				delete command;
+			}
+		}
+		data->playing.count = 0;
+		data->state_results.count = 0;
+		data->upload_results.count = 0;
+	}
+	if(data->load_worker_count > 0)
+	{
+		{
+			std::lock_guard<std::mutex> lock(data->load_mutex);
+			data->load_stopping = true;
+		}
+		data->load_signal.notify_all();
+		for(size_t i = 0; i < data->load_worker_count; ++i)
+			data->load_workers[i].join();
+		data->load_worker_count = 0;
+		data->load_stopping = false;
+	}
+	while(LoadJob *job = data->load_queue.pop())
+		_releaseJob(job);
+	while(LoadJob *job = data->loaded.pop())
+		_releaseJob(job);
+	data->pending_sources.count = 0;
+	_clearCache(data);
+	audioman_cache_stats.resident_bytes = 0;
+	while(data->dirty_sources)
+		data->dirty_sources->unmarkDirty();
+	data->updating = false;
+	data->listener_dirty = 0;
+	for(StreamingSource* stream = data->streams; stream; stream = stream->m_next_stream)
+	{
+		stream->destroy();
+		stream->source_effect_chain = 0;
+		((StreamingSourceData*)stream->m_stream)->effect_chain = 0;
+	}
+	// Tear the pools down in one pass: every live name joins its stock and each stock is
+	// deleted with a single call. Sources go first so no buffer is still attached.
+	bool is_current = AudioManager::makeCurrent();
+	if(is_current && data->state_events_enabled)
+		_enableStateEvents(data, false);
+	data->state_events_enabled = false;
+	data->finished.count = 0;
+	data->finished_head = 0;
+	for(unsigned int index = 0; index < data->voices.page_count * POOL_PAGE_SLOTS; ++index)
+	{
+		ObjectPool<Voice>::Slot *slot = data->voices.slot(index);
+		if(!slot->live)
+			continue;
+		Voice *voice = (Voice*)slot->storage;
+		voice->m_source = 0;
+		voice->~Voice();
+		data->voices.release(index);
+	}
+	for(unsigned int index = 0; index < data->sources.page_count * POOL_PAGE_SLOTS; ++index)
+	{
+		ObjectPool<AudioSource>::Slot *slot = data->sources.slot(index);
+		if(!slot->live)
+			continue;
+		AudioSource *source = (AudioSource*)slot->storage;
+		if(source->m_source_id != INVALID_AL_ID)
+			data->source_names.push(source->m_source_id);
+		source->m_source_id = INVALID_AL_ID;
+		source->~AudioSource();
+		data->sources.release(index);
+	}
+	if(is_current && data->source_names.count > 0)
+	{
+		alSourceStopv((ALsizei)data->source_names.count, data->source_names.items);
+		alDeleteSources((ALsizei)data->source_names.count, data->source_names.items);
+	}
+	data->source_names.count = 0;
+	for(unsigned int index = 0; index < data->buffers.page_count * POOL_PAGE_SLOTS; ++index)
+	{
+		ObjectPool<AudioBuffer>::Slot *slot = data->buffers.slot(index);
+		if(!slot->live)
+			continue;
+		AudioBuffer *buffer = (AudioBuffer*)slot->storage;
+		if(buffer->m_buffer_id != INVALID_AL_ID)
+			data->buffer_names.push(buffer->m_buffer_id);
+	}
+	if(is_current)
+		while(alGetError() != AL_NO_ERROR);
+	if(is_current && data->buffer_names.count > 0)
+		alDeleteBuffers((ALsizei)data->buffer_names.count, data->buffer_names.items);
+	bool buffers_released = is_current && alGetError() == AL_NO_ERROR;
+	data->buffer_names.count = 0;
+	for(unsigned int index = 0; index < data->buffers.page_count * POOL_PAGE_SLOTS; ++index)
+	{
+		ObjectPool<AudioBuffer>::Slot *slot = data->buffers.slot(index);
+		if(!slot->live)
+			continue;
+		AudioBuffer *buffer = (AudioBuffer*)slot->storage;
+		buffer->m_buffer_id = INVALID_AL_ID;
+		if(buffers_released)
+			buffer->releaseMapping();
+		buffer->~AudioBuffer();
+		data->buffers.release(index);
+	}
+	while(EffectChain *effect_chain = data->chains)
+	{
+		data->chains = effect_chain->m_next_chain;
+		if(is_current)
+			_releaseEfx(data->efx, (EffectChainData*)effect_chain->m_chain, effect_chain->chain_effect_count);
+		delete effect_chain;
+	}
+	data->master_chain = 0;
+	if(data->get_thread_context && data->get_thread_context() == data->context)
+		data->set_thread_context(0);
+	alcGetCurrentContext() != data->context || alcMakeContextCurrent(0);
+	alcDestroyContext(data->context);
+	if(data->shared_device)
+		AudioManager::releaseDevice(data->shared_device);
+	else
+		alcCloseDevice(data->device);
+	data->shared_device = 0;
+	data->set_thread_context = 0;
+	data->get_thread_context = 0;
+	data->render_samples = 0;
+	data->render_channels = 0;
+	data->scheduled.count = 0;
+	data->context = 0;
+	data->device = 0;
+	return true;
+}
+
+bool AudioManager::isValid() const
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	return data && data->device && data->context;
+}
+
+bool AudioManager::isThreaded() const
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	return data && data->threaded;
+}
+
+bool AudioManager::isOffline() const
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	return data && data->render_samples;
+}
+
+// The device to hand to another manager's create() so both share it. A loopback device belongs
+// to its manager alone, so an offline manager has none to share.
+AudioManager::Device* AudioManager::getDevice() const
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	return data ? data->shared_device : 0;
+}
+
+// Reports what the device granted, read back from its attribute list rather than echoed from
+// the DeviceConfig. With ALC_SOFT_device_clock the output latency is measured by the driver;
+// without it, it is estimated as one mixer update, the least any device can buffer. The device
+// clock is the timeline playSourcesAt() schedules on.
+bool AudioManager::getLatency(Latency& latency) const
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!AudioManager::isValid())
+		return false;
+	latency = Latency{ 0.0, 0.0, 0, data->device_frequency, 0, 0, 0, false, false };
+	ALCint size = 0;
+	alcGetIntegerv(data->device, ALC_ATTRIBUTES_SIZE, 1, &size);
+	ALCint *attributes = size > 0 ? new(std::nothrow) ALCint[size] : 0;
+	if(attributes)
+	{
+		alcGetIntegerv(data->device, ALC_ALL_ATTRIBUTES, size, attributes);
+		for(ALCint i = 0; i + 1 < size && attributes[i] != 0; i += 2)
+		{
+			size_t value = attributes[i + 1] > 0 ? (size_t)attributes[i + 1] : 0;
+			switch(attributes[i])
+			{
+				case ALC_FREQUENCY: latency.frequency = value; break;
+				case ALC_REFRESH: latency.refresh = value; break;
+				case ALC_MONO_SOURCES: latency.mono_sources = value; break;
+				case ALC_STEREO_SOURCES: latency.stereo_sources = value; break;
+				case HRTF_SOFT: latency.hrtf = value != 0; break;
+				default: break;
+			}
+		}
+		delete[] attributes;
+	}
+	if(latency.refresh > 0)
+		latency.update_period = 1.0 / (double)latency.refresh;
+	if(data->get_clock_latency)
+	{
+		int64_t clock_latency[2] = { 0, 0 };
+		data->get_clock_latency(data->device, DEVICE_CLOCK_LATENCY_SOFT, 2, clock_latency);
+		latency.device_clock = clock_latency[0] > 0 ? (uint64_t)clock_latency[0] : 0;
+		latency.output = (double)clock_latency[1] * 1e-9;
+		latency.measured = true;
+	}
+	else
+	{
+		latency.device_clock = _deviceClock(data);
+		latency.output = latency.update_period;
+	}
+	return true;
+}
+
+// Mixes frame_count interleaved float frames of the loopback device into samples.
+bool AudioManager::render(float* samples, size_t frame_count)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!samples || !data || !data->render_samples || !AudioManager::isValid())
+		return false;
+	// Software-scheduled starts split the mix at their frame, so they are sample-accurate here.
+	for(size_t rendered = 0; rendered < frame_count;)
+	{
+		size_t chunk = frame_count - rendered;
+		if(data->scheduled.count > 0 && data->device_frequency)
+		{
+			uint64_t now = _deviceClock(data), due = UINT64_MAX;
+			for(size_t i = 0; i < data->scheduled.count; ++i)
+				due = std::min(due, data->scheduled.items[i].time);
+			size_t wait = due <= now ? 0 : (size_t)std::min<uint64_t>(chunk, ((due - now) * data->device_frequency + 999999999ull) / 1000000000ull);
+			if(wait == 0 && AudioManager::makeCurrent())
+			{
+				this->startScheduled(now);
+				continue;
+			}
+			if(wait > 0)
+				chunk = wait;
+		}
+		data->render_samples(data->device, samples + rendered * data->render_channels, (ALCsizei)chunk);
+		data->rendered_frames += chunk;
+		rendered += chunk;
+	}
+	if(alcGetError(data->device) != ALC_NO_ERROR)
+		return false;
+	return !data->master_chain || data->master_chain->process(samples, frame_count);
+}
+
+bool AudioManager::setPosition(const axl::math::Vec3f& _position)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(this->postsCommands())
+	{
+		audioman_position = _position;
+		return _postListener(data, LISTENER_DIRTY_POSITION, *this);
+	}
+	if(data && data->updating)
+	{
+		audioman_position = _position;
+		data->listener_dirty |= LISTENER_DIRTY_POSITION;
+		return true;
+	}
+	if(AudioManager::makeCurrent())
+	{
+		while(alGetError() != AL_NO_ERROR);
+		alListener3f(AL_POSITION, _position.x, _position.y, _position.z);
+		if(alGetError() != AL_NO_ERROR)
+			return false;
+	}
+	audioman_position = _position;
+	return true;
+}
+
+bool AudioManager::setVelocity(const axl::math::Vec3f& _velocity)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(this->postsCommands())
+	{
+		audioman_velocity = _velocity;
+		return _postListener(data, LISTENER_DIRTY_VELOCITY, *this);
+	}
+	if(data && data->updating)
+	{
+		audioman_velocity = _velocity;
+		data->listener_dirty |= LISTENER_DIRTY_VELOCITY;
+		return true;
+	}
+	if(AudioManager::makeCurrent())
+	{
+		while(alGetError() != AL_NO_ERROR);
+		alListener3f(AL_VELOCITY, _velocity.x, _velocity.y, _velocity.z);
+		if(alGetError() != AL_NO_ERROR)
+			return false;
+	}
+	audioman_velocity = _velocity;
+	return true;
+}
+
+bool AudioManager::setOrientationAt(const axl::math::Vec3f& _orientation_at)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(this->postsCommands())
+	{
+		audioman_orientation_at = _orientation_at;
+		return _postListener(data, LISTENER_DIRTY_ORIENTATION, *this);
+	}
+	if(data && data->updating)
+	{
+		audioman_orientation_at = _orientation_at;
+		data->listener_dirty |= LISTENER_DIRTY_ORIENTATION;
+		return true;
+	}
+	if(AudioManager::makeCurrent())
+	{
+		while(alGetError() != AL_NO_ERROR);
+		float fp_orientation[] = { _orientation_at.x, _orientation_at.y, _orientation_at.z, audioman_orientation_up.x, audioman_orientation_up.y, audioman_orientation_up.z };
+		alListenerfv(AL_ORIENTATION, fp_orientation);
+		if(alGetError() != AL_NO_ERROR)
+			return false;
+	}
+	audioman_orientation_at = _orientation_at;
+	return true;
+}
+
+bool AudioManager::setOrientationUp(const axl::math::Vec3f& _orientation_up)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(this->postsCommands())
+	{
+		audioman_orientation_up = _orientation_up;
+		return _postListener(data, LISTENER_DIRTY_ORIENTATION, *this);
+	}
+	if(data && data->updating)
+	{
+		audioman_orientation_up = _orientation_up;
+		data->listener_dirty |= LISTENER_DIRTY_ORIENTATION;
+		return true;
+	}
+	if(AudioManager::makeCurrent())
+	{
+		while(alGetError() != AL_NO_ERROR);
+		float fp_orientation[] = { audioman_orientation_at.x, audioman_orientation_at.y, audioman_orientation_at.z, _orientation_up.x, _orientation_up.y, _orientation_up.z };
+		alListenerfv(AL_ORIENTATION, fp_orientation);
+		if(alGetError() != AL_NO_ERROR)
+			return false;
+	}
+	audioman_orientation_up = _orientation_up;
+	return true;
+}
+
+bool AudioManager::setOrientation(const axl::math::Vec3f& _orientation_at, const axl::math::Vec3f& _orientation_up)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(this->postsCommands())
+	{
+		audioman_orientation_at = _orientation_at;
+		audioman_orientation_up = _orientation_up;
+		return _postListener(data, LISTENER_DIRTY_ORIENTATION, *this);
+	}
+	if(data && data->updating)
+	{
+		audioman_orientation_at = _orientation_at;
+		audioman_orientation_up = _orientation_up;
+		data->listener_dirty |= LISTENER_DIRTY_ORIENTATION;
+		return true;
+	}
+	if(AudioManager::makeCurrent())
+	{
+		while(alGetError() != AL_NO_ERROR);
+		float fp_orientation[] = { _orientation_at.x, _orientation_at.y, _orientation_at.z, _orientation_up.x, _orientation_up.y, _orientation_up.z };
+		alListenerfv(AL_ORIENTATION, fp_orientation);
+		if(alGetError() != AL_NO_ERROR)
+			return false;
+	}
+	audioman_orientation_at = _orientation_at;
+	audioman_orientation_up = _orientation_up;
+	return true;
+}
+
+AudioManager::AudioBuffer* AudioManager::newBuffer()
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	StatScope stat_scope(data, STAT_CREATE);
+	if(!AudioManager::isValid())
+		return 0;
+	if(this->postsCommands())
+	{
+		AudioBuffer *buffer = 0;
+		{
+			std::lock_guard<SpinLock> guard(data->pool_lock);
+			Handle buffer_handle;
+			void *storage = data->buffers.allocate(buffer_handle);
+			if(!storage)
+				return 0;
+			buffer = new(storage) AudioBuffer(*this);
+			buffer->m_handle = buffer_handle;
+		}
+		data->commands.push(new AudioCommand(CMD_BUFFER_CREATE, buffer));
+		return buffer;
+	}
+	if(!AudioManager::makeCurrent())
+		return 0;
+	ALuint buffer_id = _takeName(data->buffer_names, false);
+	if(buffer_id == INVALID_AL_ID)
+	{
+		_countStat(data->stats.failed_buffers);
+		return 0;
+	}
+	Handle buffer_handle;
+	void *storage = data->buffers.allocate(buffer_handle);
+	if(!storage)
+	{
+		data->buffer_names.push(buffer_id);
+		return 0;
+	}
+	AudioBuffer *buffer = new(storage) AudioBuffer(*this);
+	buffer->m_handle = buffer_handle;
+	buffer->m_buffer_id = buffer_id;
+	return buffer;
+}
+
+AudioManager::AudioBuffer* AudioManager::getBuffer(const Handle& buffer_handle) const
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(this->postsCommands())
+	{
+		std::lock_guard<SpinLock> guard(data->pool_lock);
+		return data->buffers.get(buffer_handle);
+	}
+	return data ? data->buffers.get(buffer_handle) : 0;
+}
+
+bool AudioManager::deleteBuffer(AudioManager::AudioBuffer* audio_buffer)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(this->postsCommands())
+	{
+		{
+			std::lock_guard<SpinLock> guard(data->pool_lock);
+			if(!audio_buffer || data->buffers.get(audio_buffer->handle) != audio_buffer || this->isHeld(audio_buffer))
+				return false;
+			data->buffers.retire(audio_buffer->handle.index);
+		}
+		this->uncacheBuffer(audio_buffer);
+		data->commands.push(new AudioCommand(CMD_BUFFER_DELETE, audio_buffer));
+		return true;
+	}
+	if(!audio_buffer || !data || data->buffers.get(audio_buffer->handle) != audio_buffer || this->isHeld(audio_buffer))
+		return false;
+	unsigned int index = audio_buffer->handle.index;
+	this->uncacheBuffer(audio_buffer);
+	audio_buffer->~AudioBuffer();
+	data->buffers.release(index);
+	return true;
+}
+
+bool AudioManager::deleteBuffer(const Handle& buffer_handle)
+{
+	return this->deleteBuffer(this->getBuffer(buffer_handle));
+}
+
+AudioManager::AudioBuffer* AudioManager::loadBufferAsync(const char* wav_file_path)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!wav_file_path || !data || data->threaded)
+		return 0;
+	AudioBuffer *buffer = this->newBuffer();
+	if(!buffer)
+		return 0;
+	size_t path_length = strlen(wav_file_path);
+	LoadJob *job = new LoadJob();
+	job->path = new char[path_length + 1];
+	memcpy(job->path, wav_file_path, path_length + 1);
+	job->handle = buffer->m_handle;
+	buffer->buffer_load_state = AudioBuffer::LOAD_PENDING;
+	if(data->load_worker_count == 0)
+	{
+		size_t worker_count = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), MAX_LOAD_WORKERS);
+		for(size_t i = 0; i < worker_count; ++i)
+			data->load_workers[i] = std::thread(_runLoadWorker, data);
+		data->load_worker_count = worker_count;
+	}
+	{
+		std::lock_guard<std::mutex> lock(data->load_mutex);
+		data->load_queue.push(job);
+	}
+	data->load_signal.notify_one();
+	return buffer;
+}
+
+// Uploads finished loads in order until the byte budget is used up. A single load larger than
+// the budget still goes through on its own so nothing can starve.
+bool AudioManager::updateLoads(size_t max_upload_bytes)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!data || !AudioManager::isValid() || !AudioManager::makeCurrent())
+		return false;
+	size_t uploaded = 0;
+	while(true)
+	{
+		LoadJob *job = 0;
+		{
+			std::lock_guard<std::mutex> lock(data->load_mutex);
+			if(!data->loaded.head || (uploaded > 0 && uploaded + data->loaded.head->size > max_upload_bytes))
+				break;
+			job = data->loaded.pop();
+		}
+		AudioBuffer *buffer = data->buffers.get(job->handle);
+		if(buffer)
+		{
+			bool loaded = !job->failed;
+			if(loaded && job->block_align)
+				loaded = buffer->setCompressedData(job->format, job->samples, job->size, job->frequency, job->block_align);
+			else if(loaded && job->mapped_file && buffer->setStaticData(job->format, job->samples, job->size, job->frequency))
+			{
+				buffer->m_mapping = job->mapped_file;
+				job->mapped_file = 0;
+				job->samples = 0;
+			}
+			else if(loaded)
+				loaded = buffer->setData(job->format, job->samples, job->size, job->frequency);
+			buffer->buffer_load_state = loaded ? AudioBuffer::LOAD_READY : AudioBuffer::LOAD_FAILED;
+			this->resolvePendingSources(buffer);
+		}
+		uploaded += job->size;
+		_releaseJob(job);
+	}
+	return true;
+}
+
+AudioManager::AudioBuffer* AudioManager::acquireBuffer(const char* wav_file_path)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!wav_file_path || !data || !AudioManager::isValid())
+		return 0;
+	if(data->cache_entry_count >= data->cache_bucket_count && !_growCache(data))
+		return 0;
+	uint64_t hash = _hashPath(wav_file_path);
+	CacheEntry **slot = _cacheSlot(data, hash, wav_file_path);
+	if(CacheEntry *entry = *slot)
+	{
+		++audioman_cache_stats.hits;
+		if(entry->ref_count++ == 0)
+			_lruUnlink(data, entry);
+		return entry->buffer;
+	}
+	++audioman_cache_stats.misses;
+	AudioBuffer *buffer = this->newBuffer();
+	if(!buffer)
+		return 0;
+	if(!buffer->loadFromFile(wav_file_path))
+	{
+		this->deleteBuffer(buffer);
+		return 0;
+	}
+	size_t path_length = strlen(wav_file_path);
+	CacheEntry *entry = new CacheEntry();
+	entry->path = new char[path_length + 1];
+	memcpy(entry->path, wav_file_path, path_length + 1);
+	entry->hash = hash;
+	entry->buffer = buffer;
+	entry->ref_count = 1;
+	entry->size = buffer->size;
+	*slot = entry;
+	++data->cache_entry_count;
+	buffer->m_cache_entry = entry;
+	audioman_cache_stats.resident_bytes += entry->size;
+	this->trimCache();
+	return buffer;
+}
+
+bool AudioManager::releaseBuffer(AudioBuffer* audio_buffer)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	CacheEntry *entry = audio_buffer ? (CacheEntry*)audio_buffer->m_cache_entry : 0;
+	if(!data || !entry || entry->ref_count == 0)
+		return false;
+	if(--entry->ref_count == 0)
+	{
+		_lruAppend(data, entry);
+		this->trimCache();
+	}
+	return true;
+}
+
+bool AudioManager::setCacheBudget(size_t _cache_budget)
+{
+	audioman_cache_budget = _cache_budget;
+	this->trimCache();
+	return true;
+}
+
+// Load workers read the factory list without locking, so register decoders before loading anything.
+// Each factory returns a decoder allocated with new; the manager deletes it once the file is read.
+bool AudioManager::registerDecoder(DecoderFactory decoder_factory)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!data || !decoder_factory)
+		return false;
+	for(size_t i = 0; i < data->decoder_count; ++i)
+	{
+		if(data->decoders[i] == decoder_factory)
+			return true;
+	}
+	if(data->decoder_count >= MAX_DECODERS)
+		return false;
+	data->decoders[data->decoder_count++] = decoder_factory;
+	return true;
+}
+
+// Like the decoders, the settings are read by the load workers and belong before the loads they affect.
+// The cache directory must already exist; entries are never cleaned up.
+bool AudioManager::setLoadNormalization(bool normalize, ResampleQuality quality, const char* cache_directory)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!data || (size_t)quality >= sizeof(_resampleProfiles) / sizeof(_resampleProfiles[0]))
+		return false;
+	delete[] data->normalize_cache_directory;
+	data->normalize_cache_directory = 0;
+	if(cache_directory && *cache_directory)
+	{
+		size_t length = strlen(cache_directory);
+		data->normalize_cache_directory = new char[length + 1];
+		memcpy(data->normalize_cache_directory, cache_directory, length + 1);
+	}
+	data->normalize_loads = normalize;
+	data->resample_quality = quality;
+	return true;
+}
+
+// Buffers still held are never evicted, so the budget can be exceeded while they are in use.
+void AudioManager::trimCache()
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	while(data->lru_head && audioman_cache_stats.resident_bytes > audioman_cache_budget)
+	{
+		++audioman_cache_stats.evictions;
+		this->deleteBuffer(data->lru_head->buffer);
+	}
+}
+
+// Cached buffers that are still held go back through releaseBuffer; only idle ones can be deleted directly.
+bool AudioManager::isHeld(const AudioBuffer* audio_buffer) const
+{
+	const CacheEntry *entry = (const CacheEntry*)audio_buffer->m_cache_entry;
+	return entry && entry->ref_count > 0;
+}
+
+void AudioManager::uncacheBuffer(AudioBuffer* audio_buffer)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	CacheEntry *entry = (CacheEntry*)audio_buffer->m_cache_entry;
+	if(!entry)
+		return;
+	CacheEntry **slot = _cacheSlot(data, entry->hash, entry->path);
+	*slot = entry->next_in_bucket;
+	if(entry->ref_count == 0)
+		_lruUnlink(data, entry);
+	audioman_cache_stats.resident_bytes -= entry->size;
+	--data->cache_entry_count;
+	audio_buffer->m_cache_entry = 0;
+	delete[] entry->path;
+	delete entry;
+}
+
+void AudioManager::resolvePendingSources(const AudioBuffer* audio_buffer)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	size_t kept = 0;
+	for(size_t i = 0; i < data->pending_sources.count; ++i)
+	{
+		AudioSource *source = data->sources.get(data->pending_sources.items[i]);
+		if(!source)
+			continue;
+		const AudioBuffer *bound = source->source_audio_buffer;
+		if(bound && bound->load_state == AudioBuffer::LOAD_PENDING)
+		{
+			data->pending_sources.items[kept++] = data->pending_sources.items[i];
+			continue;
+		}
+		if(bound != audio_buffer)
+			continue;
+		if(audio_buffer->load_state == AudioBuffer::LOAD_READY && source->m_source_id != INVALID_AL_ID)
+		{
+			while(alGetError() != AL_NO_ERROR);
+			alSourcei(source->m_source_id, AL_BUFFER, (ALint)audio_buffer->m_buffer_id);
+			if(source->m_play_when_ready)
+				alSourcePlay(source->m_source_id);
+			if(source->m_play_when_ready && alGetError() == AL_NO_ERROR)
+				source->source_state = AudioSource::STATE_PLAYING;
+		}
+		source->m_play_when_ready = false;
+	}
+	data->pending_sources.count = kept;
+}
+
+AudioManager::AudioSource* AudioManager::newSource()
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	StatScope stat_scope(data, STAT_CREATE);
+	if(!AudioManager::isValid())
+		return 0;
+	if(this->postsCommands())
+	{
+		AudioSource *source = 0;
+		{
+			std::lock_guard<SpinLock> guard(data->pool_lock);
+			Handle source_handle;
+			void *storage = data->sources.allocate(source_handle);
+			if(!storage)
+				return 0;
+			source = new(storage) AudioSource(*this);
+			source->m_handle = source_handle;
+		}
+		data->commands.push(new AudioCommand(CMD_SOURCE_CREATE, source));
+		return source;
+	}
+	if(!AudioManager::makeCurrent())
+		return 0;
+	ALuint source_id = _takeName(data->source_names, true);
+	if(source_id == INVALID_AL_ID)
+	{
+		_countStat(data->stats.failed_sources);
+		return 0;
 	}
-	_data = wav.wave_data;
-	_size = wav.data_header.chunk_size;
-	_frequency = wav.format_chunk.samples_per_sec;
-	return AudioBuffer::setData(_format, _data, _size, _frequency);
+	Handle source_handle;
+	void *storage = data->sources.allocate(source_handle);
+	if(!storage)
+	{
+		data->source_names.push(source_id);
+		return 0;
+	}
+	AudioSource *source = new(storage) AudioSource(*this);
+	source->m_handle = source_handle;
+	source->m_source_id = source_id;
+	// Recycled names carry the previous owner's state, so reset every property.
+	while(alGetError() != AL_NO_ERROR);
+	source->flushProperties(SOURCE_DIRTY_ALL);
+	if(alGetError() != AL_NO_ERROR)
+	{
+		_countStat(data->stats.failed_sources);
+		this->deleteSource(source);
+		return 0;
+	}
+	return source;
 }
 
-bool AudioManager::AudioBuffer::setData(Format _format, void* _data, size_t _size, size_t _frequency)
+AudioManager::AudioSource* AudioManager::getSource(const Handle& source_handle) const
 {
-	if(!_data || _size==0 || _frequency==0 || !AudioBuffer::isValid() || !audio_manager.makeCurrent())
-		return false;
-	ALenum al_format;
-	switch(_format)
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(this->postsCommands())
 	{
-		case FORMAT_NONE:
-		default: return false;
-		case FORMAT_MONO8: al_format = AL_FORMAT_MONO8; break;
-		case FORMAT_MONO16: al_format = AL_FORMAT_MONO16; break;
-		case FORMAT_STEREO8: al_format = AL_FORMAT_STEREO8; break;
-		case FORMAT_STEREO16: al_format = AL_FORMAT_STEREO16; break;
+		std::lock_guard<SpinLock> guard(data->pool_lock);
+		return data->sources.get(source_handle);
 	}
-	while(alGetError() != AL_NO_ERROR);
-	alBufferData(m_buffer_id, al_format, _data, _size, _frequency);
-	if(alGetError() == AL_NO_ERROR)
+	return data ? data->sources.get(source_handle) : 0;
+}
+
+bool AudioManager::deleteSource(AudioManager::AudioSource* audio_source)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(this->postsCommands())
 	{
-		buffer_format = _format;
-		buffer_size = _size;
-		buffer_frequency = _frequency;
+		{
+			std::lock_guard<SpinLock> guard(data->pool_lock);
+			if(!audio_source || data->sources.get(audio_source->handle) != audio_source)
+				return false;
+			data->sources.retire(audio_source->handle.index);
+		}
+		data->commands.push(new AudioCommand(CMD_SOURCE_DELETE, audio_source));
 		return true;
 	}
-	return false;
+	if(!audio_source || !data || data->sources.get(audio_source->handle) != audio_source)
+		return false;
+	unsigned int index = audio_source->handle.index;
+	audio_source->unmarkDirty();
+	_unschedule(data, audio_source);
+	if(audio_source->m_source_id != INVALID_AL_ID && AudioManager::makeCurrent())
+	{
+		while(alGetError() != AL_NO_ERROR);
+		if(_parkSourceName(data, audio_source->m_source_id))
+			audio_source->m_source_id = INVALID_AL_ID;
+	}
+	audio_source->~AudioSource();
+	data->sources.release(index);
+	return true;
 }
 
-//
-// AudioManager::AudioSource
-//
+bool AudioManager::deleteSource(const Handle& source_handle)
+{
+	return this->deleteSource(this->getSource(source_handle));
+}
 
-AudioManager::AudioSource::AudioSource(const AudioManager& _audio_manager) :
-	audio_manager(_audio_manager),
-	audio_buffer(source_audio_buffer),
-	source_id(m_source_id),
-	loop(source_loop),
-	pitch(source_pitch),
-	gain(source_gain),
-	min_gain(source_min_gain),
-	max_gain(source_max_gain),
-	max_distance(source_max_distance),
-	position(source_position),
-	velocity(source_velocity),
-	direction(source_direction),
-	source_audio_buffer(0),
-	source_loop(false),
-	source_pitch(1.f),
-	source_gain(1.f),
-	source_min_gain(0.f),
-	source_max_gain(1.f),
-	source_max_distance(1000.f),
-	source_position(0.f, 0.f, 0.f),
-	source_velocity(0.f, 0.f, 0.f),
-	source_direction(0.f),
-	m_source_id(INVALID_AL_ID)
-{}
+// Group calls reach the driver as one alSourcePlayv/Pausev/Stopv, so layered stems start in the
+// same mix period instead of drifting apart over separate play() calls.
+bool AudioManager::playSources(AudioSource* const* audio_sources, size_t count)
+{
+	return this->commandGroup(CMD_GROUP_PLAY, audio_sources, count, 0);
+}
 
-AudioManager::AudioSource::~AudioSource()
+// device_time is on the clock getLatency() reports. AL_SOFT_source_start_delay starts the group
+// at that time inside the mixer; without it the group is held back and started by the first
+// render(), pollStates() or audio thread pass at or after it, which on a loopback device is
+// still sample-accurate. A time already past starts the group at once.
+bool AudioManager::playSourcesAt(AudioSource* const* audio_sources, size_t count, uint64_t device_time)
 {
-	this->destroy();
+	return this->commandGroup(CMD_GROUP_PLAY, audio_sources, count, device_time);
 }
 
-AudioManager::AudioSource::AudioSource(AudioSource&& audio_source) :
-	audio_manager(audio_source.audio_manager),
-	audio_buffer(source_audio_buffer),
-	source_id(m_source_id),
-	loop(source_loop),
-	pitch(source_pitch),
-	gain(source_gain),
-	min_gain(source_min_gain),
-	max_gain(source_max_gain),
-	max_distance(source_max_distance),
-	position(source_position),
-	velocity(source_velocity),
-	direction(source_direction),
-	source_audio_buffer(audio_source.source_audio_buffer),
-	source_loop(audio_source.source_loop),
-	source_pitch(audio_source.source_pitch),
-	source_gain(audio_source.source_gain),
-	source_min_gain(audio_source.source_min_gain),
-	source_max_gain(audio_source.source_max_gain),
-	source_max_distance(audio_source.source_max_distance),
-	source_position(audio_source.source_position),
-	source_velocity(audio_source.source_velocity),
-	source_direction(audio_source.source_direction),
-	m_source_id(audio_source.m_source_id)
+bool AudioManager::pauseSources(AudioSource* const* audio_sources, size_t count)
 {
-	audio_source.m_source_id = INVALID_AL_ID;
+	return this->commandGroup(CMD_GROUP_PAUSE, audio_sources, count, 0);
 }
 
-bool AudioManager::AudioSource::create()
+bool AudioManager::stopSources(AudioSource* const* audio_sources, size_t count)
 {
-	if(!audio_manager.makeCurrent())
-		return false;
-	this->destroy();
-	while(alGetError() != AL_NO_ERROR);
-	alGenSources(1, &m_source_id);
-	if(alGetError() != AL_NO_ERROR || m_source_id == INVALID_AL_ID)
+	return this->commandGroup(CMD_GROUP_STOP, audio_sources, count, 0);
+}
+
+AudioManager::StreamingSource* AudioManager::newStreamingSource(size_t buffer_count, size_t buffer_size)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!AudioManager::isValid() || this->isThreaded())
+		return 0;
+	StreamingSource *stream = new StreamingSource(*this, buffer_count, buffer_size);
+	if(!stream)
+		return 0;
+	if(!stream->create())
 	{
-		this->destroy();
-		return false;
+		delete stream;
+		return 0;
 	}
-	alSourcei(m_source_id, AL_LOOPING, (ALint)source_loop);
-	alSourcef(m_source_id, AL_PITCH, source_pitch);
-	alSourcef(m_source_id, AL_GAIN, source_gain);
-	alSourcef(m_source_id, AL_MIN_GAIN, source_min_gain);
-	alSourcef(m_source_id, AL_MAX_GAIN, source_max_gain);
-	alSourcef(m_source_id, AL_MAX_DISTANCE, source_max_distance);
-	alSource3f(m_source_id, AL_POSITION, source_position.x, source_position.y, source_position.z);
-	alSource3f(m_source_id, AL_VELOCITY, source_velocity.x, source_velocity.y, source_velocity.z);
-	alSource3f(m_source_id, AL_DIRECTION, source_direction.x, source_direction.y, source_direction.z);
-	if(source_audio_buffer)
-		this->setBuffer(source_audio_buffer);
-	return true;
+	stream->m_next_stream = data->streams;
+	data->streams = stream;
+	return stream;
 }
 
-bool AudioManager::AudioSource::destroy()
+bool AudioManager::deleteStreamingSource(AudioManager::StreamingSource* streaming_source)
 {
-	if(!audio_manager.makeCurrent() || m_source_id == INVALID_AL_ID)
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!streaming_source || !data)
 		return false;
-	while(alGetError() != AL_NO_ERROR);
-	alSourceStop(m_source_id);
-	alSourcei(m_source_id, AL_BUFFER, 0);
-	alDeleteSources(1, &m_source_id);
-	m_source_id = INVALID_AL_ID;
-	return alGetError() == AL_NO_ERROR;
+	for(StreamingSource** link = &data->streams; *link; link = &(*link)->m_next_stream)
+	{
+		if(*link != streaming_source)
+			continue;
+		*link = streaming_source->m_next_stream;
+		_unschedule(data, streaming_source);
+		delete streaming_source;
+		return true;
+	}
+	return false;
 }
 
-bool AudioManager::AudioSource::isValid() const
+bool AudioManager::updateStreams()
 {
-	return audio_manager.makeCurrent() && m_source_id != INVALID_AL_ID && alIsSource(m_source_id);
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!data || !AudioManager::makeCurrent())
+		return false;
+	bool success = true;
+	for(StreamingSource* stream = data->streams; stream; stream = stream->m_next_stream)
+	{
+		if(stream->isOpen() && !stream->update())
+			success = false;
+	}
+	return success;
 }
 
-bool AudioManager::AudioSource::isPlaying() const
+AudioManager::EffectChain* AudioManager::newEffectChain(size_t channel_count, size_t frequency)
 {
-	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
-		return false;
-	while(alGetError() != AL_NO_ERROR);
-	ALint state;
-	alGetSourcei(m_source_id, AL_SOURCE_STATE, &state);
-	if(alGetError() == AL_NO_ERROR)
-		return state == AL_PLAYING;
-	return false;
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!AudioManager::isValid() || channel_count == 0 || channel_count > MAX_EFFECT_CHANNELS || frequency == 0)
+		return 0;
+	EffectChain *effect_chain = new EffectChain(*this, channel_count, frequency);
+	if(!effect_chain)
+		return 0;
+	effect_chain->m_next_chain = data->chains;
+	data->chains = effect_chain;
+	return effect_chain;
 }
 
-bool AudioManager::AudioSource::isPaused() const
+bool AudioManager::deleteEffectChain(EffectChain* effect_chain)
 {
-	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!effect_chain || !data)
 		return false;
-	while(alGetError() != AL_NO_ERROR);
-	ALint state;
-	alGetSourcei(m_source_id, AL_SOURCE_STATE, &state);
-	if(alGetError() == AL_NO_ERROR)
-		return state == AL_PAUSED;
+	for(EffectChain** link = &data->chains; *link; link = &(*link)->m_next_chain)
+	{
+		if(*link != effect_chain)
+			continue;
+		*link = effect_chain->m_next_chain;
+		// Detach everything still feeding the chain's slots before they are deleted.
+		for(unsigned int index = 0; index < data->sources.page_count * POOL_PAGE_SLOTS; ++index)
+		{
+			ObjectPool<AudioSource>::Slot *slot = data->sources.slot(index);
+			AudioSource *source = (AudioSource*)slot->storage;
+			if(slot->live && source->source_effect_chain == effect_chain)
+				source->setEffectChain(0);
+		}
+		for(StreamingSource* stream = data->streams; stream; stream = stream->m_next_stream)
+		{
+			if(stream->source_effect_chain == effect_chain)
+				stream->AudioSource::setEffectChain(0);
+			if(((StreamingSourceData*)stream->m_stream)->effect_chain == effect_chain)
+				stream->setEffectChain(0);
+		}
+		if(data->master_chain == effect_chain)
+			data->master_chain = 0;
+		if(AudioManager::makeCurrent())
+			_releaseEfx(data->efx, (EffectChainData*)effect_chain->m_chain, effect_chain->chain_effect_count);
+		delete effect_chain;
+		return true;
+	}
 	return false;
 }
 
-bool AudioManager::AudioSource::isStopped() const
+// The master chain runs over the mixed output of render(), so only an offline manager has one.
+bool AudioManager::setMasterEffectChain(EffectChain* effect_chain)
 {
-	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!data || !data->render_samples || (effect_chain && effect_chain->chain_channel_count != data->render_channels))
 		return false;
-	while(alGetError() != AL_NO_ERROR);
-	ALint state;
-	alGetSourcei(m_source_id, AL_SOURCE_STATE, &state);
-	if(alGetError() == AL_NO_ERROR)
-		return state == AL_STOPPED;
-	return false;
+	data->master_chain = effect_chain;
+	return true;
 }
 
-bool AudioManager::AudioSource::play() const
+// Pushes parameters changed since the last call to the EFX objects of chains attached to sources.
+// Software chains need no such step; they read their parameters while processing.
+bool AudioManager::updateEffects()
 {
-	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!data || this->postsCommands() || !AudioManager::makeCurrent())
 		return false;
 	while(alGetError() != AL_NO_ERROR);
-	alSourcePlay(m_source_id);
+	for(EffectChain* effect_chain = data->chains; effect_chain; effect_chain = effect_chain->m_next_chain)
+	{
+		EffectChainData *chain = ((EffectChainData*)effect_chain->m_chain);
+		unsigned int version = chain->version.load(std::memory_order_acquire);
+		if(!chain->efx_built || version == chain->applied_version)
+			continue;
+		chain->applied_version = version;
+		_applyEfx(data->efx, chain, effect_chain->chain_effect_count);
+	}
 	return alGetError() == AL_NO_ERROR;
 }
 
-bool AudioManager::AudioSource::pause() const
+AudioManager::Voice* AudioManager::newVoice()
 {
-	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
-		return false;
-	while(alGetError() != AL_NO_ERROR);
-	alSourcePause(m_source_id);
-	return alGetError() == AL_NO_ERROR;
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!data || data->threaded)
+		return 0;
+	Handle voice_handle;
+	void *storage = data->voices.allocate(voice_handle);
+	if(!storage)
+		return 0;
+	Voice *voice = new(storage) Voice(*this);
+	voice->m_handle = voice_handle;
+	return voice;
 }
 
-bool AudioManager::AudioSource::stop() const
+AudioManager::Voice* AudioManager::getVoice(const Handle& voice_handle) const
 {
-	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
-		return false;
-	while(alGetError() != AL_NO_ERROR);
-	alSourceStop(m_source_id);
-	return alGetError() == AL_NO_ERROR;
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	return data ? data->voices.get(voice_handle) : 0;
 }
 
-bool AudioManager::AudioSource::setLoop(bool _loop)
+bool AudioManager::deleteVoice(AudioManager::Voice* voice)
 {
-	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!voice || !data || data->voices.get(voice->handle) != voice)
 		return false;
-	while(alGetError() != AL_NO_ERROR);
-	alSourcei(m_source_id, AL_LOOPING, (ALint)_loop);
-	if(alGetError() == AL_NO_ERROR)
-	{
-		source_loop = _loop;
-		return true;
-	}
-	return false;
+	unsigned int index = voice->handle.index;
+	if(voice->m_source)
+		this->unbindVoice(voice, false);
+	voice->~Voice();
+	data->voices.release(index);
+	return true;
 }
 
-bool AudioManager::AudioSource::setPitch(float _pitch)
+bool AudioManager::deleteVoice(const Handle& voice_handle)
 {
-	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
-		return false;
-	while(alGetError() != AL_NO_ERROR);
-	alSourcef(m_source_id, AL_PITCH, _pitch);
-	if(alGetError() == AL_NO_ERROR)
-	{
-		source_pitch = _pitch;
-		return true;
-	}
-	return false;
+	return this->deleteVoice(this->getVoice(voice_handle));
 }
 
-bool AudioManager::AudioSource::setGain(float _gain)
+bool AudioManager::setMaxVoices(size_t _max_voices)
 {
-	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+	audioman_max_voices = _max_voices;
+	return true;
+}
+
+bool AudioManager::updateVoices(float delta_time)
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!data || !AudioManager::isValid() || !AudioManager::makeCurrent())
 		return false;
-	while(alGetError() != AL_NO_ERROR);
-	alSourcef(m_source_id, AL_GAIN, _gain);
-	if(alGetError() == AL_NO_ERROR)
+	if(delta_time < 0.f)
+		delta_time = 0.f;
+	data->voice_ranking.count = 0;
+	EmitterBatch& emitters = data->emitters;
+	if(!emitters.reserve(data->voices.live_count))
+		return false;
+	emitters.count = 0;
+	for(unsigned int index = 0; index < data->voices.page_count * POOL_PAGE_SLOTS; ++index)
 	{
-		source_gain = _gain;
-		return true;
+		ObjectPool<Voice>::Slot *slot = data->voices.slot(index);
+		if(!slot->live)
+			continue;
+		Voice *voice = (Voice*)slot->storage;
+		const AudioBuffer *buffer = voice->voice_audio_buffer;
+		if(!voice->m_playing || !buffer)
+		{
+			voice->m_playing = false;
+			if(voice->m_source)
+				this->unbindVoice(voice, false);
+			continue;
+		}
+		// A pending buffer has no length yet, so its voice stays virtual and keeps its offset until the load lands.
+		if(buffer->load_state == AudioBuffer::LOAD_PENDING)
+		{
+			voice->m_selected = false;
+			if(voice->m_source)
+				this->unbindVoice(voice, false);
+			continue;
+		}
+		// Multichannel buffers are not spatialized, so only their gain counts.
+		size_t i = emitters.count++;
+		emitters.voices[i] = voice;
+		emitters.column(EmitterBatch::POSITION_X)[i] = voice->voice_position.x;
+		emitters.column(EmitterBatch::POSITION_Y)[i] = voice->voice_position.y;
+		emitters.column(EmitterBatch::POSITION_Z)[i] = voice->voice_position.z;
+		emitters.column(EmitterBatch::VELOCITY_X)[i] = voice->voice_velocity.x;
+		emitters.column(EmitterBatch::VELOCITY_Y)[i] = voice->voice_velocity.y;
+		emitters.column(EmitterBatch::VELOCITY_Z)[i] = voice->voice_velocity.z;
+		emitters.column(EmitterBatch::DIRECTION_X)[i] = voice->voice_direction.x;
+		emitters.column(EmitterBatch::DIRECTION_Y)[i] = voice->voice_direction.y;
+		emitters.column(EmitterBatch::DIRECTION_Z)[i] = voice->voice_direction.z;
+		emitters.column(EmitterBatch::GAIN)[i] = voice->voice_gain;
+		emitters.column(EmitterBatch::MAX_DISTANCE)[i] = voice->voice_max_distance;
+		emitters.column(EmitterBatch::CONE_INNER)[i] = cosf(voice->voice_cone_inner_angle * 0.5f * PI / 180.f);
+		emitters.column(EmitterBatch::CONE_OUTER)[i] = cosf(voice->voice_cone_outer_angle * 0.5f * PI / 180.f);
+		emitters.column(EmitterBatch::CONE_OUTER_GAIN)[i] = voice->voice_cone_outer_gain;
+		emitters.column(EmitterBatch::SPATIAL)[i] = _formatChannels(buffer->format) == 1 ? 1.f : 0.f;
 	}
-	return false;
+	const float listener[] = { audioman_position.x, audioman_position.y, audioman_position.z, audioman_velocity.x, audioman_velocity.y, audioman_velocity.z };
+	_computeAudibility(emitters, listener);
+	size_t audible_count = 0;
+	for(size_t i = 0; i < emitters.count; ++i)
+	{
+		Voice *voice = emitters.voices[i];
+		const AudioBuffer *buffer = voice->voice_audio_buffer;
+		voice->voice_audibility = emitters.column(EmitterBatch::AUDIBILITY)[i];
+		voice->voice_doppler = emitters.column(EmitterBatch::DOPPLER)[i];
+		// Virtual voices keep time so a promoted voice resumes where it would have been.
+		float duration = buffer->frequency ? (float)_bufferFrameCount(buffer) / (float)buffer->frequency : 0.f;
+		if(!voice->m_pending)
+			voice->voice_offset += delta_time * voice->voice_pitch * voice->voice_doppler;
+		voice->m_pending = false;
+		if(voice->voice_offset >= duration)
+		{
+			if(voice->voice_loop && duration > 0.f)
+				voice->voice_offset = fmodf(voice->voice_offset, duration);
+			else
+			{
+				voice->m_playing = false;
+				voice->voice_offset = 0.f;
+				if(voice->m_source)
+					this->unbindVoice(voice, false);
+				continue;
+			}
+		}
+		// Inaudible voices are culled before ranking; bound ones stay in to fade out.
+		bool audible = voice->voice_audibility >= VOICE_CULL_AUDIBILITY;
+		if(!audible && !voice->m_source)
+		{
+			voice->m_selected = false;
+			continue;
+		}
+		VoiceRank rank = { audible ? voice->voice_priority * voice->voice_audibility : -HUGE_VALF, voice };
+		data->voice_ranking.push(rank);
+		audible_count += audible;
+	}
+	VoiceRank *ranking = data->voice_ranking.items;
+	size_t count = data->voice_ranking.count;
+	size_t selected = audioman_max_voices < audible_count ? audioman_max_voices : audible_count;
+	if(selected < count)
+		std::nth_element(ranking, ranking + selected, ranking + count, _rankGreater);
+	float fade_step = delta_time / VOICE_FADE_TIME;
+	for(size_t i = 0; i < count; ++i)
+	{
+		Voice *voice = ranking[i].voice;
+		voice->m_selected = i < selected;
+		if(voice->m_selected)
+		{
+			if(!voice->m_source)
+				this->bindVoice(voice);
+			else if(voice->m_fade < 1.f)
+			{
+				voice->m_fade = voice->m_fade + fade_step < 1.f ? voice->m_fade + fade_step : 1.f;
+				voice->m_source->setGain(voice->voice_gain * voice->m_fade);
+			}
+		}
+		else if(voice->m_source)
+		{
+			voice->m_fade -= fade_step;
+			if(voice->m_fade > 0.f)
+				voice->m_source->setGain(voice->voice_gain * voice->m_fade);
+			else
+			{
+				this->unbindVoice(voice, true);
+				voice->m_fade = 0.f;
+			}
+		}
+	}
+	return true;
 }
 
-bool AudioManager::AudioSource::setMinGain(float _min_gain)
+bool AudioManager::bindVoice(Voice* voice)
 {
-	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+	// Fresh voices start at full gain; voices resumed from virtual fade in from wherever their fade is.
+	AudioSource *source = this->newSource();
+	if(!source)
 		return false;
+	source->source_audio_buffer = voice->voice_audio_buffer;
+	source->source_loop = voice->voice_loop;
+	source->source_pitch = voice->voice_pitch;
+	source->source_gain = voice->voice_gain * voice->m_fade;
+	source->source_max_distance = voice->voice_max_distance;
+	source->source_position = voice->voice_position;
+	source->source_velocity = voice->voice_velocity;
+	source->source_direction = voice->voice_direction;
 	while(alGetError() != AL_NO_ERROR);
-	alSourcef(m_source_id, AL_MIN_GAIN, _min_gain);
-	if(alGetError() == AL_NO_ERROR)
+	source->flushProperties(SOURCE_DIRTY_ALL);
+	alSourcef(source->m_source_id, AL_CONE_INNER_ANGLE, voice->voice_cone_inner_angle);
+	alSourcef(source->m_source_id, AL_CONE_OUTER_ANGLE, voice->voice_cone_outer_angle);
+	alSourcef(source->m_source_id, AL_CONE_OUTER_GAIN, voice->voice_cone_outer_gain);
+	if(voice->voice_offset > 0.f)
+		alSourcef(source->m_source_id, AL_SEC_OFFSET, voice->voice_offset);
+	alSourcePlay(source->m_source_id);
+	if(alGetError() != AL_NO_ERROR)
 	{
-		source_min_gain = _min_gain;
-		return true;
+		this->deleteSource(source);
+		return false;
 	}
-	return false;
+	source->source_state = AudioSource::STATE_PLAYING;
+	voice->m_source = source;
+	return true;
 }
 
-bool AudioManager::AudioSource::setMaxGain(float _max_gain)
+void AudioManager::unbindVoice(Voice* voice, bool sync_offset)
 {
-	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
-		return false;
-	while(alGetError() != AL_NO_ERROR);
-	alSourcef(m_source_id, AL_MAX_GAIN, _max_gain);
-	if(alGetError() == AL_NO_ERROR)
-	{
-		source_max_gain = _max_gain;
-		return true;
+	if(sync_offset && AudioManager::makeCurrent())
+	{
+		ALfloat seconds = 0.f;
+		while(alGetError() != AL_NO_ERROR);
+		alGetSourcef(voice->m_source->m_source_id, AL_SEC_OFFSET, &seconds);
+		if(alGetError() == AL_NO_ERROR && seconds > 0.f)
+			voice->voice_offset = seconds;
 	}
-	return false;
+	this->deleteSource(voice->m_source);
+	voice->m_source = 0;
 }
 
-bool AudioManager::AudioSource::setMaxDistance(float _max_distance)
+bool AudioManager::pollStates()
 {
-	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!data || !AudioManager::isValid())
 		return false;
-	while(alGetError() != AL_NO_ERROR);
-	alSourcef(m_source_id, AL_MAX_DISTANCE, _max_distance);
-	if(alGetError() == AL_NO_ERROR)
+	if(data->threaded)
 	{
-		source_max_distance = _max_distance;
+		bool cache_grew = false;
+		{
+			// A result only counts if no play() was issued after the one the audio thread saw finish.
+			std::lock_guard<SpinLock> guard(data->pool_lock);
+			for(size_t i = 0; i < data->state_results.count; ++i)
+			{
+				const StateResult& result = data->state_results.items[i];
+				AudioSource *source = data->sources.get(result.handle);
+				if(!source || source->m_play_serial != result.serial || source->source_state != AudioSource::STATE_PLAYING)
+					continue;
+				source->source_state = result.state;
+				if(result.state == AudioSource::STATE_STOPPED)
+					data->finished.push(result.handle);
+			}
+			data->state_results.count = 0;
+			// A buffer only takes on the format and size of an upload the audio thread confirmed.
+			for(size_t i = 0; i < data->upload_results.count; ++i)
+			{
+				const UploadResult& result = data->upload_results.items[i];
+				AudioBuffer *buffer = data->buffers.get(result.handle);
+				if(!buffer)
+					continue;
+				if(!result.success)
+				{
+					buffer->buffer_load_state = AudioBuffer::LOAD_FAILED;
+					_countStat(data->stats.failed_buffers);
+					continue;
+				}
+				buffer->buffer_format = result.format;
+				buffer->buffer_size = result.size;
+				buffer->buffer_frequency = result.frequency;
+				buffer->buffer_block_align = 0;
+				if(CacheEntry *entry = (CacheEntry*)buffer->m_cache_entry)
+				{
+					audioman_cache_stats.resident_bytes += result.size - entry->size;
+					cache_grew |= result.size > entry->size;
+					entry->size = result.size;
+				}
+			}
+			data->upload_results.count = 0;
+		}
+		if(cache_grew)
+			this->trimCache();
 		return true;
 	}
-	return false;
-}
-
-bool AudioManager::AudioSource::setPosition(const axl::math::Vec3f& _position)
-{
-	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+	if(data->scheduled.count > 0 && AudioManager::makeCurrent())
+		this->startScheduled(_deviceClock(data));
+	// With AL_SOFT_events a frame in which no source changed state costs nothing.
+	if(data->state_events_enabled && data->state_events.exchange(0, std::memory_order_acquire) == 0)
+		return true;
+	if(!AudioManager::makeCurrent())
 		return false;
 	while(alGetError() != AL_NO_ERROR);
-	alSource3f(m_source_id, AL_POSITION, _position.x, _position.y, _position.z);
-	if(alGetError() == AL_NO_ERROR)
+	for(unsigned int index = 0; index < data->sources.page_count * POOL_PAGE_SLOTS; ++index)
 	{
-		source_position = _position;
-		return true;
+		ObjectPool<AudioSource>::Slot *slot = data->sources.slot(index);
+		if(!slot->live)
+			continue;
+		AudioSource *source = (AudioSource*)slot->storage;
+		// Only a playing source can change state without going through our own calls. One held
+		// back for a scheduled start already reports playing, as it would under the extension.
+		if(source->source_state != AudioSource::STATE_PLAYING || source->m_source_id == INVALID_AL_ID || _isScheduled(data, source))
+			continue;
+		ALint al_state = AL_PLAYING;
+		alGetSourcei(source->m_source_id, AL_SOURCE_STATE, &al_state);
+		source->source_state = _sourceState(al_state);
+		if(source->source_state == AudioSource::STATE_STOPPED)
+			data->finished.push(source->m_handle);
 	}
-	return false;
+	return alGetError() == AL_NO_ERROR;
 }
 
-bool AudioManager::AudioSource::setVelocity(const axl::math::Vec3f& _velocity)
+bool AudioManager::popFinished(Handle& source_handle)
 {
-	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!data || data->finished_head >= data->finished.count)
 		return false;
-	while(alGetError() != AL_NO_ERROR);
-	alSource3f(m_source_id, AL_VELOCITY, _velocity.x, _velocity.y, _velocity.z);
-	if(alGetError() == AL_NO_ERROR)
-	{
-		source_velocity = _velocity;
-		return true;
-	}
-	return false;
+	source_handle = data->finished.items[data->finished_head++];
+	if(data->finished_head == data->finished.count)
+		data->finished.count = data->finished_head = 0;
+	return true;
 }
 
-bool AudioManager::AudioSource::setDirection(const axl::math::Vec3f& _direction)
+bool AudioManager::beginUpdate()
 {
-	if(!AudioSource::isValid() || !audio_manager.makeCurrent())
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!data || data->updating || data->threaded)
 		return false;
-	while(alGetError() != AL_NO_ERROR);
-	alSource3f(m_source_id, AL_DIRECTION, _direction.x, _direction.y, _direction.z);
-	if(alGetError() == AL_NO_ERROR)
-	{
-		source_direction = _direction;
-		return true;
-	}
-	return false;
+	data->updating = true;
+	return true;
 }
 
-bool AudioManager::AudioSource::setBuffer(const AudioBuffer* audio_buffer)
+bool AudioManager::commitUpdate(AudioSource** failed_sources, size_t max_failed_sources, size_t* failed_count)
 {
-	if(!AudioSource::isValid() || (audio_buffer && !audio_buffer->isValid()) || !audio_manager.makeCurrent())
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(failed_count)
+		*failed_count = 0;
+	if(!data || !data->updating)
 		return false;
-	while(alGetError() != AL_NO_ERROR);
-	if(!audio_buffer)
-		alSourcei(m_source_id, AL_BUFFER, 0);
-	else
-		alSourcei(m_source_id, AL_BUFFER, audio_buffer->buffer_id);
-	if(alGetError() == AL_NO_ERROR)
+	data->updating = false;
+	bool is_current = AudioManager::makeCurrent();
+	if(is_current)
 	{
-		source_audio_buffer = audio_buffer;
-		return true;
+		while(alGetError() != AL_NO_ERROR);
+		if(data->listener_dirty & LISTENER_DIRTY_POSITION)
+			alListener3f(AL_POSITION, audioman_position.x, audioman_position.y, audioman_position.z);
+		if(data->listener_dirty & LISTENER_DIRTY_VELOCITY)
+			alListener3f(AL_VELOCITY, audioman_velocity.x, audioman_velocity.y, audioman_velocity.z);
+		if(data->listener_dirty & LISTENER_DIRTY_ORIENTATION)
+		{
+			float fp_orientation[] = { audioman_orientation_at.x, audioman_orientation_at.y, audioman_orientation_at.z, audioman_orientation_up.x, audioman_orientation_up.y, audioman_orientation_up.z };
+			alListenerfv(AL_ORIENTATION, fp_orientation);
+		}
+		data->listener_dirty = 0;
+		for(AudioSource* source = data->dirty_sources; source; source = source->m_next_dirty)
+			source->flushProperties(source->m_dirty);
 	}
-	return false;
+	// Fast path: a single error check covers the whole frame. Only when it reports
+	// an error is every source replayed on its own to attribute the failures.
+	bool success = is_current && alGetError() == AL_NO_ERROR;
+	size_t failures = 0;
+	AudioSource* source = data->dirty_sources;
+	data->dirty_sources = 0;
+	while(source)
+	{
+		AudioSource* next = source->m_next_dirty;
+		unsigned int dirty_flags = source->m_dirty;
+		source->m_dirty = 0;
+		source->m_next_dirty = 0;
+		if(!success)
+		{
+			bool failed = !is_current;
+			if(!failed)
+			{
+				source->flushProperties(dirty_flags);
+				failed = alGetError() != AL_NO_ERROR;
+				if(failed)
+					source->reloadProperties(dirty_flags);
+			}
+			if(failed)
+			{
+				if(failed_sources && failures < max_failed_sources)
+					failed_sources[failures] = source;
+				++failures;
+			}
+		}
+		source = next;
+	}
+	if(failed_count)
+		*failed_count = failures;
+	return success;
 }
 
-//
-// AudioManager
-//
+bool AudioManager::isUpdating() const
+{
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	return data && data->updating;
+}
 
-AudioManager::AudioManager() :
-	m_reserved(new AudioManagerData()),
-	m_sources(),
-	m_buffers(),
-	position(audioman_position),
-	velocity(audioman_velocity),
-	orientation_at(audioman_orientation_at),
-	orientation_up(audioman_orientation_up),
-	audioman_position(0.f, 0.f, 0.f),
-	audioman_velocity(0.f, 0.f, 0.f),
-	audioman_orientation_at(0.f, 0.f, -1.f),
-	audioman_orientation_up(0.f, 1.f, 0.f)
-{}
+static const char *const _statOperationNames[AudioManager::STAT_OPERATION_COUNT] = {
+	"create", "destroy", "set_property", "playback", "load_from_file", "set_data", "make_current"
+};
 
-AudioManager::~AudioManager()
+// Counters are read one at a time, so a snapshot taken while other threads work is close but not atomic.
+bool AudioManager::getStats(Stats& stats) const
 {
-	this->destroy();
-	if(m_reserved)
-		delete (AudioManagerData*)m_reserved;
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	if(!data)
+		return false;
+	memset(&stats, 0, sizeof(stats));
+#if AUDIOMANAGER_STATS
+	for(size_t op = 0; op < STAT_OPERATION_COUNT; ++op)
+	{
+		const OperationCounters& counters = data->stats.operations[op];
+		stats.operations[op].calls = (size_t)counters.calls.load(std::memory_order_relaxed);
+		stats.operations[op].total_ns = counters.total_ns.load(std::memory_order_relaxed);
+		stats.operations[op].max_ns = counters.max_ns.load(std::memory_order_relaxed);
+		for(size_t bucket = 0; bucket < STATS_HISTOGRAM_BUCKETS; ++bucket)
+			stats.operations[op].histogram[bucket] = (size_t)counters.histogram[bucket].load(std::memory_order_relaxed);
+	}
+	stats.frame_count = (size_t)data->stats.frame_count;
+	stats.frame_operations = (size_t)data->stats.last_frame_operations;
+	stats.frame_uploaded_bytes = (size_t)data->stats.last_frame_uploaded_bytes;
+	stats.uploaded_bytes = (size_t)data->stats.uploaded_bytes.load(std::memory_order_relaxed);
+	stats.failed_buffers = (size_t)data->stats.failed_buffers.load(std::memory_order_relaxed);
+	stats.failed_sources = (size_t)data->stats.failed_sources.load(std::memory_order_relaxed);
+#endif
+	{
+		std::lock_guard<SpinLock> guard(data->pool_lock);
+		stats.live_buffers = data->buffers.live_count;
+		stats.live_sources = data->sources.live_count;
+		for(unsigned int index = 0; index < data->buffers.page_count * POOL_PAGE_SLOTS; ++index)
+		{
+			ObjectPool<AudioBuffer>::Slot *slot = data->buffers.slot(index);
+			if(slot->live)
+				stats.resident_bytes += ((AudioBuffer*)slot->storage)->buffer_size;
+		}
+	}
+	stats.live_voices = data->voices.live_count;
+	for(StreamingSource* stream = data->streams; stream; stream = stream->m_next_stream)
+		++stats.live_streams;
+	for(EffectChain* effect_chain = data->chains; effect_chain; effect_chain = effect_chain->m_next_chain)
+		++stats.live_effect_chains;
+	return true;
 }
 
-bool AudioManager::create()
+bool AudioManager::resetStats()
 {
 	AudioManagerData *data = ((AudioManagerData*)m_reserved);
 	if(!data)
-		m_reserved = data = new AudioManagerData();
-	if(!data)
-		return false;
-	data->device = _g_al_device ? _g_al_device : alcOpenDevice(NULL);
-	++_g_handles;
-	if(!data->device)
 		return false;
-	data->context = alcCreateContext(data->device, NULL);
-	if(!data->context)
+	for(size_t op = 0; op < STAT_OPERATION_COUNT; ++op)
 	{
-		if(_g_handles <= 0)
-			alcCloseDevice(data->device);
-		else --_g_handles;
-		data->device = 0;
-		return false;
+		OperationCounters& counters = data->stats.operations[op];
+		counters.calls.store(0, std::memory_order_relaxed);
+		counters.total_ns.store(0, std::memory_order_relaxed);
+		counters.max_ns.store(0, std::memory_order_relaxed);
+		for(size_t bucket = 0; bucket < STATS_HISTOGRAM_BUCKETS; ++bucket)
+			counters.histogram[bucket].store(0, std::memory_order_relaxed);
 	}
-	if(!AudioManager::makeCurrent())
-		return false;
-	while(alGetError() != AL_NO_ERROR);
-	alListener3f(AL_POSITION, audioman_position.x, audioman_position.y, audioman_position.z);
-	alListener3f(AL_VELOCITY, audioman_velocity.x, audioman_velocity.y, audioman_velocity.z);
-	float fp_orientation[] = { audioman_orientation_at.x, audioman_orientation_at.y, audioman_orientation_at.z, audioman_orientation_up.x, audioman_orientation_up.y, audioman_orientation_up.z };
-	alListenerfv(AL_ORIENTATION, fp_orientation);
-	return alGetError() == AL_NO_ERROR;
+	data->stats.frame_operations.store(0, std::memory_order_relaxed);
+	data->stats.frame_uploaded_bytes.store(0, std::memory_order_relaxed);
+	data->stats.uploaded_bytes.store(0, std::memory_order_relaxed);
+	data->stats.failed_buffers.store(0, std::memory_order_relaxed);
+	data->stats.failed_sources.store(0, std::memory_order_relaxed);
+	data->stats.frame_count = 0;
+	data->stats.last_frame_operations = 0;
+	data->stats.last_frame_uploaded_bytes = 0;
+	return true;
 }
 
-bool AudioManager::destroy()
+// Closes the current frame: its operation count and upload volume become the frame_* figures.
+bool AudioManager::markStatsFrame()
 {
 	AudioManagerData *data = ((AudioManagerData*)m_reserved);
-	if(!data || !data->device || !data->context)
+	if(!data)
 		return false;
-	for(axl::ds::ListIterator<AudioBuffer*> it = m_buffers.first(); it.isNotNull(); ++it)
+	data->stats.last_frame_operations = data->stats.frame_operations.exchange(0, std::memory_order_relaxed);
+	data->stats.last_frame_uploaded_bytes = data->stats.frame_uploaded_bytes.exchange(0, std::memory_order_relaxed);
+	++data->stats.frame_count;
+	return true;
+}
+
+// JSON nests the per-operation figures; CSV flattens everything into metric,value rows.
+bool AudioManager::dumpStats(const char* file_path, StatsFormat format) const
+{
+	Stats stats;
+	if(!file_path || !this->getStats(stats))
+		return false;
+	FILE *file = fopen(file_path, "w");
+	if(!file)
+		return false;
+	const char *const counter_names[] = {
+		"frame_count", "frame_operations", "frame_uploaded_bytes", "uploaded_bytes", "live_buffers", "live_sources",
+		"live_streams", "live_voices", "live_effect_chains", "failed_buffers", "failed_sources", "resident_bytes"
+	};
+	const size_t counter_values[] = {
+		stats.frame_count, stats.frame_operations, stats.frame_uploaded_bytes, stats.uploaded_bytes, stats.live_buffers, stats.live_sources,
+		stats.live_streams, stats.live_voices, stats.live_effect_chains, stats.failed_buffers, stats.failed_sources, stats.resident_bytes
+	};
+	const size_t counter_count = sizeof(counter_values) / sizeof(counter_values[0]);
+	if(format == STATS_CSV)
 	{
-		AudioBuffer* buffer = it.ref();
-		if(!buffer)
-			continue;
-		buffer->destroy();
+		fprintf(file, "metric,value\n");
+		for(size_t i = 0; i < counter_count; ++i)
+			fprintf(file, "%s,%llu\n", counter_names[i], (unsigned long long)counter_values[i]);
+		for(size_t op = 0; op < STAT_OPERATION_COUNT; ++op)
+		{
+			const OperationStats& operation = stats.operations[op];
+			fprintf(file, "%s.calls,%llu\n", _statOperationNames[op], (unsigned long long)operation.calls);
+			fprintf(file, "%s.total_ns,%llu\n", _statOperationNames[op], (unsigned long long)operation.total_ns);
+			fprintf(file, "%s.max_ns,%llu\n", _statOperationNames[op], (unsigned long long)operation.max_ns);
+			for(size_t bucket = 0; bucket < STATS_HISTOGRAM_BUCKETS; ++bucket)
+				fprintf(file, "%s.histogram_%u,%llu\n", _statOperationNames[op], (unsigned int)bucket, (unsigned long long)operation.histogram[bucket]);
+		}
 	}
-	for(axl::ds::ListIterator<AudioSource*> it = m_sources.first(); it.isNotNull(); ++it)
+	else
 	{
-		AudioSource* source = it.ref();
-		if(!source)
-			continue;
-		source->destroy();
+		fprintf(file, "{\n");
+		for(size_t i = 0; i < counter_count; ++i)
+			fprintf(file, "\t\"%s\": %llu,\n", counter_names[i], (unsigned long long)counter_values[i]);
+		fprintf(file, "\t\"operations\": {\n");
+		for(size_t op = 0; op < STAT_OPERATION_COUNT; ++op)
+		{
+			const OperationStats& operation = stats.operations[op];
+			fprintf(file, "\t\t\"%s\": { \"calls\": %llu, \"total_ns\": %llu, \"max_ns\": %llu, \"histogram_us\": [", _statOperationNames[op],
+				(unsigned long long)operation.calls, (unsigned long long)operation.total_ns, (unsigned long long)operation.max_ns);
+			for(size_t bucket = 0; bucket < STATS_HISTOGRAM_BUCKETS; ++bucket)
+				fprintf(file, bucket ? ", %llu" : "%llu", (unsigned long long)operation.histogram[bucket]);
+			fprintf(file, op + 1 < STAT_OPERATION_COUNT ? "] },\n" : "] }\n");
+		}
+		fprintf(file, "\t}\n}\n");
 	}
-	alcGetCurrentContext() != data->context || alcMakeContextCurrent(0);
-	alcDestroyContext(data->context);
-	if(_g_handles <= 0)
-		alcCloseDevice(data->device);
-	else
-		--_g_handles;
-	data->context = 0;
-	data->device = 0;
-	return true;
+	bool success = !ferror(file);
+	return fclose(file) == 0 && success;
 }
 
-bool AudioManager::isValid() const
+bool AudioManager::makeCurrent() const
 {
 	AudioManagerData *data = ((AudioManagerData*)m_reserved);
-	return data && data->device && data->context;
+	StatScope stat_scope(data, STAT_MAKE_CURRENT);
+	// A threaded manager only touches the AL from its own audio thread.
+	if(data && data->threaded && _t_audio_thread_data != data)
+		return false;
+	if(!data || !data->device || !data->context)
+		return false;
+	// With ALC_EXT_thread_local_context each thread binds its own context, so managers driven
+	// from different threads never switch the process-wide one under each other.
+	if(data->get_thread_context)
+		return data->get_thread_context() == data->context || data->set_thread_context(data->context);
+	return alcGetCurrentContext() == data->context || alcMakeContextCurrent(data->context);
 }
 
-bool AudioManager::setPosition(const axl::math::Vec3f& _position)
+//
+// AudioManager audio thread
+//
+
+bool AudioManager::postsCommands() const
 {
-	if(AudioManager::makeCurrent())
-	{
-		while(alGetError() != AL_NO_ERROR);
-		alListener3f(AL_POSITION, _position.x, _position.y, _position.z);
-		if(alGetError() != AL_NO_ERROR)
-			return false;
-	}
-	audioman_position = _position;
-	return true;
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	return data && data->threaded && _t_audio_thread_data != data;
 }
 
-bool AudioManager::setVelocity(const axl::math::Vec3f& _velocity)
+void AudioManager::runAudioThread()
 {
-	if(AudioManager::makeCurrent())
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	_t_audio_thread_data = data;
+	AudioManager::makeCurrent();
+	while(data->running.load(std::memory_order_acquire))
 	{
-		while(alGetError() != AL_NO_ERROR);
-		alListener3f(AL_VELOCITY, _velocity.x, _velocity.y, _velocity.z);
-		if(alGetError() != AL_NO_ERROR)
-			return false;
+		bool idle = true;
+		while(AudioCommand *command = data->commands.pop())
+		{
+			this->executeCommand(command);
+			delete command;
+			idle = false;
+		}
+		if(data->scheduled.count > 0)
+			this->startScheduled(_deviceClock(data));
+		this->pollPlayingSources();
+		if(idle)
+			std::this_thread::sleep_for(AUDIO_THREAD_IDLE_WAIT);
 	}
-	audioman_velocity = _velocity;
-	return true;
+	if(data->set_thread_context)
+		data->set_thread_context(0);
+	_t_audio_thread_data = 0;
 }
 
-bool AudioManager::setOrientationAt(const axl::math::Vec3f& _orientation_at)
+static void _removePlaying(AudioManagerData* data, const AudioManager::AudioSource* source)
 {
-	if(AudioManager::makeCurrent())
+	for(size_t i = 0; i < data->playing.count; ++i)
 	{
-		while(alGetError() != AL_NO_ERROR);
-		float fp_orientation[] = { _orientation_at.x, _orientation_at.y, _orientation_at.z, audioman_orientation_up.x, audioman_orientation_up.y, audioman_orientation_up.z };
-		alListenerfv(AL_ORIENTATION, fp_orientation);
-		if(alGetError() != AL_NO_ERROR)
-			return false;
+		if(data->playing.items[i] != source)
+			continue;
+		data->playing.items[i] = data->playing.items[--data->playing.count];
+		return;
 	}
-	audioman_orientation_at = _orientation_at;
-	return true;
 }
 
-bool AudioManager::setOrientationUp(const axl::math::Vec3f& _orientation_up)
+// Validates a group on the calling thread and either runs it or hands it to the audio thread in
+// one command; the serials travel with it so pollStates() can tell the group's play apart.
+bool AudioManager::commandGroup(unsigned int command_type, AudioSource* const* audio_sources, size_t count, uint64_t device_time)
 {
-	if(AudioManager::makeCurrent())
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	StatScope stat_scope(data, STAT_PLAYBACK);
+	if(!audio_sources || count == 0 || !AudioManager::isValid())
+		return false;
+	for(size_t i = 0; i < count; ++i)
 	{
-		while(alGetError() != AL_NO_ERROR);
-		float fp_orientation[] = { audioman_orientation_at.x, audioman_orientation_at.y, audioman_orientation_at.z, _orientation_up.x, _orientation_up.y, _orientation_up.z };
-		alListenerfv(AL_ORIENTATION, fp_orientation);
-		if(alGetError() != AL_NO_ERROR)
+		if(!audio_sources[i] || &audio_sources[i]->audio_manager != this || !audio_sources[i]->isValid())
 			return false;
 	}
-	audioman_orientation_up = _orientation_up;
-	return true;
-}
-
-bool AudioManager::setOrientation(const axl::math::Vec3f& _orientation_at, const axl::math::Vec3f& _orientation_up)
-{
-	if(AudioManager::makeCurrent())
+	if(this->postsCommands())
 	{
-		while(alGetError() != AL_NO_ERROR);
-		float fp_orientation[] = { _orientation_at.x, _orientation_at.y, _orientation_at.z, _orientation_up.x, _orientation_up.y, _orientation_up.z };
-		alListenerfv(AL_ORIENTATION, fp_orientation);
-		if(alGetError() != AL_NO_ERROR)
+		// Streams refill from the calling thread, which a threaded manager never lets touch the AL.
+		for(size_t i = 0; i < count; ++i)
+		{
+			if(this->findStream(audio_sources[i]))
+				return false;
+		}
+		AudioSource **sources = (AudioSource**)malloc(count * (sizeof(AudioSource*) + sizeof(unsigned int)));
+		if(!sources)
 			return false;
+		unsigned int *serials = (unsigned int*)(sources + count);
+		for(size_t i = 0; i < count; ++i)
+		{
+			AudioSource *source = audio_sources[i];
+			if(command_type == CMD_GROUP_PLAY)
+			{
+				source->source_state = AudioSource::STATE_PLAYING;
+				++source->m_play_serial;
+			}
+			else if(command_type == CMD_GROUP_STOP)
+				source->source_state = AudioSource::STATE_STOPPED;
+			else if(source->source_state == AudioSource::STATE_PLAYING)
+				source->source_state = AudioSource::STATE_PAUSED;
+			sources[i] = source;
+			serials[i] = source->m_play_serial;
+		}
+		AudioCommand *command = new AudioCommand((AudioCommandType)command_type);
+		command->payload = sources;
+		command->size = count;
+		command->time = device_time;
+		data->commands.push(command);
+		return true;
 	}
-	audioman_orientation_at = _orientation_at;
-	audioman_orientation_up = _orientation_up;
-	return true;
+	if(!AudioManager::makeCurrent())
+		return false;
+	for(size_t i = 0; i < count; ++i)
+	{
+		StreamingSource *stream = command_type == CMD_GROUP_PLAY ? this->findStream(audio_sources[i]) : 0;
+		if(stream && !stream->prepare())
+			return false;
+	}
+	while(alGetError() != AL_NO_ERROR);
+	this->runGroup(command_type, audio_sources, 0, count, device_time);
+	return alGetError() == AL_NO_ERROR;
 }
 
-AudioManager::AudioBuffer* AudioManager::newBuffer()
+// Issues a validated group on the thread that owns the AL. Sources still waiting on an async
+// load join the group once it lands, as play() does for them.
+void AudioManager::runGroup(unsigned int command_type, AudioSource* const* audio_sources, const unsigned int* serials, size_t count, uint64_t device_time)
 {
-	if(!AudioManager::isValid())
-		return 0;
-	AudioBuffer *buffer = new AudioBuffer(*this);
-	if(!buffer)
-		return 0;
-	if(!buffer->create())
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	bool schedule = command_type == CMD_GROUP_PLAY && !data->play_at_time && device_time > _deviceClock(data);
+	data->group_names.count = 0;
+	for(size_t i = 0; i < count; ++i)
 	{
-		delete buffer;
-		return 0;
+		AudioSource *source = audio_sources[i];
+		_unschedule(data, source);
+		if(source->m_source_id == INVALID_AL_ID)
+			continue;
+		if(command_type == CMD_GROUP_PLAY && !serials && source->source_audio_buffer && source->source_audio_buffer->load_state == AudioBuffer::LOAD_PENDING)
+		{
+			source->m_play_when_ready = true;
+			continue;
+		}
+		source->m_play_when_ready = false;
+		if(schedule)
+		{
+			ScheduledStart start = { source, device_time, serials ? serials[i] : 0 };
+			data->scheduled.push(start);
+			if(!serials)
+				source->source_state = AudioSource::STATE_PLAYING;
+			continue;
+		}
+		data->group_names.push(source->m_source_id);
+		if(serials)
+		{
+			_removePlaying(data, source);
+			if(command_type == CMD_GROUP_PLAY)
+			{
+				source->m_polled_serial = serials[i];
+				data->playing.push(source);
+			}
+		}
+		else if(command_type == CMD_GROUP_PLAY)
+			source->source_state = AudioSource::STATE_PLAYING;
+		else if(command_type == CMD_GROUP_STOP)
+			source->source_state = AudioSource::STATE_STOPPED;
+		else if(source->source_state == AudioSource::STATE_PLAYING)
+			source->source_state = AudioSource::STATE_PAUSED;
+		if(StreamingSource *stream = serials ? 0 : this->findStream(source))
+		{
+			StreamingSourceData *stream_data = (StreamingSourceData*)stream->m_stream;
+			stream_data->primed = false;
+			stream_data->playing = command_type == CMD_GROUP_PLAY;
+			if(command_type == CMD_GROUP_STOP)
+				stream->seek(0);
+		}
 	}
-	return buffer;
+	ALsizei name_count = (ALsizei)data->group_names.count;
+	if(name_count == 0)
+		return;
+	if(command_type == CMD_GROUP_PLAY && device_time && data->play_at_time)
+		data->play_at_time(name_count, data->group_names.items, (int64_t)device_time);
+	else if(command_type == CMD_GROUP_PLAY)
+		alSourcePlayv(name_count, data->group_names.items);
+	else if(command_type == CMD_GROUP_PAUSE)
+		alSourcePausev(name_count, data->group_names.items);
+	else
+		alSourceStopv(name_count, data->group_names.items);
 }
 
-bool AudioManager::deleteBuffer(AudioManager::AudioBuffer* audio_buffer)
+// Starts every held-back source that is due with a single alSourcePlayv, so a group scheduled
+// together still starts together.
+void AudioManager::startScheduled(uint64_t device_time)
 {
-	if(!audio_buffer || !AudioManager::isValid())
-		return false;
-	for(axl::ds::ListIterator<AudioBuffer*> it = m_buffers.first(); it.isNotNull(); ++it)
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	size_t kept = 0;
+	data->group_names.count = 0;
+	for(size_t i = 0; i < data->scheduled.count; ++i)
 	{
-		AudioBuffer* buffer = it.ref();
-		if(!buffer || buffer != audio_buffer)
+		ScheduledStart start = data->scheduled.items[i];
+		if(start.time > device_time)
+		{
+			data->scheduled.items[kept++] = start;
 			continue;
-		m_buffers.remove(it);
-		buffer->destroy();
-		delete buffer;
-		return true;
+		}
+		AudioSource *source = start.source;
+		if(source->m_source_id == INVALID_AL_ID)
+			continue;
+		data->group_names.push(source->m_source_id);
+		if(data->threaded)
+		{
+			source->m_polled_serial = start.serial;
+			_removePlaying(data, source);
+			data->playing.push(source);
+		}
+		else if(StreamingSource *stream = this->findStream(source))
+		{
+			((StreamingSourceData*)stream->m_stream)->primed = false;
+			((StreamingSourceData*)stream->m_stream)->playing = true;
+		}
 	}
-	return false;
+	data->scheduled.count = kept;
+	if(data->group_names.count > 0)
+		alSourcePlayv((ALsizei)data->group_names.count, data->group_names.items);
 }
 
-AudioManager::AudioSource* AudioManager::newSource()
+AudioManager::StreamingSource* AudioManager::findStream(const AudioSource* audio_source) const
 {
-	if(!AudioManager::isValid())
-		return 0;
-	AudioSource *source = new AudioSource(*this);
-	if(!source)
-		return 0;
-	if(!source->create())
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	for(StreamingSource* stream = data->streams; stream; stream = stream->m_next_stream)
 	{
-		delete source;
-		return 0;
+		if(stream == audio_source)
+			return stream;
 	}
-	return source;
+	return 0;
 }
 
-bool AudioManager::deleteSource(AudioManager::AudioSource* audio_source)
+void AudioManager::executeCommand(void* _command)
 {
-	if(!audio_source || !AudioManager::isValid())
-		return false;
-	for(axl::ds::ListIterator<AudioSource*> it = m_sources.first(); it.isNotNull(); ++it)
+	AudioManagerData *data = ((AudioManagerData*)m_reserved);
+	AudioCommand *command = (AudioCommand*)_command;
+	const float *values = command->values;
+	while(alGetError() != AL_NO_ERROR);
+	switch(command->type)
 	{
-		AudioSource* source = it.ref();
-		if(!source || source != audio_source)
-			continue;
-		m_sources.remove(it);
-		source->destroy();
-		delete source;
-		return true;
+		case CMD_SOURCE_CREATE:
+		{
+			AudioSource *source = (AudioSource*)command->target;
+			ALuint source_id = _takeName(data->source_names, true);
+			if(source_id == INVALID_AL_ID)
+				break;
+			// Reset the recycled name from a default prototype; the caller may be writing the real object's fields.
+			AudioSource prototype(*this);
+			prototype.m_source_id = source_id;
+			prototype.flushProperties(SOURCE_DIRTY_ALL);
+			prototype.m_source_id = INVALID_AL_ID;
+			source->m_source_id = source_id;
+		} break;
+		case CMD_SOURCE_DELETE:
+		{
+			AudioSource *source = (AudioSource*)command->target;
+			unsigned int index = source->m_handle.index;
+			_removePlaying(data, source);
+			_unschedule(data, source);
+			if(source->m_source_id != INVALID_AL_ID && _parkSourceName(data, source->m_source_id))
+				source->m_source_id = INVALID_AL_ID;
+			source->~AudioSource();
+			std::lock_guard<SpinLock> guard(data->pool_lock);
+			data->sources.recycle(index);
+		} break;
+		case CMD_SOURCE_PROPERTY:
+		{
+			ALuint source_id = ((AudioSource*)command->target)->m_source_id;
+			if(source_id == INVALID_AL_ID)
+				break;
+			switch(command->flags)
+			{
+				case SOURCE_DIRTY_LOOP: alSourcei(source_id, AL_LOOPING, values[0] != 0.f ? AL_TRUE : AL_FALSE); break;
+				case SOURCE_DIRTY_PITCH: alSourcef(source_id, AL_PITCH, values[0]); break;
+				case SOURCE_DIRTY_GAIN: alSourcef(source_id, AL_GAIN, values[0]); break;
+				case SOURCE_DIRTY_MIN_GAIN: alSourcef(source_id, AL_MIN_GAIN, values[0]); break;
+				case SOURCE_DIRTY_MAX_GAIN: alSourcef(source_id, AL_MAX_GAIN, values[0]); break;
+				case SOURCE_DIRTY_MAX_DISTANCE: alSourcef(source_id, AL_MAX_DISTANCE, values[0]); break;
+				case SOURCE_DIRTY_POSITION: alSource3f(source_id, AL_POSITION, values[0], values[1], values[2]); break;
+				case SOURCE_DIRTY_VELOCITY: alSource3f(source_id, AL_VELOCITY, values[0], values[1], values[2]); break;
+				case SOURCE_DIRTY_DIRECTION: alSource3f(source_id, AL_DIRECTION, values[0], values[1], values[2]); break;
+				case SOURCE_DIRTY_BUFFER:
+				{
+					const AudioBuffer *buffer = (const AudioBuffer*)command->object;
+					alSourcei(source_id, AL_BUFFER, buffer ? (ALint)buffer->m_buffer_id : 0);
+				} break;
+			}
+		} break;
+		case CMD_SOURCE_PLAY:
+		{
+			AudioSource *source = (AudioSource*)command->target;
+			_unschedule(data, source);
+			if(source->m_source_id == INVALID_AL_ID)
+				break;
+			alSourcePlay(source->m_source_id);
+			source->m_polled_serial = command->serial;
+			_removePlaying(data, source);
+			data->playing.push(source);
+		} break;
+		case CMD_SOURCE_PAUSE:
+		case CMD_SOURCE_STOP:
+		{
+			AudioSource *source = (AudioSource*)command->target;
+			_unschedule(data, source);
+			if(source->m_source_id == INVALID_AL_ID)
+				break;
+			if(command->type == CMD_SOURCE_PAUSE)
+				alSourcePause(source->m_source_id);
+			else
+				alSourceStop(source->m_source_id);
+			_removePlaying(data, source);
+		} break;
+		case CMD_GROUP_PLAY:
+		case CMD_GROUP_PAUSE:
+		case CMD_GROUP_STOP:
+		{
+			AudioSource **sources = (AudioSource**)command->payload;
+			this->runGroup(command->type, sources, (const unsigned int*)(sources + command->size), command->size, command->time);
+			free(command->payload);
+		} break;
+		case CMD_BUFFER_CREATE:
+			((AudioBuffer*)command->target)->m_buffer_id = _takeName(data->buffer_names, false);
+			break;
+		case CMD_BUFFER_DELETE:
+		{
+			AudioBuffer *buffer = (AudioBuffer*)command->target;
+			unsigned int index = buffer->m_handle.index;
+			buffer->~AudioBuffer();
+			std::lock_guard<SpinLock> guard(data->pool_lock);
+			data->buffers.recycle(index);
+		} break;
+		case CMD_BUFFER_DATA:
+		{
+			AudioBuffer *buffer = (AudioBuffer*)command->target;
+			ALenum al_format = _alFormat(data, command->format);
+			PFN_alBufferDataStatic alBufferDataStatic = command->mapped ? _alBufferDataStatic() : 0;
+			UploadResult result = {buffer->m_handle, command->format, command->size, command->frequency, false};
+			if(buffer->m_buffer_id != INVALID_AL_ID && alBufferDataStatic)
+			{
+				alBufferDataStatic((ALint)buffer->m_buffer_id, al_format, (ALvoid*)command->object, (ALsizei)command->size, (ALsizei)command->frequency);
+				if(alGetError() == AL_NO_ERROR)
+				{
+					buffer->releaseMapping();
+					buffer->m_mapping = command->payload;
+					result.success = true;
+				}
+			}
+			if(!result.success && buffer->m_buffer_id != INVALID_AL_ID)
+			{
+				alBufferData(buffer->m_buffer_id, al_format, command->object, (ALsizei)command->size, (ALsizei)command->frequency);
+				if(alGetError() == AL_NO_ERROR)
+				{
+					_countUpload(data, command->size);
+					buffer->releaseMapping();
+					result.success = true;
+				}
+			}
+			if(!result.success || buffer->m_mapping != command->payload)
+			{
+				if(command->mapped)
+				{
+					_unmapFile(*(MappedFile*)command->payload);
+					delete (MappedFile*)command->payload;
+				}
+				else free(command->payload);
+			}
+			std::lock_guard<SpinLock> guard(data->pool_lock);
+			data->upload_results.push(result);
+		} break;
+		case CMD_LISTENER:
+			if(command->flags == LISTENER_DIRTY_POSITION)
+				alListener3f(AL_POSITION, values[0], values[1], values[2]);
+			else if(command->flags == LISTENER_DIRTY_VELOCITY)
+				alListener3f(AL_VELOCITY, values[0], values[1], values[2]);
+			else
+				alListenerfv(AL_ORIENTATION, values);
+			break;
 	}
-	return false;
 }
 
-bool AudioManager::makeCurrent() const
+void AudioManager::pollPlayingSources()
 {
 	AudioManagerData *data = ((AudioManagerData*)m_reserved);
-	return data && data->device && data->context && (alcGetCurrentContext() == data->context || alcMakeContextCurrent(data->context));
+	if(data->playing.count == 0)
+		return;
+	if(data->state_events_enabled && data->state_events.exchange(0, std::memory_order_acquire) == 0)
+		return;
+	size_t kept = 0;
+	for(size_t i = 0; i < data->playing.count; ++i)
+	{
+		AudioSource *source = data->playing.items[i];
+		ALint al_state = AL_PLAYING;
+		alGetSourcei(source->m_source_id, AL_SOURCE_STATE, &al_state);
+		if(al_state == AL_STOPPED)
+		{
+			StateResult result = {source->m_handle, AudioSource::STATE_STOPPED, source->m_polled_serial};
+			std::lock_guard<SpinLock> guard(data->pool_lock);
+			data->state_results.push(result);
+		}
+		else data->playing.items[kept++] = source;
+	}
+	data->playing.count = kept;
 }
@@ -4,6 +4,103 @@
 class AudioManager
 {
 	public:
+		struct Handle
+		{
+			unsigned int index;
+			unsigned int generation;
+		};
+		struct CacheStats
+		{
+			size_t hits;
+			size_t misses;
+			size_t evictions;
+			size_t resident_bytes;
+		};
+		enum StatOperation
+		{
+			STAT_CREATE,
+			STAT_DESTROY,
+			STAT_SET_PROPERTY,
+			STAT_PLAYBACK,
+			STAT_LOAD_FROM_FILE,
+			STAT_SET_DATA,
+			STAT_MAKE_CURRENT,
+			STAT_OPERATION_COUNT
+		};
+		enum StatsFormat
+		{
+			STATS_JSON,
+			STATS_CSV
+		};
+		enum ResampleQuality
+		{
+			RESAMPLE_LOW,
+			RESAMPLE_MEDIUM,
+			RESAMPLE_HIGH
+		};
+		enum HrtfMode
+		{
+			HRTF_DEFAULT,
+			HRTF_DISABLED,
+			HRTF_ENABLED
+		};
+		struct DeviceConfig
+		{
+			size_t frequency;
+			size_t refresh;
+			size_t mono_sources;
+			size_t stereo_sources;
+			HrtfMode hrtf;
+			bool threaded;
+		};
+		struct Latency
+		{
+			double output;
+			double update_period;
+			uint64_t device_clock;
+			size_t frequency;
+			size_t refresh;
+			size_t mono_sources;
+			size_t stereo_sources;
+			bool hrtf;
+			bool measured;
+		};
+		class Device
+		{
+			private:
+				friend class AudioManager;
+				Device();
+				~Device();
+			public:
+				Device(const Device&) = delete;
+			public:
+				bool retain();
+			private:
+				void* m_reserved;
+		};
+		struct OperationStats
+		{
+			size_t calls;
+			uint64_t total_ns;
+			uint64_t max_ns;
+			size_t histogram[16];
+		};
+		struct Stats
+		{
+			OperationStats operations[STAT_OPERATION_COUNT];
+			size_t frame_count;
+			size_t frame_operations;
+			size_t frame_uploaded_bytes;
+			size_t uploaded_bytes;
+			size_t live_buffers;
+			size_t live_sources;
+			size_t live_streams;
+			size_t live_voices;
+			size_t live_effect_chains;
+			size_t failed_buffers;
+			size_t failed_sources;
+			size_t resident_bytes;
+		};
 		class AudioBuffer
 		{
 			public:
@@ -13,7 +110,24 @@ class AudioManager
 					FORMAT_MONO8,
 					FORMAT_MONO16,
 					FORMAT_STEREO8,
-					FORMAT_STEREO16 
+					FORMAT_STEREO16,
+					FORMAT_MONO_FLOAT32,
+					FORMAT_STEREO_FLOAT32,
+					FORMAT_51CHN16,
+					FORMAT_51CHN_FLOAT32,
+					FORMAT_71CHN16,
+					FORMAT_71CHN_FLOAT32,
+					FORMAT_MONO_IMA4,
+					FORMAT_STEREO_IMA4,
+					FORMAT_MONO_MSADPCM,
+					FORMAT_STEREO_MSADPCM
+				};
+				enum LoadState
+				{
+					LOAD_NONE,
+					LOAD_PENDING,
+					LOAD_READY,
+					LOAD_FAILED
 				};
 			private:
 				friend class AudioManager;
@@ -28,26 +142,117 @@ class AudioManager
 				bool isValid() const;
 				bool loadFromFile(const char* wav_file_path);
 				bool setData(Format format, void* data, size_t size, size_t frequency);
+				bool setCompressedData(Format format, void* data, size_t size, size_t frequency, size_t block_align);
+			private:
+				bool setStaticData(Format format, void* data, size_t size, size_t frequency);
+				void releaseMapping();
 			public:
 				const AudioManager& audio_manager;
+				const Handle& handle;
 				const unsigned int& buffer_id;
 				const Format& format;
 				const size_t& size;
 				const size_t& frequency;
+				const size_t& block_align;
+				const LoadState& load_state;
 			protected:
 				Format buffer_format;
 				size_t buffer_size;
 				size_t buffer_frequency;
+				size_t buffer_block_align;
+				LoadState buffer_load_state;
 			private:
 				unsigned int m_buffer_id;
+				void* m_mapping;
+				void* m_cache_entry;
+				Handle m_handle;
+		};
+		class Decoder
+		{
+			public:
+				Decoder();
+				virtual ~Decoder();
+				Decoder(const Decoder&) = delete;
+			public:
+				virtual bool open(const char* file_path) = 0;
+				virtual size_t read(void* samples, size_t frame_count) = 0;
+				virtual bool seek(size_t frame_offset) = 0;
+				virtual void close() = 0;
+			public:
+				const AudioBuffer::Format& format;
+				const size_t& frequency;
+				const size_t& frame_count;
+			protected:
+				AudioBuffer::Format decoder_format;
+				size_t decoder_frequency;
+				size_t decoder_frame_count;
+		};
+		typedef Decoder* (*DecoderFactory)();
+		class EffectChain
+		{
+			public:
+				enum EffectType
+				{
+					EFFECT_LOWPASS,
+					EFFECT_HIGHPASS,
+					EFFECT_DELAY,
+					EFFECT_REVERB,
+					EFFECT_COMPRESSOR
+				};
+				enum Parameter
+				{
+					PARAM_CUTOFF,
+					PARAM_RESONANCE,
+					PARAM_DELAY_TIME,
+					PARAM_FEEDBACK,
+					PARAM_DECAY_TIME,
+					PARAM_MIX,
+					PARAM_THRESHOLD,
+					PARAM_RATIO,
+					PARAM_ATTACK,
+					PARAM_RELEASE
+				};
+			private:
+				friend class AudioManager;
+				EffectChain(const AudioManager& audio_manager, size_t channel_count, size_t frequency);
+			public:
+				~EffectChain();
+				EffectChain(const EffectChain&) = delete;
+			public:
+				bool addEffect(EffectType type);
+				bool setParameter(size_t effect_index, Parameter parameter, float value);
+				float getParameter(size_t effect_index, Parameter parameter) const;
+				bool process(float* samples, size_t frame_count);
+				void reset();
+			public:
+				const AudioManager& audio_manager;
+				const size_t& channel_count;
+				const size_t& frequency;
+				const size_t& effect_count;
+			protected:
+				size_t chain_channel_count;
+				size_t chain_frequency;
+				size_t chain_effect_count;
+			private:
+				void* m_chain;
+				EffectChain* m_next_chain;
 		};
 		class AudioSource
 		{
+			public:
+				enum State
+				{
+					STATE_INITIAL,
+					STATE_PLAYING,
+					STATE_PAUSED,
+					STATE_STOPPED
+				};
 			private:
 				friend class AudioManager;
+			protected:
 				AudioSource(const AudioManager& audio_manager);
 			public:
-				~AudioSource();
+				virtual ~AudioSource();
 				AudioSource(AudioSource&& audio_source);
 				AudioSource(const AudioSource&) = delete;
 			public:
@@ -60,7 +265,7 @@ class AudioManager
 				bool play() const;
 				bool pause() const;
 				bool stop() const;
-				bool setLoop(bool loop);
+				virtual bool setLoop(bool loop);
 				bool setPitch(float pitch);
 				bool setGain(float gain);
 				bool setMinGain(float min_gain);
@@ -70,10 +275,20 @@ class AudioManager
 				bool setVelocity(const axl::math::Vec3f& velocity);
 				bool setDirection(const axl::math::Vec3f& direction);
 				bool setBuffer(const AudioBuffer* audio_buffer);
+				virtual bool setEffectChain(const EffectChain* effect_chain);
+				bool getLatency(double& offset, double& latency) const;
+			private:
+				bool markDirty(unsigned int dirty_flags);
+				void unmarkDirty();
+				void flushProperties(unsigned int dirty_flags);
+				void reloadProperties(unsigned int dirty_flags);
+				bool postCommand(unsigned int command_type, unsigned int dirty_flags = 0) const;
 			public:
 				const AudioManager& audio_manager;
+				const Handle& handle;
 				const AudioBuffer*const& audio_buffer;
 				const unsigned int& source_id;
+				const State& state;
 				const bool& loop;
 				const float& pitch;
 				const float& gain;
@@ -83,8 +298,10 @@ class AudioManager
 				const axl::math::Vec3f& position;
 				const axl::math::Vec3f& velocity;
 				const axl::math::Vec3f& direction;
+				const EffectChain*const& effect_chain;
 			protected:
 				const AudioBuffer* source_audio_buffer;
+				mutable State source_state;
 				bool source_loop;
 				float source_pitch;
 				float source_gain;
@@ -94,40 +311,218 @@ class AudioManager
 				axl::math::Vec3f source_position;
 				axl::math::Vec3f source_velocity;
 				axl::math::Vec3f source_direction;
+				const EffectChain* source_effect_chain;
 			private:
 				unsigned int m_source_id;
+				unsigned int m_dirty;
+				AudioSource* m_next_dirty;
+				Handle m_handle;
+				mutable unsigned int m_play_serial;
+				unsigned int m_polled_serial;
+				mutable bool m_play_when_ready;
+				const AudioBuffer* m_committed_buffer;
+		};
+		class StreamingSource : public AudioSource
+		{
+			private:
+				friend class AudioManager;
+				StreamingSource(const AudioManager& audio_manager, size_t buffer_count, size_t buffer_size);
+			public:
+				~StreamingSource();
+				StreamingSource(const StreamingSource&) = delete;
+			public:
+				bool create();
+				bool destroy();
+				bool open(const char* wav_file_path);
+				bool close();
+				bool isOpen() const;
+				bool play();
+				bool pause();
+				bool stop();
+				bool update();
+				bool seek(size_t sample_offset);
+				bool setLoop(bool loop) override;
+				bool setEffectChain(const EffectChain* effect_chain) override;
+				bool setBuffer(const AudioBuffer* audio_buffer) = delete;
+			private:
+				bool prepare();
+				bool fill(unsigned int al_buffer);
+				bool prime();
+				void unqueueAll();
+			public:
+				const size_t& buffer_count;
+				const size_t& buffer_size;
+				const size_t& sample_count;
+			protected:
+				size_t stream_buffer_count;
+				size_t stream_buffer_size;
+				size_t stream_sample_count;
+			private:
+				void* m_stream;
+				StreamingSource* m_next_stream;
+		};
+		class Voice
+		{
+			private:
+				friend class AudioManager;
+				Voice(const AudioManager& audio_manager);
+			public:
+				~Voice();
+				Voice(const Voice&) = delete;
+			public:
+				bool isPlaying() const;
+				bool isVirtual() const;
+				bool play();
+				bool stop();
+				bool setBuffer(const AudioBuffer* audio_buffer);
+				bool setLoop(bool loop);
+				bool setPriority(float priority);
+				bool setPitch(float pitch);
+				bool setGain(float gain);
+				bool setMaxDistance(float max_distance);
+				bool setPosition(const axl::math::Vec3f& position);
+				bool setVelocity(const axl::math::Vec3f& velocity);
+				bool setDirection(const axl::math::Vec3f& direction);
+				bool setCone(float inner_angle, float outer_angle, float outer_gain);
+			public:
+				const AudioManager& audio_manager;
+				const Handle& handle;
+				const AudioBuffer*const& audio_buffer;
+				const bool& loop;
+				const float& priority;
+				const float& pitch;
+				const float& gain;
+				const float& max_distance;
+				const axl::math::Vec3f& position;
+				const axl::math::Vec3f& velocity;
+				const axl::math::Vec3f& direction;
+				const float& cone_inner_angle;
+				const float& cone_outer_angle;
+				const float& cone_outer_gain;
+				const float& audibility;
+				const float& doppler;
+				const float& offset;
+			protected:
+				const AudioBuffer* voice_audio_buffer;
+				bool voice_loop;
+				float voice_priority;
+				float voice_pitch;
+				float voice_gain;
+				float voice_max_distance;
+				axl::math::Vec3f voice_position;
+				axl::math::Vec3f voice_velocity;
+				axl::math::Vec3f voice_direction;
+				float voice_cone_inner_angle;
+				float voice_cone_outer_angle;
+				float voice_cone_outer_gain;
+				float voice_audibility;
+				float voice_doppler;
+				float voice_offset;
+			private:
+				Handle m_handle;
+				AudioSource* m_source;
+				float m_fade;
+				bool m_playing;
+				bool m_pending;
+				bool m_selected;
 		};
 	public:
 		AudioManager();
 		~AudioManager();
 		AudioManager(const AudioManager&) = delete;
 	public:
-		bool create();
+		bool create(bool threaded = false);
+		bool create(const DeviceConfig& config, Device* device = 0);
+		bool createOffline(size_t frequency = 48000, size_t channel_count = 2);
 		bool destroy();
 		bool isValid() const;
+		bool isThreaded() const;
+		bool isOffline() const;
+		Device* getDevice() const;
+		bool render(float* samples, size_t frame_count);
+		bool getLatency(Latency& latency) const;
 		bool setPosition(const axl::math::Vec3f& position);
 		bool setVelocity(const axl::math::Vec3f& velocity);
 		bool setOrientationAt(const axl::math::Vec3f& orientation_at);
 		bool setOrientationUp(const axl::math::Vec3f& orientation_up);
 		bool setOrientation(const axl::math::Vec3f& orientation_at, const axl::math::Vec3f& orientation_up);
 		AudioBuffer* newBuffer();
+		AudioBuffer* getBuffer(const Handle& handle) const;
 		bool deleteBuffer(AudioBuffer* audio_buffer);
+		bool deleteBuffer(const Handle& handle);
+		AudioBuffer* loadBufferAsync(const char* wav_file_path);
+		bool updateLoads(size_t max_upload_bytes = 1048576);
+		AudioBuffer* acquireBuffer(const char* wav_file_path);
+		bool releaseBuffer(AudioBuffer* audio_buffer);
+		bool setCacheBudget(size_t cache_budget);
+		bool registerDecoder(DecoderFactory decoder_factory);
+		bool setLoadNormalization(bool normalize, ResampleQuality quality = RESAMPLE_MEDIUM, const char* cache_directory = 0);
+		EffectChain* newEffectChain(size_t channel_count = 2, size_t frequency = 48000);
+		bool deleteEffectChain(EffectChain* effect_chain);
+		bool setMasterEffectChain(EffectChain* effect_chain);
+		bool updateEffects();
 		AudioSource* newSource();
+		AudioSource* getSource(const Handle& handle) const;
 		bool deleteSource(AudioSource* audio_source);
+		bool deleteSource(const Handle& handle);
+		bool playSources(AudioSource* const* audio_sources, size_t count);
+		bool playSourcesAt(AudioSource* const* audio_sources, size_t count, uint64_t device_time);
+		bool pauseSources(AudioSource* const* audio_sources, size_t count);
+		bool stopSources(AudioSource* const* audio_sources, size_t count);
+		StreamingSource* newStreamingSource(size_t buffer_count = 4, size_t buffer_size = 65536);
+		bool deleteStreamingSource(StreamingSource* streaming_source);
+		bool updateStreams();
+		Voice* newVoice();
+		Voice* getVoice(const Handle& handle) const;
+		bool deleteVoice(Voice* voice);
+		bool deleteVoice(const Handle& handle);
+		bool setMaxVoices(size_t max_voices);
+		bool updateVoices(float delta_time);
+		bool pollStates();
+		bool popFinished(Handle& handle);
+		bool beginUpdate();
+		bool commitUpdate(AudioSource** failed_sources = 0, size_t max_failed_sources = 0, size_t* failed_count = 0);
+		bool isUpdating() const;
+		bool getStats(Stats& stats) const;
+		bool resetStats();
+		bool markStatsFrame();
+		bool dumpStats(const char* file_path, StatsFormat format = STATS_JSON) const;
+		static Device* openDevice(const char* device_name = 0);
+		static bool releaseDevice(Device* device);
 	protected:
 		bool makeCurrent() const;
+	private:
+		bool initContext(bool threaded);
+		bool postsCommands() const;
+		void runAudioThread();
+		void executeCommand(void* command);
+		bool commandGroup(unsigned int command_type, AudioSource* const* audio_sources, size_t count, uint64_t device_time);
+		void runGroup(unsigned int command_type, AudioSource* const* audio_sources, const unsigned int* serials, size_t count, uint64_t device_time);
+		void startScheduled(uint64_t device_time);
+		StreamingSource* findStream(const AudioSource* audio_source) const;
+		void pollPlayingSources();
+		void resolvePendingSources(const AudioBuffer* audio_buffer);
+		bool isHeld(const AudioBuffer* audio_buffer) const;
+		void uncacheBuffer(AudioBuffer* audio_buffer);
+		void trimCache();
+		bool bindVoice(Voice* voice);
+		void unbindVoice(Voice* voice, bool sync_offset);
 	public:
 		const axl::math::Vec3f& position;
 		const axl::math::Vec3f& velocity;
 		const axl::math::Vec3f& orientation_at;
 		const axl::math::Vec3f& orientation_up;
+		const size_t& max_voices;
+		const size_t& cache_budget;
+		const CacheStats& cache_stats;
 	protected:
 		axl::math::Vec3f audioman_position;
 		axl::math::Vec3f audioman_velocity;
 		axl::math::Vec3f audioman_orientation_at;
 		axl::math::Vec3f audioman_orientation_up;
+		size_t audioman_max_voices;
+		size_t audioman_cache_budget;
+		CacheStats audioman_cache_stats;
 	private:
 		void* m_reserved;
-		axl::ds::List<AudioBuffer*> m_buffers;
-		axl::ds::List<AudioSource*> m_sources;
 };
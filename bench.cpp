@@ -0,0 +1,277 @@
+#include <AudioManager.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+struct Result
+{
+	const char* name;
+	size_t ops;
+	size_t bytes_per_op;
+	double p50;
+	double p90;
+	double p99;
+	double min;
+};
+
+class Bench
+{
+	public:
+		Bench(size_t samples);
+	public:
+		// Times `body` once per sample; the body performs `ops` operations and results are in ns/op.
+		template <class Body>
+		const Result& run(const char* name, size_t ops, Body body, size_t bytes_per_op = 0);
+		const std::vector<Result>& results() const;
+	private:
+		size_t _samples;
+		std::vector<double> _times;
+		std::vector<Result> _results;
+};
+
+///////////////
+// Bench
+
+Bench::Bench(size_t samples) :
+	_samples(samples < 1 ? 1 : samples),
+	_times(),
+	_results()
+{}
+
+template <class Body>
+const Result& Bench::run(const char* name, size_t ops, Body body, size_t bytes_per_op)
+{
+	_times.clear();
+	body(); // warm-up: first-touch allocations and name stocks
+	for(size_t i = 0; i < _samples; ++i)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		body();
+		std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+		_times.push_back((double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / (double)ops);
+	}
+	std::sort(_times.begin(), _times.end());
+	size_t last = _times.size() - 1;
+	Result result = { name, ops, bytes_per_op, _times[last * 50 / 100], _times[last * 90 / 100], _times[last * 99 / 100], _times[0] };
+	_results.push_back(result);
+	printf("%-24s %8zu %12.1f %12.1f %12.1f %12.1f", name, ops, result.p50, result.p90, result.p99, result.min);
+	if(bytes_per_op)
+		printf(" %10.1f MB/s", (double)bytes_per_op / result.p50 * 1e+3);
+	printf("\n");
+	return _results.back();
+}
+
+const std::vector<Result>& Bench::results() const
+{
+	return _results;
+}
+
+///////////////
+// Helpers
+
+static bool writeWav(const char* path, size_t data_size)
+{
+	FILE *file = fopen(path, "wb");
+	if(!file)
+		return false;
+	unsigned char header[44] = { 'R','I','F','F', 0,0,0,0, 'W','A','V','E', 'f','m','t',' ', 16,0,0,0, 1,0, 2,0,
+		0x80,0xBB,0,0, 0x00,0xEE,0x02,0, 4,0, 16,0, 'd','a','t','a', 0,0,0,0 };
+	unsigned int riff_size = (unsigned int)(36 + data_size), chunk_size = (unsigned int)data_size;
+	for(int i = 0; i < 4; ++i)
+	{
+		header[4 + i] = (unsigned char)(riff_size >> (8 * i));
+		header[40 + i] = (unsigned char)(chunk_size >> (8 * i));
+	}
+	std::vector<short> samples(data_size / sizeof(short));
+	for(size_t i = 0; i < samples.size(); ++i)
+		samples[i] = (short)(8000.0 * sin((double)(i / 2) * 0.0626));
+	bool success = fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+		fwrite(samples.data(), sizeof(short), samples.size(), file) == samples.size();
+	return fclose(file) == 0 && success;
+}
+
+// Baseline lines are "<name> <p50 ns/op>"; '#' starts a comment.
+static bool readBaseline(const char* path, const char* name, double& p50)
+{
+	FILE *file = fopen(path, "r");
+	if(!file)
+		return false;
+	char line[256], entry[128];
+	bool found = false;
+	while(!found && fgets(line, sizeof(line), file))
+		found = line[0] != '#' && sscanf(line, "%127s %lf", entry, &p50) == 2 && strcmp(entry, name) == 0;
+	fclose(file);
+	return found;
+}
+
+static bool writeBaseline(const char* path, const std::vector<Result>& results)
+{
+	FILE *file = fopen(path, "w");
+	if(!file)
+		return false;
+	fprintf(file, "# AudioManager benchmark baseline: <name> <p50 ns/op>\n");
+	fprintf(file, "# Regenerate on the reference machine with: bench --update\n");
+	for(size_t i = 0; i < results.size(); ++i)
+		fprintf(file, "%s %.1f\n", results[i].name, results[i].p50);
+	return fclose(file) == 0;
+}
+
+/////////
+// main
+
+int main(int argc, char* argv[])
+{
+	// args: [--baseline file] [--update] [--tolerance fraction] [--samples n] [--sources n]
+	const char *baseline_path = "bench_baseline.txt";
+	bool update = false;
+	double tolerance = 0.25;
+	size_t samples = 50, source_count = 256;
+	for(int i = 1; i < argc; ++i)
+	{
+		if(!strcmp(argv[i], "--update"))
+			update = true;
+		else if(i + 1 < argc && !strcmp(argv[i], "--baseline"))
+			baseline_path = argv[++i];
+		else if(i + 1 < argc && !strcmp(argv[i], "--tolerance"))
+			tolerance = atof(argv[++i]);
+		else if(i + 1 < argc && !strcmp(argv[i], "--samples"))
+			samples = (size_t)atol(argv[++i]);
+		else if(i + 1 < argc && !strcmp(argv[i], "--sources"))
+			source_count = (size_t)atol(argv[++i]);
+		else
+		{
+			printf("USAGE %s [--baseline file] [--update] [--tolerance fraction] [--samples n] [--sources n]\n", argv[0]);
+			return 2;
+		}
+	}
+	/********************************/
+	// The loopback device mixes only on demand, so timings carry no sound card or mixer-thread noise.
+	// A hardware device would make the numbers incomparable with the baseline, so there is no fallback.
+	AudioManager audio_manager;
+	if(!audio_manager.createOffline(48000, 2))
+	{
+		printf("No OpenAL loopback device available\n");
+		return 2;
+	}
+	printf("device: loopback, %zu samples per benchmark\n", samples);
+	printf("%-24s %8s %12s %12s %12s %12s\n", "benchmark", "ops", "p50 ns/op", "p90 ns/op", "p99 ns/op", "min ns/op");
+	Bench bench(samples);
+	const size_t churn_count = 2000;
+	std::vector<AudioManager::AudioSource*> sources(churn_count);
+	std::vector<AudioManager::AudioBuffer*> buffers(churn_count);
+	bench.run("source_churn", churn_count * 2, [&]() {
+		for(size_t i = 0; i < churn_count; ++i)
+			sources[i] = audio_manager.newSource();
+		for(size_t i = 0; i < churn_count; ++i)
+			audio_manager.deleteSource(sources[i]);
+	});
+	bench.run("buffer_churn", churn_count * 2, [&]() {
+		for(size_t i = 0; i < churn_count; ++i)
+			buffers[i] = audio_manager.newBuffer();
+		for(size_t i = 0; i < churn_count; ++i)
+			audio_manager.deleteBuffer(buffers[i]);
+	});
+	// One second of a stereo tone shared by the moving sources.
+	const size_t clip_size = 48000 * 4;
+	std::vector<short> clip(clip_size / sizeof(short));
+	for(size_t i = 0; i < clip.size(); ++i)
+		clip[i] = (short)(8000.0 * sin((double)(i / 2) * 0.0626));
+	AudioManager::AudioBuffer *clip_buffer = audio_manager.newBuffer();
+	if(!clip_buffer || !clip_buffer->setData(AudioManager::AudioBuffer::FORMAT_STEREO16, clip.data(), clip_size, 48000))
+	{
+		printf("Could not upload the test clip\n");
+		return 2;
+	}
+	sources.resize(source_count);
+	for(size_t i = 0; i < source_count; ++i)
+	{
+		sources[i] = audio_manager.newSource();
+		if(!sources[i] || !sources[i]->setBuffer(clip_buffer) || !sources[i]->setLoop(true))
+		{
+			printf("Could not create %zu sources\n", source_count);
+			return 2;
+		}
+	}
+	float frame_time = 0.f;
+	auto moveSources = [&]() {
+		frame_time += 1.f / 60.f;
+		for(size_t i = 0; i < source_count; ++i)
+		{
+			float phase = frame_time + (float)i * 0.1f;
+			sources[i]->setPosition(axl::math::Vec3f(10.f * cosf(phase), 0.f, 10.f * sinf(phase)));
+			sources[i]->setVelocity(axl::math::Vec3f(-10.f * sinf(phase), 0.f, 10.f * cosf(phase)));
+			sources[i]->setGain(0.5f + 0.5f * sinf(phase));
+		}
+	};
+	bench.run("frame_update_direct", source_count * 3, moveSources);
+	bench.run("frame_update_batched", source_count * 3, [&]() {
+		audio_manager.beginUpdate();
+		moveSources();
+		audio_manager.commitUpdate();
+	});
+	for(size_t i = 0; i < source_count; ++i)
+		sources[i]->play();
+	float mix[256 * 2];
+	audio_manager.render(mix, 256);
+	const size_t poll_count = 100;
+	bench.run("poll_states", poll_count, [&]() {
+		for(size_t i = 0; i < poll_count; ++i)
+			audio_manager.pollStates();
+	});
+	for(size_t i = 0; i < source_count; ++i)
+		audio_manager.deleteSource(sources[i]);
+	const size_t wav_sizes[] = { 4 << 10, 256 << 10, 4 << 20 };
+	const char *const wav_names[] = { "load_wav_4k", "load_wav_256k", "load_wav_4m" };
+	const char *wav_path = "bench_load.wav";
+	for(size_t i = 0; i < sizeof(wav_sizes) / sizeof(wav_sizes[0]); ++i)
+	{
+		if(!writeWav(wav_path, wav_sizes[i]))
+		{
+			printf("Could not write %s\n", wav_path);
+			return 2;
+		}
+		const size_t load_count = wav_sizes[i] >= (1 << 20) ? 4 : 32;
+		bench.run(wav_names[i], load_count, [&]() {
+			for(size_t j = 0; j < load_count; ++j)
+				clip_buffer->loadFromFile(wav_path);
+		}, wav_sizes[i]);
+	}
+	remove(wav_path);
+	audio_manager.destroy();
+	/********************************/
+	const std::vector<Result>& results = bench.results();
+	if(update)
+	{
+		if(!writeBaseline(baseline_path, results))
+		{
+			printf("Could not write %s\n", baseline_path);
+			return 2;
+		}
+		printf("Baseline written to %s\n", baseline_path);
+		return 0;
+	}
+	int regressions = 0, missing = 0;
+	for(size_t i = 0; i < results.size(); ++i)
+	{
+		double baseline;
+		if(!readBaseline(baseline_path, results[i].name, baseline))
+		{
+			++missing;
+			continue;
+		}
+		if(results[i].p50 > baseline * (1.0 + tolerance))
+		{
+			printf("REGRESSION %s: %.1f ns/op against a baseline of %.1f (+%.0f%%)\n", results[i].name, results[i].p50, baseline, (results[i].p50 / baseline - 1.0) * 100.0);
+			++regressions;
+		}
+	}
+	if(missing > 0)
+		printf("%d benchmark(s) have no entry in %s; record one with --update\n", missing, baseline_path);
+	if(regressions > 0)
+		printf("%d benchmark(s) slower than %s allows\n", regressions, baseline_path);
+	return regressions > 0 || missing > 0 ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+#include <AudioManager.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// A 1 kHz mono tone at the device rate, so the mix involves no resampling.
+const size_t FREQUENCY = 48000;
+const size_t CLIP_FRAMES = 4800;
+const size_t TAIL_FRAMES = 4800;
+const size_t BLOCK_FRAMES = 256;
+// Frames at either end of the clip where the mixer may still be ramping its gains.
+const size_t EDGE_FRAMES = 512;
+
+static std::vector<short> makeClip()
+{
+	std::vector<short> clip(CLIP_FRAMES);
+	for(size_t i = 0; i < CLIP_FRAMES; ++i)
+		clip[i] = (short)(16384.0 * sin(2.0 * 3.14159265358979323846 * 1000.0 * (double)i / (double)FREQUENCY));
+	return clip;
+}
+
+// Renders the clip on a fresh offline manager at `gain`. `silence` receives one block rendered before play().
+static bool renderClip(const std::vector<short>& clip, float gain, std::vector<float>& output, std::vector<float>& silence, bool& stopped)
+{
+	AudioManager audio_manager;
+	if(!audio_manager.createOffline(FREQUENCY, 2))
+		return false;
+	AudioManager::AudioBuffer *buffer = audio_manager.newBuffer();
+	AudioManager::AudioSource *source = audio_manager.newSource();
+	if(!buffer || !buffer->setData(AudioManager::AudioBuffer::FORMAT_MONO16, (void*)clip.data(), clip.size() * sizeof(short), FREQUENCY) ||
+		!source || !source->setBuffer(buffer) || !source->setGain(gain))
+	{
+		audio_manager.destroy();
+		return false;
+	}
+	silence.assign(BLOCK_FRAMES * 2, 1.f);
+	output.assign((CLIP_FRAMES + TAIL_FRAMES) * 2, 0.f);
+	bool success = audio_manager.render(silence.data(), BLOCK_FRAMES) && source->play();
+	for(size_t frame = 0; success && frame < CLIP_FRAMES + TAIL_FRAMES; frame += BLOCK_FRAMES)
+		success = audio_manager.render(output.data() + frame * 2, std::min(BLOCK_FRAMES, CLIP_FRAMES + TAIL_FRAMES - frame));
+	audio_manager.pollStates();
+	stopped = !source->isPlaying();
+	audio_manager.destroy();
+	return success;
+}
+
+static int check(bool passed, const char* name)
+{
+	printf("%-28s %s\n", name, passed ? "ok" : "FAILED");
+	return passed ? 0 : 1;
+}
+
+/////////
+// main
+
+int main()
+{
+	// Two renders of the same mix must match sample for sample, and the mix must be linear in the
+	// source gain. The clip itself is compared by correlation, which holds under any panning law.
+	std::vector<short> clip = makeClip();
+	std::vector<float> full, repeat, half, silence;
+	bool stopped = false, repeat_stopped = false, half_stopped = false;
+	if(!renderClip(clip, 1.f, full, silence, stopped))
+	{
+		printf("No OpenAL loopback device available\n");
+		return 2;
+	}
+	if(!renderClip(clip, 1.f, repeat, silence, repeat_stopped) || !renderClip(clip, .5f, half, silence, half_stopped))
+	{
+		printf("Could not render the test clip\n");
+		return 2;
+	}
+	int failures = 0;
+	bool quiet = true;
+	for(size_t i = 0; i < silence.size(); ++i)
+		quiet = quiet && silence[i] == 0.f;
+	failures += check(quiet, "silent_before_play");
+	failures += check(full.size() == repeat.size() && !memcmp(full.data(), repeat.data(), full.size() * sizeof(float)), "deterministic");
+	float half_error = 0.f, side_error = 0.f;
+	for(size_t i = 0; i < full.size(); ++i)
+		half_error = std::max(half_error, fabsf(half[i] - .5f * full[i]));
+	for(size_t frame = 0; frame < CLIP_FRAMES + TAIL_FRAMES; ++frame)
+		side_error = std::max(side_error, fabsf(full[frame * 2] - full[frame * 2 + 1]));
+	failures += check(half_error < 1e-5f, "linear_in_gain");
+	failures += check(side_error < 1e-5f, "centered");
+	double cross = 0.0, clip_energy = 0.0, output_energy = 0.0;
+	for(size_t frame = EDGE_FRAMES; frame < CLIP_FRAMES - EDGE_FRAMES; ++frame)
+	{
+		double expected = (double)clip[frame] / 32768.0, actual = (double)full[frame * 2];
+		cross += expected * actual;
+		clip_energy += expected * expected;
+		output_energy += actual * actual;
+	}
+	double correlation = clip_energy > 0.0 && output_energy > 0.0 ? cross / sqrt(clip_energy * output_energy) : 0.0;
+	double level = clip_energy > 0.0 ? sqrt(output_energy / clip_energy) : 0.0;
+	printf("correlation %.6f, level %.3f\n", correlation, level);
+	failures += check(correlation > 0.999, "matches_clip");
+	failures += check(level > 0.25 && level < 1.5, "audible");
+	float tail = 0.f;
+	for(size_t frame = CLIP_FRAMES + TAIL_FRAMES / 2; frame < CLIP_FRAMES + TAIL_FRAMES; ++frame)
+		tail = std::max(tail, std::max(fabsf(full[frame * 2]), fabsf(full[frame * 2 + 1])));
+	failures += check(tail < 1e-4f, "silent_after_clip");
+	failures += check(stopped && repeat_stopped && half_stopped, "stopped_after_clip");
+	if(failures > 0)
+		printf("%d check(s) failed\n", failures);
+	return failures > 0 ? 1 : 0;
+}
@@ -1,90 +1,994 @@
-#include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-int shift_cipher(const uint8_t* message, size_t size, uint8_t* encrypted_message, const uint8_t* key, size_t key_len)
-{
-	if(!message || size == 0 || !encrypted_message) return 1;
-	for(size_t i=0; i<size; ++i)
-	{
-		if((message[i] >= 'A' && message[i] <= 'Z'))
-			encrypted_message[i] = ((message[i] - 'A') + key[i%key_len]) % 26 + 'A';
-		else if((message[i] >= 'a' && message[i] <= 'z'))
-			encrypted_message[i] = ((message[i] - 'a') + key[i%key_len]) % 26 + 'a';
-		else encrypted_message[i] = message[i];
-	}
-	return 0;
-}
-
-int shift_decipher(const uint8_t* encrypted_message, size_t size, uint8_t* decrypted_message, const uint8_t* key, size_t key_len)
-{
-	if(!encrypted_message || size == 0 || !decrypted_message) return 1;
-	for(size_t i=0; i<size; ++i)
-	{
-		if(encrypted_message[i] >= 'A' && encrypted_message[i] <= 'Z')
-			decrypted_message[i] = (26 + (encrypted_message[i] - 'A') - key[i%key_len]) % 26 + 'A';
-		else if(encrypted_message[i] >= 'a' && encrypted_message[i] <= 'z')
-			decrypted_message[i] = (26 + (encrypted_message[i] - 'a') - key[i%key_len]) % 26 + 'a';
-		else decrypted_message[i] = encrypted_message[i];
-	}
-	return 0;
-}
-
-int main(int argc, char *argv[])
-{
-	if(argc > 3 && argc < 26+3) // shiftc -c "message" 1 2 3 4
-	{
-		const char* command = argv[1];
-		int cipher_mode = 0 == strcmp(command, "-c") ? 0 : (0 == strcmp(command, "-d") ? 1 : -1);
-		if(!(cipher_mode == 0 || cipher_mode == 1))
-		{
-			fprintf(stderr, "Invalid command! '%s'\n", command);
-			return 1;
-		}
-		const char* message = argv[2];
-		size_t msg_len = strlen(message), key_len = argc - 3;
-		uint8_t keys[26];
-		printf("Keys[%u]: ", key_len);
-		for(int i=3; i<argc; ++i)
-		{
-			keys[i-3] = (uint8_t)atoi(argv[i]);
-			printf("%hhu ", keys[i-3]);
-		}
-		printf("\n");
-		char *buffer = calloc(msg_len+1, 1);
-		if(!buffer) return -2;
-		if(cipher_mode == 0) // cipher
-		{
-			if(0 != shift_cipher(message, msg_len, buffer, keys, key_len))
-			{
-				fprintf(stderr, "> Cipher failed!\n");
-				free(buffer);
-				return -3;
-			}
-			else
-			{
-				buffer[msg_len] = '\0';
-				printf("\"%s\"\n", buffer);
-			}
-		}
-		else
-		{
-			if(0 != shift_decipher(message, msg_len, buffer, keys, key_len))
-			{
-				fprintf(stderr, "> Decipher failed!\n");
-				free(buffer);
-				return -3;
-			}
-			else
-			{
-				buffer[msg_len] = '\0';
-				printf("\"%s\"\n", buffer);
-			}
-		}
-		free(buffer);
-		return 0;
-	}
-	puts("shiftc [-c|-d] \"<message>\" <key_0> [key_1] ...\n");
-	return 0;
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#	define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#	include <fcntl.h>
+#	include <io.h>
+#	include <malloc.h>
+#else
+#	include <pthread.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#	define SHIFT_MMAP 1
+#	define SHIFT_THREADS 1
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	include <immintrin.h>
+#	define SHIFT_X86 1
+#	define SHIFT_TARGET(isa) __attribute__((target(isa)))
+#elif defined(__ARM_NEON)
+#	include <arm_neon.h>
+#endif
+
+#define SHIFT_MAX_WIDTH 64
+#define SHIFT_BLOCK_SIZE (1 << 20)
+#define SHIFT_BLOCK_ALIGN 64
+#define SHIFT_CHUNK_SIZE (256 << 10)
+#define SHIFT_CHUNKS_PER_THREAD 4
+#define SHIFT_MAX_THREADS 256
+#define SHIFT_GUESS_KEY_LEN 64
+#define SHIFT_SAMPLE_SIZE (64 << 10)
+
+// A kernel runs the message through a key stream already reduced to 0..25 and pre-inverted for
+// deciphering, so both directions are the same add-and-wrap. key_stream holds key_len +
+// SHIFT_MAX_WIDTH bytes so a full vector can be loaded from any phase. Returns the next phase.
+typedef size_t (*shift_kernel)(const uint8_t* in, uint8_t* out, size_t size, const uint8_t* key_stream, size_t key_len, size_t phase);
+
+static int shift_cipher_scalar(const uint8_t* message, size_t size, uint8_t* encrypted_message, const uint8_t* key, size_t key_len)
+{
+	for(size_t i=0; i<size; ++i)
+	{
+		if((message[i] >= 'A' && message[i] <= 'Z'))
+			encrypted_message[i] = ((message[i] - 'A') + key[i%key_len]) % 26 + 'A';
+		else if((message[i] >= 'a' && message[i] <= 'z'))
+			encrypted_message[i] = ((message[i] - 'a') + key[i%key_len]) % 26 + 'a';
+		else encrypted_message[i] = message[i];
+	}
+	return 0;
+}
+
+static int shift_decipher_scalar(const uint8_t* encrypted_message, size_t size, uint8_t* decrypted_message, const uint8_t* key, size_t key_len)
+{
+	for(size_t i=0; i<size; ++i)
+	{
+		if(encrypted_message[i] >= 'A' && encrypted_message[i] <= 'Z')
+			decrypted_message[i] = (26 + (encrypted_message[i] - 'A') - key[i%key_len]) % 26 + 'A';
+		else if(encrypted_message[i] >= 'a' && encrypted_message[i] <= 'z')
+			decrypted_message[i] = (26 + (encrypted_message[i] - 'a') - key[i%key_len]) % 26 + 'a';
+		else decrypted_message[i] = encrypted_message[i];
+	}
+	return 0;
+}
+
+// Folding in 0x20 maps both cases onto 'a'..'z', so one unsigned compare classifies a byte and
+// the letter's own case survives because only the distance to its shifted value is added back.
+static size_t shift_bytes(const uint8_t* in, uint8_t* out, size_t size, const uint8_t* key_stream, size_t key_len, size_t phase)
+{
+	for(size_t i=0; i<size; ++i)
+	{
+		uint8_t c = in[i], x = (uint8_t)((c | 0x20) - 'a'), y = (uint8_t)(x + key_stream[phase]);
+		y = (uint8_t)(y - (y >= 26 ? 26 : 0));
+		out[i] = x < 26 ? (uint8_t)(c + y - x) : c;
+		if(++phase == key_len) phase = 0;
+	}
+	return phase;
+}
+
+#if defined(SHIFT_X86)
+SHIFT_TARGET("sse2")
+static size_t shift_bytes_sse2(const uint8_t* in, uint8_t* out, size_t size, const uint8_t* key_stream, size_t key_len, size_t phase)
+{
+	const __m128i lower = _mm_set1_epi8(0x20), a = _mm_set1_epi8('a'), last = _mm_set1_epi8(25), wrap = _mm_set1_epi8(26);
+	size_t step = 16 % key_len;
+	for(; size >= 16; size -= 16, in += 16, out += 16)
+	{
+		__m128i c = _mm_loadu_si128((const __m128i*)in);
+		__m128i k = _mm_loadu_si128((const __m128i*)(key_stream + phase));
+		__m128i x = _mm_sub_epi8(_mm_or_si128(c, lower), a);
+		__m128i letter = _mm_cmpeq_epi8(_mm_min_epu8(x, last), x);
+		__m128i y = _mm_add_epi8(x, k);
+		y = _mm_sub_epi8(y, _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(y, wrap), y), wrap));
+		_mm_storeu_si128((__m128i*)out, _mm_add_epi8(c, _mm_and_si128(letter, _mm_sub_epi8(y, x))));
+		phase += step;
+		if(phase >= key_len) phase -= key_len;
+	}
+	return shift_bytes(in, out, size, key_stream, key_len, phase);
+}
+
+SHIFT_TARGET("avx2")
+static size_t shift_bytes_avx2(const uint8_t* in, uint8_t* out, size_t size, const uint8_t* key_stream, size_t key_len, size_t phase)
+{
+	const __m256i lower = _mm256_set1_epi8(0x20), a = _mm256_set1_epi8('a'), last = _mm256_set1_epi8(25), wrap = _mm256_set1_epi8(26);
+	size_t step = 32 % key_len;
+	for(; size >= 32; size -= 32, in += 32, out += 32)
+	{
+		__m256i c = _mm256_loadu_si256((const __m256i*)in);
+		__m256i k = _mm256_loadu_si256((const __m256i*)(key_stream + phase));
+		__m256i x = _mm256_sub_epi8(_mm256_or_si256(c, lower), a);
+		__m256i letter = _mm256_cmpeq_epi8(_mm256_min_epu8(x, last), x);
+		__m256i y = _mm256_add_epi8(x, k);
+		y = _mm256_sub_epi8(y, _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(y, wrap), y), wrap));
+		_mm256_storeu_si256((__m256i*)out, _mm256_add_epi8(c, _mm256_and_si256(letter, _mm256_sub_epi8(y, x))));
+		phase += step;
+		if(phase >= key_len) phase -= key_len;
+	}
+	return shift_bytes_sse2(in, out, size, key_stream, key_len, phase);
+}
+
+// AVX-512 masks the tail instead of finishing it byte by byte.
+SHIFT_TARGET("avx512f,avx512bw")
+static size_t shift_bytes_avx512(const uint8_t* in, uint8_t* out, size_t size, const uint8_t* key_stream, size_t key_len, size_t phase)
+{
+	const __m512i lower = _mm512_set1_epi8(0x20), a = _mm512_set1_epi8('a'), last = _mm512_set1_epi8(25), wrap = _mm512_set1_epi8(26);
+	size_t step = 64 % key_len;
+	while(size > 0)
+	{
+		size_t count = size < 64 ? size : 64;
+		__mmask64 active = count == 64 ? ~(__mmask64)0 : (((__mmask64)1 << count) - 1);
+		__m512i c = _mm512_maskz_loadu_epi8(active, in);
+		__m512i k = _mm512_loadu_si512((const void*)(key_stream + phase));
+		__m512i x = _mm512_sub_epi8(_mm512_or_si512(c, lower), a);
+		__mmask64 letter = _mm512_cmple_epu8_mask(x, last);
+		__m512i y = _mm512_add_epi8(x, k);
+		y = _mm512_mask_sub_epi8(y, _mm512_cmpge_epu8_mask(y, wrap), y, wrap);
+		_mm512_mask_storeu_epi8(out, active, _mm512_mask_sub_epi8(c, letter, _mm512_add_epi8(c, y), x));
+		if(count < 64) return (phase + count) % key_len;
+		size -= 64, in += 64, out += 64;
+		phase += step;
+		if(phase >= key_len) phase -= key_len;
+	}
+	return phase;
+}
+#elif defined(__ARM_NEON)
+static size_t shift_bytes_neon(const uint8_t* in, uint8_t* out, size_t size, const uint8_t* key_stream, size_t key_len, size_t phase)
+{
+	const uint8x16_t lower = vdupq_n_u8(0x20), a = vdupq_n_u8('a'), last = vdupq_n_u8(25), wrap = vdupq_n_u8(26);
+	size_t step = 16 % key_len;
+	for(; size >= 16; size -= 16, in += 16, out += 16)
+	{
+		uint8x16_t c = vld1q_u8(in);
+		uint8x16_t k = vld1q_u8(key_stream + phase);
+		uint8x16_t x = vsubq_u8(vorrq_u8(c, lower), a);
+		uint8x16_t letter = vcleq_u8(x, last);
+		uint8x16_t y = vaddq_u8(x, k);
+		y = vsubq_u8(y, vandq_u8(vcgeq_u8(y, wrap), wrap));
+		vst1q_u8(out, vaddq_u8(c, vandq_u8(letter, vsubq_u8(y, x))));
+		phase += step;
+		if(phase >= key_len) phase -= key_len;
+	}
+	return shift_bytes(in, out, size, key_stream, key_len, phase);
+}
+#endif
+
+// Picked from what the running CPU supports rather than what the compiler targeted. shift_init
+// stores the pick in the state, so pool workers never run this themselves.
+static shift_kernel shift_select_kernel(void)
+{
+	shift_kernel kernel;
+#if defined(SHIFT_X86)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512bw")) kernel = shift_bytes_avx512;
+	else if(__builtin_cpu_supports("avx2")) kernel = shift_bytes_avx2;
+	else if(__builtin_cpu_supports("sse2")) kernel = shift_bytes_sse2;
+	else kernel = shift_bytes;
+#elif defined(__ARM_NEON)
+	kernel = shift_bytes_neon;
+#else
+	kernel = shift_bytes;
+#endif
+	return kernel;
+}
+
+// Carries the key phase from one block to the next, so a message split anywhere ciphers the
+// same as in one piece. Reference mode keeps the raw key for keys the kernels cannot reproduce.
+typedef struct shift_state
+{
+	uint8_t *key_stream;
+	size_t key_len;
+	size_t phase;
+	int decipher;
+	int reference;
+	shift_kernel kernel;
+} shift_state;
+
+int shift_init(shift_state* state, const uint8_t* key, size_t key_len, int decipher)
+{
+	if(!state) return 1;
+	state->key_stream = 0;
+	if(!key || key_len == 0) return 1;
+	state->key_len = key_len;
+	state->phase = 0;
+	state->decipher = decipher;
+	state->reference = 0;
+	state->kernel = shift_select_kernel();
+	// Shifts of 26 or more can take the deciphering reference below zero; only it reproduces those bytes.
+	for(size_t i=0; decipher && i<key_len; ++i)
+		if(key[i] >= 26) state->reference = 1;
+	// The reference reads a whole key past the phase, the kernels at most one vector.
+	size_t tail = state->reference && key_len > SHIFT_MAX_WIDTH ? key_len : SHIFT_MAX_WIDTH;
+	state->key_stream = malloc(key_len + tail);
+	if(!state->key_stream) return 1;
+	for(size_t i=0; i<key_len; ++i)
+	{
+		uint8_t k = state->reference ? key[i] : key[i] % 26;
+		state->key_stream[i] = decipher && !state->reference ? (uint8_t)((26 - k) % 26) : k;
+	}
+	for(size_t i=key_len; i<key_len + tail; ++i)
+		state->key_stream[i] = state->key_stream[i - key_len];
+	return 0;
+}
+
+// Ciphers size bytes starting at the given key phase without touching the state, so disjoint
+// parts of a message can run at once.
+static void shift_run(const shift_state* state, const uint8_t* in, size_t size, uint8_t* out, size_t phase)
+{
+	// The raw key repeats in key_stream, so starting there at the phase rotates it for the reference.
+	if(state->reference) shift_decipher_scalar(in, size, out, state->key_stream + phase, state->key_len);
+	else state->kernel(in, out, size, state->key_stream, state->key_len, phase);
+}
+
+// in and out may be the same buffer.
+int shift_update(shift_state* state, const uint8_t* in, size_t size, uint8_t* out)
+{
+	if(!state || !state->key_stream || (size > 0 && (!in || !out))) return 1;
+	shift_run(state, in, size, out, state->phase);
+	state->phase = (state->phase + size) % state->key_len;
+	return 0;
+}
+
+void shift_release(shift_state* state)
+{
+	if(!state) return;
+	free(state->key_stream);
+	state->key_stream = 0;
+}
+
+int shift_cipher(const uint8_t* message, size_t size, uint8_t* encrypted_message, const uint8_t* key, size_t key_len)
+{
+	if(!message || size == 0 || !encrypted_message || !key || key_len == 0) return 1;
+	shift_state state;
+	if(0 != shift_init(&state, key, key_len, 0))
+		return shift_cipher_scalar(message, size, encrypted_message, key, key_len);
+	shift_update(&state, message, size, encrypted_message);
+	shift_release(&state);
+	return 0;
+}
+
+int shift_decipher(const uint8_t* encrypted_message, size_t size, uint8_t* decrypted_message, const uint8_t* key, size_t key_len)
+{
+	if(!encrypted_message || size == 0 || !decrypted_message || !key || key_len == 0) return 1;
+	shift_state state;
+	if(0 != shift_init(&state, key, key_len, 1))
+		return shift_decipher_scalar(encrypted_message, size, decrypted_message, key, key_len);
+	shift_update(&state, encrypted_message, size, decrypted_message);
+	shift_release(&state);
+	return 0;
+}
+
+typedef struct shift_pool shift_pool;
+
+// A pool job runs task(context, i) for every i below its task count.
+typedef void (*shift_task)(void* context, size_t index);
+
+#if defined(SHIFT_THREADS)
+// Workers park between jobs and every thread, the caller included, takes the next unclaimed
+// task until none are left, so a slow thread only ever holds one task back.
+struct shift_pool
+{
+	pthread_t threads[SHIFT_MAX_THREADS];
+	size_t thread_count;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	unsigned int generation;
+	size_t busy;
+	int stopping;
+	shift_task task;
+	void *context;
+	size_t task_count;
+	size_t next_task;
+};
+
+static void shift_pool_drain(shift_pool* pool)
+{
+	for(;;)
+	{
+		pthread_mutex_lock(&pool->lock);
+		size_t index = pool->next_task++;
+		pthread_mutex_unlock(&pool->lock);
+		if(index >= pool->task_count) break;
+		pool->task(pool->context, index);
+	}
+}
+
+static void* shift_pool_worker(void* argument)
+{
+	shift_pool *pool = argument;
+	unsigned int generation = 0;
+	pthread_mutex_lock(&pool->lock);
+	for(;;)
+	{
+		while(!pool->stopping && pool->generation == generation)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if(pool->stopping) break;
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+		shift_pool_drain(pool);
+		pthread_mutex_lock(&pool->lock);
+		if(--pool->busy == 0) pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+// Starts thread_count - 1 workers; the thread that runs the jobs is the last one.
+static shift_pool* shift_pool_create(size_t thread_count)
+{
+	if(thread_count < 2) return NULL;
+	shift_pool *pool = calloc(1, sizeof(shift_pool));
+	if(!pool) return NULL;
+	if(0 != pthread_mutex_init(&pool->lock, NULL)) { free(pool); return NULL; }
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	if(thread_count > SHIFT_MAX_THREADS) thread_count = SHIFT_MAX_THREADS;
+	while(pool->thread_count < thread_count - 1 && 0 == pthread_create(&pool->threads[pool->thread_count], NULL, shift_pool_worker, pool))
+		++pool->thread_count;
+	return pool;
+}
+
+static void shift_pool_destroy(shift_pool* pool)
+{
+	if(!pool) return;
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for(size_t i=0; i<pool->thread_count; ++i)
+		pthread_join(pool->threads[i], NULL);
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+static void shift_pool_run(shift_pool* pool, shift_task task, void* context, size_t task_count)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->task = task;
+	pool->context = context;
+	pool->task_count = task_count;
+	pool->next_task = 0;
+	pool->busy = pool->thread_count;
+	++pool->generation;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	shift_pool_drain(pool);
+	pthread_mutex_lock(&pool->lock);
+	while(pool->busy > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+#endif
+
+// Without a pool the tasks run in order on the calling thread.
+static void shift_pool_for(shift_pool* pool, shift_task task, void* context, size_t task_count)
+{
+#if defined(SHIFT_THREADS)
+	if(pool) { shift_pool_run(pool, task, context, task_count); return; }
+#else
+	(void)pool;
+#endif
+	for(size_t i=0; i<task_count; ++i)
+		task(context, i);
+}
+
+typedef struct shift_chunks
+{
+	const shift_state *state;
+	const uint8_t *in;
+	uint8_t *out;
+	size_t size;
+} shift_chunks;
+
+// Each chunk's key phase follows from its offset, which is all that ties the chunks together.
+static void shift_chunk_task(void* context, size_t index)
+{
+	const shift_chunks *chunks = context;
+	size_t offset = index * SHIFT_CHUNK_SIZE;
+	size_t count = chunks->size - offset < SHIFT_CHUNK_SIZE ? chunks->size - offset : SHIFT_CHUNK_SIZE;
+	shift_run(chunks->state, chunks->in + offset, count, chunks->out + offset, (chunks->state->phase + offset) % chunks->state->key_len);
+}
+
+// Each block is ciphered in full before it is written, so output stays in order with no reordering copy.
+static void shift_block(shift_state* state, shift_pool* pool, const uint8_t* in, size_t size, uint8_t* out)
+{
+	if(!pool) { shift_update(state, in, size, out); return; }
+	shift_chunks chunks = {state, in, out, size};
+	shift_pool_for(pool, shift_chunk_task, &chunks, (size + SHIFT_CHUNK_SIZE - 1) / SHIFT_CHUNK_SIZE);
+	state->phase = (state->phase + size) % state->key_len;
+}
+
+// A pool gets a few chunks per thread in every block, so early finishers have work to take.
+static size_t shift_block_size(const shift_pool* pool)
+{
+#if defined(SHIFT_THREADS)
+	if(pool) return (pool->thread_count + 1) * SHIFT_CHUNKS_PER_THREAD * SHIFT_CHUNK_SIZE;
+#else
+	(void)pool;
+#endif
+	return SHIFT_BLOCK_SIZE;
+}
+
+static uint8_t* shift_alloc_block(size_t size)
+{
+#if defined(_WIN32)
+	return _aligned_malloc(size, SHIFT_BLOCK_ALIGN);
+#else
+	void *block = 0;
+	return 0 == posix_memalign(&block, SHIFT_BLOCK_ALIGN, size) ? block : 0;
+#endif
+}
+
+static void shift_free_block(uint8_t* block)
+{
+#if defined(_WIN32)
+	_aligned_free(block);
+#else
+	free(block);
+#endif
+}
+
+// Reads, ciphers in place and writes one fixed-size block at a time, so memory stays constant
+// whatever the input size. The streams are unbuffered: blocks go straight to read and write.
+static int shift_stream(FILE* in, FILE* out, shift_state* state, shift_pool* pool)
+{
+	size_t block_size = shift_block_size(pool);
+	uint8_t *block = shift_alloc_block(block_size);
+	if(!block) return -2;
+	setvbuf(in, NULL, _IONBF, 0);
+	setvbuf(out, NULL, _IONBF, 0);
+	int result = 0;
+	for(;;)
+	{
+		size_t size = fread(block, 1, block_size, in);
+		shift_block(state, pool, block, size, block);
+		if(size > 0 && fwrite(block, 1, size, out) != size)
+		{
+			result = -4;
+			break;
+		}
+		if(size < block_size)
+		{
+			if(ferror(in)) result = -4;
+			break;
+		}
+	}
+	shift_free_block(block);
+	return result;
+}
+
+#if defined(SHIFT_MMAP)
+// A regular input file is mapped instead of read, so the kernels take their input straight from
+// the page cache. Returns 1 when the input cannot be mapped, leaving it to shift_stream.
+static int shift_stream_mapped(FILE* in, FILE* out, shift_state* state, shift_pool* pool)
+{
+	struct stat info;
+	int fd = fileno(in);
+	off_t start = lseek(fd, 0, SEEK_CUR);
+	size_t block_size = shift_block_size(pool);
+	if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || start < 0 || info.st_size - start < SHIFT_BLOCK_SIZE) return 1;
+	size_t size = (size_t)info.st_size;
+	uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(map == MAP_FAILED) return 1;
+	posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+	uint8_t *block = shift_alloc_block(block_size);
+	int result = block ? 0 : -2;
+	setvbuf(out, NULL, _IONBF, 0);
+	for(size_t offset=(size_t)start; block && offset<size; offset+=block_size)
+	{
+		size_t count = size - offset < block_size ? size - offset : block_size;
+		shift_block(state, pool, map + offset, count, block);
+		if(fwrite(block, 1, count, out) != count)
+		{
+			result = -4;
+			break;
+		}
+	}
+	shift_free_block(block);
+	munmap(map, size);
+	return result;
+}
+#endif
+
+// "-" or no path at all stands for stdin/stdout.
+static int shift_file(const char* input_path, const char* output_path, const uint8_t* key, size_t key_len, int decipher, size_t thread_count)
+{
+	int use_stdin = !input_path || 0 == strcmp(input_path, "-"), use_stdout = !output_path || 0 == strcmp(output_path, "-");
+	FILE *in = use_stdin ? stdin : fopen(input_path, "rb");
+	if(!in)
+	{
+		fprintf(stderr, "> Could not open '%s'!\n", input_path);
+		return -4;
+	}
+	FILE *out = use_stdout ? stdout : fopen(output_path, "wb");
+	if(!out)
+	{
+		fprintf(stderr, "> Could not create '%s'!\n", output_path);
+		if(!use_stdin) fclose(in);
+		return -4;
+	}
+#if defined(_WIN32)
+	if(use_stdin) _setmode(_fileno(stdin), _O_BINARY);
+	if(use_stdout) _setmode(_fileno(stdout), _O_BINARY);
+#endif
+	shift_state state;
+	int result = 0 == shift_init(&state, key, key_len, decipher) ? 1 : -2;
+	shift_pool *pool = NULL;
+#if defined(SHIFT_THREADS)
+	if(result == 1) pool = shift_pool_create(thread_count);
+#else
+	(void)thread_count;
+#endif
+#if defined(SHIFT_MMAP)
+	if(result == 1) result = shift_stream_mapped(in, out, &state, pool);
+#endif
+	if(result == 1) result = shift_stream(in, out, &state, pool);
+#if defined(SHIFT_THREADS)
+	shift_pool_destroy(pool);
+#endif
+	shift_release(&state);
+	if(fflush(out) != 0 && result == 0) result = -4;
+	if(!use_stdin) fclose(in);
+	if(!use_stdout && fclose(out) != 0 && result == 0) result = -4;
+	if(result == -4) fprintf(stderr, "> I/O failed!\n");
+	return result;
+}
+
+// Keys gather shifts from the command line, passphrases and key files, already reduced mod 26.
+typedef struct shift_key
+{
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+} shift_key;
+
+static int shift_key_push(shift_key* key, uint8_t shift)
+{
+	if(key->size == key->capacity)
+	{
+		size_t capacity = key->capacity ? key->capacity * 2 : 64;
+		uint8_t *data = realloc(key->data, capacity);
+		if(!data) return 1;
+		key->data = data;
+		key->capacity = capacity;
+	}
+	key->data[key->size++] = shift;
+	return 0;
+}
+
+// A number, optionally negative, is one shift; any other word adds a shift per letter, 'a' being 0.
+static int shift_key_parse(shift_key* key, const char* text, size_t size)
+{
+	for(size_t i=0; i<size;)
+	{
+		int negative = text[i] == '-' && i+1 < size && text[i+1] >= '0' && text[i+1] <= '9';
+		if(negative || (text[i] >= '0' && text[i] <= '9'))
+		{
+			unsigned int shift = 0;
+			for(i += negative; i<size && text[i] >= '0' && text[i] <= '9'; ++i)
+				shift = (shift * 10 + (text[i] - '0')) % 26;
+			if(shift_key_push(key, (uint8_t)(negative ? (26 - shift) % 26 : shift))) return 1;
+		}
+		else
+		{
+			uint8_t x = (uint8_t)((text[i] | 0x20) - 'a');
+			if(x < 26 && shift_key_push(key, x)) return 1;
+			++i;
+		}
+	}
+	return 0;
+}
+
+// Reads everything left in file into one allocation, or returns NULL on failure.
+static uint8_t* shift_read_all(FILE* file, size_t* size)
+{
+	uint8_t *data = 0;
+	size_t capacity = 0;
+	*size = 0;
+	for(;;)
+	{
+		if(*size == capacity)
+		{
+			uint8_t *grown = realloc(data, capacity = capacity ? capacity * 2 : 4096);
+			if(!grown) { free(data); return NULL; }
+			data = grown;
+		}
+		size_t count = fread(data + *size, 1, capacity - *size, file);
+		*size += count;
+		if(count == 0)
+		{
+			if(ferror(file)) { free(data); return NULL; }
+			return data;
+		}
+	}
+}
+
+static int shift_key_read(shift_key* key, const char* path)
+{
+	FILE *file = fopen(path, "rb");
+	if(!file) return 1;
+	size_t size;
+	uint8_t *text = shift_read_all(file, &size);
+	fclose(file);
+	int result = text ? shift_key_parse(key, (const char*)text, size) : 1;
+	free(text);
+	return result;
+}
+
+// Relative frequencies of the letters a to z in English text.
+static const double shift_english[26] = {
+	0.08167, 0.01492, 0.02782, 0.04253, 0.12702, 0.02228, 0.02015, 0.06094, 0.06966, 0.00153, 0.00772, 0.04025, 0.02406,
+	0.06749, 0.07507, 0.01929, 0.00095, 0.05987, 0.06327, 0.09056, 0.02758, 0.00978, 0.02360, 0.00150, 0.01974, 0.00074 };
+
+// Folds letters of either case to 0..25 the way the kernels do and every other byte to 26, so
+// histograms index their bins directly and keep non-letters in a bin of their own.
+static void shift_fold_bytes(const uint8_t* in, uint8_t* out, size_t size)
+{
+	for(size_t i=0; i<size; ++i)
+	{
+		uint8_t x = (uint8_t)((in[i] | 0x20) - 'a');
+		out[i] = x < 26 ? x : 26;
+	}
+}
+
+#if defined(SHIFT_X86)
+SHIFT_TARGET("sse2")
+static void shift_fold_sse2(const uint8_t* in, uint8_t* out, size_t size)
+{
+	const __m128i lower = _mm_set1_epi8(0x20), a = _mm_set1_epi8('a'), other = _mm_set1_epi8(26);
+	for(; size >= 16; size -= 16, in += 16, out += 16)
+		_mm_storeu_si128((__m128i*)out, _mm_min_epu8(_mm_sub_epi8(_mm_or_si128(_mm_loadu_si128((const __m128i*)in), lower), a), other));
+	shift_fold_bytes(in, out, size);
+}
+
+SHIFT_TARGET("avx2")
+static void shift_fold_avx2(const uint8_t* in, uint8_t* out, size_t size)
+{
+	const __m256i lower = _mm256_set1_epi8(0x20), a = _mm256_set1_epi8('a'), other = _mm256_set1_epi8(26);
+	for(; size >= 32; size -= 32, in += 32, out += 32)
+		_mm256_storeu_si256((__m256i*)out, _mm256_min_epu8(_mm256_sub_epi8(_mm256_or_si256(_mm256_loadu_si256((const __m256i*)in), lower), a), other));
+	shift_fold_sse2(in, out, size);
+}
+#elif defined(__ARM_NEON)
+static void shift_fold_neon(const uint8_t* in, uint8_t* out, size_t size)
+{
+	const uint8x16_t lower = vdupq_n_u8(0x20), a = vdupq_n_u8('a'), other = vdupq_n_u8(26);
+	for(; size >= 16; size -= 16, in += 16, out += 16)
+		vst1q_u8(out, vminq_u8(vsubq_u8(vorrq_u8(vld1q_u8(in), lower), a), other));
+	shift_fold_bytes(in, out, size);
+}
+#endif
+
+static void shift_fold(const uint8_t* in, uint8_t* out, size_t size)
+{
+#if defined(SHIFT_X86)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) shift_fold_avx2(in, out, size);
+	else if(__builtin_cpu_supports("sse2")) shift_fold_sse2(in, out, size);
+	else shift_fold_bytes(in, out, size);
+#elif defined(__ARM_NEON)
+	shift_fold_neon(in, out, size);
+#else
+	shift_fold_bytes(in, out, size);
+#endif
+}
+
+// counts holds key_len columns of 27 bins. The key advances on every byte, letter or not, so the
+// column rolls with the byte position rather than the letter count.
+static void shift_histogram(const uint8_t* folded, size_t size, size_t key_len, size_t* counts)
+{
+	memset(counts, 0, key_len * 27 * sizeof(size_t));
+	size_t column = 0, end = key_len * 27;
+	for(size_t i=0; i<size; ++i)
+	{
+		++counts[column + folded[i]];
+		column += 27;
+		if(column == end) column = 0;
+	}
+}
+
+// Mean index of coincidence over the columns; columns ciphered with a single shift keep the
+// English value near 0.066 while mixed ones fall towards 1/26.
+static double shift_coincidence(const size_t* counts, size_t key_len)
+{
+	double total = 0.0;
+	size_t columns = 0;
+	for(size_t c=0; c<key_len; ++c)
+	{
+		const size_t *bins = counts + c * 27;
+		double letters = 0.0, pairs = 0.0;
+		for(int x=0; x<26; ++x)
+		{
+			letters += (double)bins[x];
+			pairs += (double)bins[x] * ((double)bins[x] - 1.0);
+		}
+		if(letters > 1.0)
+		{
+			total += pairs / (letters * (letters - 1.0));
+			++columns;
+		}
+	}
+	return columns ? total / (double)columns : 0.0;
+}
+
+// The shift that makes a column's letters fit English best by chi-squared.
+static uint8_t shift_best_shift(const size_t* bins)
+{
+	double letters = 0.0, best = -1.0;
+	uint8_t shift = 0;
+	for(int x=0; x<26; ++x)
+		letters += (double)bins[x];
+	for(int s=0; s<26 && letters > 0.0; ++s)
+	{
+		double chi = 0.0;
+		for(int x=0; x<26; ++x)
+		{
+			double expected = letters * shift_english[x], delta = (double)bins[x + s < 26 ? x + s : x + s - 26] - expected;
+			chi += delta * delta / expected;
+		}
+		if(best < 0.0 || chi < best)
+		{
+			best = chi;
+			shift = (uint8_t)s;
+		}
+	}
+	return shift;
+}
+
+typedef struct shift_lengths
+{
+	const uint8_t *folded;
+	size_t size;
+	double *coincidence;
+} shift_lengths;
+
+static void shift_length_task(void* context, size_t index)
+{
+	shift_lengths *lengths = context;
+	size_t key_len = index + 1;
+	size_t *counts = malloc(key_len * 27 * sizeof(size_t));
+	lengths->coincidence[index] = 0.0;
+	if(!counts) return;
+	shift_histogram(lengths->folded, lengths->size, key_len, counts);
+	lengths->coincidence[index] = shift_coincidence(counts, key_len);
+	free(counts);
+}
+
+// Recovers the key of a message whose plaintext is English. Every length up to max_key_len is
+// scored by its index of coincidence on a sample, one pool task per length. A multiple of the
+// key scores as well as the key itself, so the shortest length within 10% of the best wins.
+// Each column of the whole message then takes its chi-squared best shift.
+static int shift_analyze(const uint8_t* message, size_t size, size_t max_key_len, shift_pool* pool, shift_key* key, double* coincidence)
+{
+	if(!message || size < 2) return 1;
+	// Columns shorter than a few dozen bytes score mostly noise.
+	if(max_key_len > size / 32) max_key_len = size < 64 ? 1 : size / 32;
+	uint8_t *folded = malloc(size);
+	double *scores = calloc(max_key_len, sizeof(double));
+	size_t *counts = 0;
+	int result = 1;
+	if(folded && scores)
+	{
+		shift_fold(message, folded, size);
+		size_t sample = max_key_len * 1024 > SHIFT_SAMPLE_SIZE ? max_key_len * 1024 : SHIFT_SAMPLE_SIZE;
+		shift_lengths lengths = {folded, size < sample ? size : sample, scores};
+		shift_pool_for(pool, shift_length_task, &lengths, max_key_len);
+		size_t key_len = 1;
+		double best = 0.0;
+		for(size_t i=0; i<max_key_len; ++i)
+			if(scores[i] > best) best = scores[i];
+		while(key_len < max_key_len && scores[key_len-1] < best * 0.9)
+			++key_len;
+		counts = malloc(key_len * 27 * sizeof(size_t));
+		if(counts)
+		{
+			shift_histogram(folded, size, key_len, counts);
+			key->size = 0;
+			result = 0;
+			for(size_t c=0; c<key_len && result == 0; ++c)
+				result = shift_key_push(key, shift_best_shift(counts + c * 27));
+			*coincidence = scores[key_len-1];
+		}
+	}
+	free(counts);
+	free(scores);
+	free(folded);
+	return result;
+}
+
+// Analyzes message, or the input file when there is none; "-" or no path at all stands for stdin.
+static int shift_analyze_file(const char* input_path, const char* message, size_t max_key_len, size_t thread_count)
+{
+	size_t size = message ? strlen(message) : 0;
+	uint8_t *data = 0;
+	if(!message)
+	{
+		int use_stdin = !input_path || 0 == strcmp(input_path, "-");
+		FILE *in = use_stdin ? stdin : fopen(input_path, "rb");
+		if(!in)
+		{
+			fprintf(stderr, "> Could not open '%s'!\n", input_path);
+			return -4;
+		}
+#if defined(_WIN32)
+		if(use_stdin) _setmode(_fileno(stdin), _O_BINARY);
+#endif
+		data = shift_read_all(in, &size);
+		if(!use_stdin) fclose(in);
+		if(!data)
+		{
+			fprintf(stderr, "> I/O failed!\n");
+			return -4;
+		}
+	}
+	shift_key key = {0, 0, 0};
+	double coincidence = 0.0;
+#if defined(SHIFT_THREADS)
+	shift_pool *pool = shift_pool_create(thread_count);
+#else
+	shift_pool *pool = NULL;
+	(void)thread_count;
+#endif
+	int result = shift_analyze(message ? (const uint8_t*)message : data, size, max_key_len, pool, &key, &coincidence);
+#if defined(SHIFT_THREADS)
+	shift_pool_destroy(pool);
+#endif
+	free(data);
+	if(result != 0)
+	{
+		fprintf(stderr, "> Analysis failed!\n");
+		free(key.data);
+		return -3;
+	}
+	printf("Key length: %zu (index of coincidence %.4f)\n", key.size, coincidence);
+	printf("Keys[%zu]: ", key.size);
+	for(size_t i=0; i<key.size; ++i)
+		printf("%hhu ", key.data[i]);
+	printf("\n\"");
+	for(size_t i=0; i<key.size; ++i)
+		putchar('a' + key.data[i]);
+	printf("\"\n");
+	free(key.data);
+	return 0;
+}
+
+// A dash followed by a digit is a negative shift and a lone dash is stdio, not an option.
+static int shift_is_option(const char* arg)
+{
+	return arg[0] == '-' && arg[1] != '\0' && !(arg[1] >= '0' && arg[1] <= '9');
+}
+
+int main(int argc, char *argv[])
+{
+	// shiftc -c "message" 1 2 3 4 | shiftc -c -p lemon "message" | shiftc -c -i in.txt -o out.txt -j 8 -k key.txt | shiftc -a -i in.txt
+	if(argc > 3 || (argc > 1 && 0 == strcmp(argv[1], "-a")))
+	{
+		const char* command = argv[1];
+		int cipher_mode = 0 == strcmp(command, "-c") ? 0 : (0 == strcmp(command, "-d") ? 1 : (0 == strcmp(command, "-a") ? 2 : -1));
+		if(cipher_mode < 0)
+		{
+			fprintf(stderr, "Invalid command! '%s'\n", command);
+			return 1;
+		}
+		// Options may come anywhere, so the first pass settles the mode before any key text is read.
+		const char *input_path = 0, *output_path = 0, *message = 0;
+		size_t thread_count = 0, max_key_len = SHIFT_GUESS_KEY_LEN;
+		for(int arg=2; arg<argc; ++arg)
+		{
+			if(!shift_is_option(argv[arg])) continue;
+			if(arg+1 == argc || strlen(argv[arg]) != 2 || !strchr("iojlpk", argv[arg][1]))
+			{
+				fprintf(stderr, "Invalid option! '%s'\n", argv[arg]);
+				return 1;
+			}
+			const char *value = argv[++arg];
+			switch(argv[arg-1][1])
+			{
+				case 'i': input_path = value; break;
+				case 'o': output_path = value; break;
+				case 'j': thread_count = atoi(value) > 1 ? (size_t)atoi(value) : 1; break;
+				case 'l': max_key_len = atoi(value) > 1 ? (size_t)atoi(value) : 1; break;
+			}
+		}
+		int streaming = input_path || output_path || thread_count > 0;
+		int takes_message = cipher_mode == 2 ? !input_path : !streaming;
+		shift_key key = {0, 0, 0};
+		for(int arg=2; arg<argc; ++arg)
+		{
+			int failed = 0;
+			if(shift_is_option(argv[arg]))
+			{
+				const char *option = argv[arg], *value = argv[++arg];
+				if(cipher_mode == 2) continue;
+				if(option[1] == 'p' && 0 != shift_key_parse(&key, value, strlen(value))) failed = -2;
+				else if(option[1] == 'k' && 0 != shift_key_read(&key, value))
+				{
+					fprintf(stderr, "> Could not read the key file '%s'!\n", value);
+					failed = -4;
+				}
+			}
+			else if(takes_message && !message) message = argv[arg];
+			else if(cipher_mode != 2 && 0 != shift_key_parse(&key, argv[arg], strlen(argv[arg]))) failed = -2;
+			if(failed)
+			{
+				free(key.data);
+				return failed;
+			}
+		}
+		if(cipher_mode == 2) // the analysis reports a key instead of taking one
+			return shift_analyze_file(input_path, message, max_key_len, thread_count);
+		const uint8_t *keys = key.data;
+		size_t key_len = key.size;
+		if(key_len > 0 && (streaming || message))
+		{
+			if(streaming)
+			{
+				int result = shift_file(input_path, output_path, keys, key_len, cipher_mode, thread_count);
+				free(key.data);
+				return result;
+			}
+			size_t msg_len = strlen(message);
+			printf("Keys[%zu]: ", key_len);
+			for(size_t i=0; i<key_len; ++i)
+				printf("%hhu ", keys[i]);
+			printf("\n");
+			char *buffer = calloc(msg_len+1, 1);
+			if(!buffer) { free(key.data); return -2; }
+			if(cipher_mode == 0) // cipher
+			{
+				if(0 != shift_cipher((const uint8_t*)message, msg_len, (uint8_t*)buffer, keys, key_len))
+				{
+					fprintf(stderr, "> Cipher failed!\n");
+					free(buffer);
+					free(key.data);
+					return -3;
+				}
+				else
+				{
+					buffer[msg_len] = '\0';
+					printf("\"%s\"\n", buffer);
+				}
+			}
+			else
+			{
+				if(0 != shift_decipher((const uint8_t*)message, msg_len, (uint8_t*)buffer, keys, key_len))
+				{
+					fprintf(stderr, "> Decipher failed!\n");
+					free(buffer);
+					free(key.data);
+					return -3;
+				}
+				else
+				{
+					buffer[msg_len] = '\0';
+					printf("\"%s\"\n", buffer);
+				}
+			}
+			free(buffer);
+			free(key.data);
+			return 0;
+		}
+		free(key.data);
+	}
+	puts("shiftc [-c|-d] [-p <passphrase>] [-k <key file>] \"<message>\" [key_0] [key_1] ...");
+	puts("shiftc [-c|-d] [-i <file>|-] [-o <file>|-] [-j <threads>] [-p <passphrase>] [-k <key file>] [key_0] [key_1] ...");
+	puts("shiftc -a [-i <file>|-] [-j <threads>] [-l <max key length>] [\"<message>\"]");
+	puts("Keys are shifts mod 26: numbers, or words whose letters count from a = 0.\n");
+	return 0;
 }
\ No newline at end of file